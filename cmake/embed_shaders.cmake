@@ -0,0 +1,27 @@
+# Writes a C++ source that embeds SPIR-V binaries as uint32_t arrays.
+#
+# Usage: cmake -DOUTPUT=<file.cc> -DSHADERS=<a.spv,b.spv> -P embed_shaders.cmake
+
+string(REPLACE "," ";" SHADERS "${SHADERS}")
+set(arrays "")
+set(lookups "")
+set(index 0)
+foreach(shader IN LISTS SHADERS)
+  file(READ "${shader}" hex HEX)
+  # SPIR-V is a stream of little-endian 32-bit words.
+  string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1u," words "${hex}")
+  get_filename_component(name "${shader}" NAME)
+  string(APPEND arrays "const std::uint32_t shader_${index}[] = {${words}};\n")
+  string(APPEND lookups "  if (filename == \"${name}\")\n"
+                        "    return shader_${index};\n")
+  math(EXPR index "${index} + 1")
+endforeach()
+
+file(
+  WRITE "${OUTPUT}"
+  "// Generated by cmake/embed_shaders.cmake, do not edit.\n"
+  "#include \"embedded_shaders.hh\"\n\n"
+  "namespace {\n${arrays}} // namespace\n\n"
+  "std::span<const std::uint32_t>\n"
+  "find_embedded_shader(const std::string &filename) {\n"
+  "${lookups}  return {};\n}\n")
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "interval.hh"
+#include "ray.hh"
+
+#include <glm/glm.hpp>
+
+// Axis-aligned box from min to max. The default box is empty.
+struct Aabb {
+  glm::vec3 min;
+  glm::vec3 max;
+
+  Aabb();
+  Aabb(const glm::vec3 &min, const glm::vec3 &max);
+  Aabb(const Aabb &) = default;
+  Aabb(Aabb &&) = default;
+  Aabb &operator=(const Aabb &) = default;
+  Aabb &operator=(Aabb &&) = default;
+
+  [[nodiscard]] glm::vec3 center() const;
+  // Grows this box to also enclose other.
+  void merge(const Aabb &other);
+
+  // Whether ray passes through the box within ray_t, given the reciprocal
+  // of its direction.
+  [[nodiscard]] bool hit(const Ray &ray, const glm::vec3 &inverse_direction,
+                         Interval ray_t) const;
+};
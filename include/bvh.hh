@@ -0,0 +1,52 @@
+#pragma once
+
+#include "aabb.hh"
+#include "hittable.hh"
+#include "hittable_list.hh"
+#include "interval.hh"
+#include "ray.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// Bounding volume hierarchy over the hittables of a list, so that a ray is
+// only tested against the hittables whose boxes it passes through. It finds
+// the same hits as the list. The hittables are shared with the list.
+class Bvh : public Hittable {
+private:
+  // Inner nodes are followed by their first child, leaves hold count
+  // hittables from first on.
+  struct Node {
+    Aabb box;
+    std::uint32_t second_child;
+    std::uint32_t first;
+    std::uint32_t count;
+    std::uint32_t axis;
+  };
+
+  struct Item {
+    Aabb box;
+    std::shared_ptr<Hittable> hittable;
+  };
+
+  // Leaves hold at most this many hittables.
+  static constexpr std::size_t LEAF_SIZE = 2;
+
+  std::vector<Node> _nodes;
+  std::vector<std::shared_ptr<Hittable>> _hittables;
+
+  // Splits items[begin, end) at the median of the box centers along the
+  // axis where they spread the most.
+  void _build(std::vector<Item> &items, std::size_t begin, std::size_t end);
+
+public:
+  explicit Bvh(const HittableList &list);
+
+  std::optional<HitRecord> hit(const Ray &ray, Interval ray_t) const override;
+  bool occluded(const Ray &ray, float t_max) const override;
+
+  Aabb bounding_box() const override;
+};
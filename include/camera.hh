@@ -1,8 +1,17 @@
 #pragma once
 
+#include "environment.hh"
 #include "hittable.hh"
+#include "hittable_list.hh"
+#include "path_guide.hh"
 #include "ray.hh"
+#include "sampler.hh"
+#include "scene.hh"
+#include "viewport.hh"
 
+#include <cstdint>
+#include <memory>
+#include <optional>
 #include <ostream>
 #include <string>
 
@@ -13,39 +22,111 @@ struct CameraConfig {
   int image_width;
   int samples_per_pixel;
   int max_depth;
+  // Portal traversals per path, which do not count towards max_depth.
+  int max_portal_hops;
   float vfov;
   glm::vec3 eye;
   glm::vec3 center;
   glm::vec3 up;
   float defocus_angle;
   float focus_dist;
+  // Finds lights only by hitting them instead of also sampling them at
+  // diffuse bounces, to compare the noise of both.
+  bool bsdf_sampling_only;
+  SamplerKind sampler;
+};
+
+// Views camera of a GPU scene at width by height pixels. Every field is set,
+// with light sampling on and the independent sampler, so that callers only
+// change what they compare.
+[[nodiscard]] CameraConfig scene_camera_config(const gpu::Camera &camera,
+                                               std::uint32_t width,
+                                               std::uint32_t height,
+                                               int samples_per_pixel,
+                                               int max_depth,
+                                               int max_portal_hops);
+
+// What tracing some pixels cost. rays counts every ray cast against the
+// world, portal_traversals every ray moved by a portal.
+struct TraceCounters {
+  std::uint64_t rays;
+  std::uint64_t portal_traversals;
+};
+
+// The portal traversals of a path so far. Hops in a row, without another
+// bounce in between, are checked for a loop with Brent's algorithm: the ray
+// after 1, 2, 4, ... hops of the run is saved and compared with every later
+// hop.
+struct PortalRun {
+  int hops;
+  int length;
+  Ray saved;
+};
+
+// First hit of the primary rays of a pixel, summed or averaged over its
+// samples. Rays that miss the world count as a zero normal and depth and the
+// background as albedo.
+struct PixelFeatures {
+  glm::vec3 albedo;
+  glm::vec3 normal;
+  float depth;
 };
 
 class Camera {
 private:
   CameraConfig _config;
   int _image_height;
-  glm::vec3 _pixel00_location;
-  glm::vec3 _pixel_delta_u;
-  glm::vec3 _pixel_delta_v;
-  glm::vec3 _defocus_disk_u;
-  glm::vec3 _defocus_disk_v;
+  gpu::Viewport _viewport;
+  std::shared_ptr<const Environment> _environment;
+  std::shared_ptr<PathGuide> _path_guide;
 
   void _write_color(std::ostream &out, const glm::vec3 &color) const;
 
+  // bsdf_pdf is the density of the diffuse bounce that cast ray, 0 if the
+  // bounce did not sample lights. The first hit of ray is added to features
+  // unless it is nullptr.
   glm::vec3 _ray_color(const Ray &ray, const Hittable &world,
-                       int depth = 0) const;
+                       const HittableList &lights, TraceCounters &counters,
+                       Sampler &sampler, PortalRun portal_run, int depth = 0,
+                       float bsdf_pdf = 0,
+                       PixelFeatures *features = nullptr) const;
+
+  // Whether the path may go on after a portal moved it to ray.
+  bool _portal_hop(PortalRun &portal_run, const Ray &ray) const;
 
-  glm::vec3 _sample_square() const;
+  // Density of scattering into scattered at record: the material's, or its
+  // mixture with the path guide at diffuse bounces in guide_leaf.
+  float _scattering_pdf(const HitRecord &record, const Ray &scattered,
+                        std::optional<std::uint32_t> guide_leaf) const;
 
-  glm::vec3 _defocus_disk_sample() const;
+  glm::vec3 _sample_light(const HitRecord &record, const glm::vec3 &albedo,
+                          const Hittable &world, const HittableList &lights,
+                          TraceCounters &counters,
+                          std::optional<std::uint32_t> guide_leaf,
+                          const glm::vec2 &u) const;
 
-  Ray _ray_at_pixel(int y, int x) const;
+  glm::vec3 _sample_environment(const HitRecord &record,
+                                const glm::vec3 &albedo, const Hittable &world,
+                                TraceCounters &counters,
+                                std::optional<std::uint32_t> guide_leaf,
+                                const glm::vec2 &u,
+                                const glm::vec2 &jitter) const;
+
+  glm::vec3 _background(const Ray &ray) const;
+
+  glm::vec3 _defocus_disk_sample(const glm::vec2 &u) const;
+
+  Ray _ray_at_pixel(int y, int x, Sampler &sampler) const;
 
 public:
+  // Probability of sampling the path guide instead of the material at a
+  // diffuse bounce.
+  static constexpr float GUIDE_FRACTION = 0.5f;
+
   static constexpr CameraConfig DEFAULT_CONFIG = {
-      16.0f / 9.0f, 400,        100,       50,   90.0f,
-      {0, 0, 0},    {0, 0, -1}, {0, 1, 0}, 0.0f, 10.0f};
+      16.0f / 9.0f, 400,       100,        50,        16,
+      90.0f,        {0, 0, 0}, {0, 0, -1}, {0, 1, 0}, 0.0f,
+      10.0f,        false,     SamplerKind::INDEPENDENT};
 
   Camera();
   Camera(const Camera &) = default;
@@ -54,6 +135,42 @@ public:
   Camera &operator=(Camera &&) = default;
 
   Camera(const CameraConfig &config);
+  // Uses image_height instead of deriving it from the aspect ratio.
+  Camera(const CameraConfig &config, int image_height);
+
+  // Lights the rays that miss the world with environment instead of the
+  // gradient sky, and samples it at diffuse bounces like the lights. nullptr
+  // restores the sky.
+  void set_environment(std::shared_ptr<const Environment> environment);
+
+  // Guides the diffuse bounces by path_guide once it is trained, and records
+  // the light they find into it. The caller renders in passes and updates
+  // path_guide in between. nullptr turns guiding off.
+  void set_path_guide(std::shared_ptr<PathGuide> path_guide);
 
   void render_to_file(const std::string &filename, const Hittable &world);
+
+  // Sum of samples_per_pixel samples of pixel (x, y).
+  glm::vec3 trace_pixel(int y, int x, const Hittable &world) const;
+  // Also samples the emissive hittables in lights at diffuse bounces and
+  // adds what the samples cost to counters. The samples are
+  // number first_sample and on of the pixel, so that calls for the same
+  // pixel continue its sample sequence instead of repeating it.
+  glm::vec3 trace_pixel(int y, int x, const Hittable &world,
+                        const HittableList &lights, TraceCounters &counters,
+                        std::uint32_t first_sample = 0) const;
+  // Adds count samples, number first_sample and on, to sum one at a time.
+  // Splitting the samples of a pixel over several calls sums them in the
+  // same order as a single call, so the result does not change either.
+  // The first hits of the samples are added to features unless it is
+  // nullptr, which costs no extra rays.
+  void accumulate_pixel(int y, int x, const Hittable &world,
+                        const HittableList &lights, TraceCounters &counters,
+                        std::uint32_t first_sample, std::uint32_t count,
+                        glm::vec3 &sum,
+                        PixelFeatures *features = nullptr) const;
+
+  // Averaged over samples_per_pixel primary rays of their own, for pixels
+  // that were not traced with accumulate_pixel.
+  PixelFeatures trace_features(int y, int x, const Hittable &world) const;
 };
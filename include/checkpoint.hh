@@ -0,0 +1,91 @@
+#pragma once
+
+#include "sampler.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <glm/glm.hpp>
+
+// What a render has to keep to be resumed with the same sample sequences.
+struct CheckpointSettings {
+  std::uint32_t width;
+  std::uint32_t height;
+  SamplerKind sampler;
+  // Samples per pixel the sampler laid its sequences out for.
+  std::uint32_t sequence_samples;
+};
+
+// The accumulation buffer of a CPU render, mapped from a file with mmap so
+// that everything the render adds is in the page cache right away and
+// survives the process being killed. flush writes it to disk. Every pixel
+// keeps the number of samples in its sum, so a resumed render continues
+// each pixel's sample sequence where it stopped.
+//
+// Other processes may map the same file read-only to watch the render
+// without copying it. Every pixel's count doubles as a sequence lock:
+// store_pixel makes it negative while it writes the pixel, and load_pixel
+// reads again until it sees the same count before and after the sum. So a
+// reader never gets a torn pixel, and since every pixel divides by its own
+// count the image is valid whenever it looks; while a round is being added
+// some pixels just have a sample more than others.
+class Checkpoint {
+private:
+  struct Header {
+    // Stored last with release semantics when the file is created, so a
+    // reader that sees it also sees the rest of the header.
+    std::uint64_t magic;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t sampler;
+    std::uint32_t sequence_samples;
+    // Read and written through std::atomic_ref, since other processes
+    // read them while the render runs.
+    std::uint32_t samples;
+    std::uint32_t generation;
+  };
+
+  std::string _filename;
+  int _file = -1;
+  std::size_t _size = 0;
+  void *_mapping = nullptr;
+
+  [[nodiscard]] Header &_header() const;
+  [[nodiscard]] glm::vec4 &_pixel(std::size_t index) const;
+  void _map(int protection);
+
+public:
+  // Opens filename, or creates it with no samples if it does not exist.
+  // Throws if an existing file holds an image of another size or sampler.
+  Checkpoint(const std::string &filename, const CheckpointSettings &settings);
+  // Maps an existing file read-only, for watching a render.
+  explicit Checkpoint(const std::string &filename);
+  Checkpoint(const Checkpoint &) = delete;
+  Checkpoint &operator=(const Checkpoint &) = delete;
+  ~Checkpoint();
+
+  // As stored in the file, which may have been created with other
+  // sequence_samples.
+  [[nodiscard]] CheckpointSettings settings() const;
+
+  // Row by row from the top left, the sum of the samples of every pixel in
+  // rgb and their number in w. For the render, which is the only writer.
+  [[nodiscard]] glm::vec4 *pixels();
+  // Replaces pixel index with sum and its number of samples.
+  void store_pixel(std::size_t index, const glm::vec3 &sum,
+                   std::uint32_t samples);
+  // Pixel index as of a moment when the render was not writing it, for
+  // readers in other processes.
+  [[nodiscard]] glm::vec4 load_pixel(std::size_t index) const;
+
+  // Samples that every pixel has, as of the last publish.
+  [[nodiscard]] std::uint32_t samples() const;
+  // Counts the calls to publish, so readers can tell when to look again.
+  [[nodiscard]] std::uint32_t generation() const;
+  // Called by the render after it has given every pixel samples samples.
+  void publish(std::uint32_t samples);
+
+  // Returns once the pixels are on disk.
+  void flush();
+};
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "scene.hh"
+
+// The random spheres scene with a pair of portals. Draws from random_float,
+// so it is the same for every caller that builds it before drawing other
+// numbers on the same thread.
+gpu::Scene make_demo_scene();
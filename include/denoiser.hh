@@ -0,0 +1,56 @@
+#pragma once
+
+#include "image_io.hh"
+#include "thread_pool.hh"
+
+#include <cstdint>
+#include <vector>
+
+struct FeatureImages {
+  Image albedo;
+  Image normal;
+  // Distance from the camera to the first hit, 0 where nothing was hit.
+  std::vector<float> depth;
+};
+
+struct DenoiserSettings {
+  std::uint32_t iterations;
+  // Edge-stopping scales: neighbours whose color, normal or relative depth
+  // differ by about this much get a weight of 1/e.
+  float color_sigma;
+  float normal_sigma;
+  float depth_sigma;
+};
+
+// Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010). Every
+// iteration blurs with a 5x5 B3 spline kernel whose taps are twice as far
+// apart as in the previous one, and weights each tap down where the color,
+// normal or depth differ from the center pixel. The colors are divided by
+// the albedo before filtering so that texture is kept sharp.
+class Denoiser {
+private:
+  ThreadPool &_pool;
+  DenoiserSettings _settings;
+  std::uint32_t _width = 0;
+  std::uint32_t _height = 0;
+  // One plane per channel, so the filter runs over contiguous floats that
+  // the compiler can vectorize.
+  std::vector<float> _color[3];
+  std::vector<float> _filtered[3];
+  std::vector<float> _normal[3];
+  std::vector<float> _depth;
+  std::vector<float> _weight_sum;
+  // Weights of the tap being filtered, for every pixel of its row.
+  std::vector<float> _tap_weights;
+
+  void _filter_row(std::uint32_t y, int step, float color_sigma);
+
+public:
+  static constexpr DenoiserSettings DEFAULT_SETTINGS = {5, 1.0f, 0.3f, 0.05f};
+
+  explicit Denoiser(ThreadPool &pool,
+                    const DenoiserSettings &settings = DEFAULT_SETTINGS);
+
+  [[nodiscard]] Image denoise(const Image &color,
+                              const FeatureImages &features);
+};
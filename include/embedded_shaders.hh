@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+
+// SPIR-V compiled into the binary when GPU_TRACER_EMBED_SHADERS is on. Returns
+// an empty span for shaders that were not embedded.
+std::span<const std::uint32_t>
+find_embedded_shader(const std::string &filename);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "image_io.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace gpu {
+// One texel of the Environment buffer in shader/common.glsl, which also
+// holds the texel's alias table entry.
+struct EnvironmentTexel {
+  alignas(16) glm::vec3 color;
+  // Density of sampling this texel per unit area of the lat-long map.
+  alignas(4) float pdf;
+  alignas(4) float probability;
+  alignas(4) std::uint32_t alias;
+};
+
+struct EnvironmentHeader {
+  alignas(4) std::uint32_t width;
+  alignas(4) std::uint32_t height;
+  // The texels start at the next multiple of 16 bytes in std430.
+  alignas(4) std::uint32_t padding[2];
+};
+} // namespace gpu
+
+// A lat-long HDR map of the light arriving from infinitely far away: +y is
+// up, the top row of the image looks straight up and the left edge looks
+// along +x. The texels are stored in TILE_SIZE x TILE_SIZE tiles, so the
+// lookups of nearby directions share cache lines.
+//
+// Directions are importance sampled by the luminance of their texel with an
+// alias table (Vose 1991), which picks a texel in constant time. Keep the
+// layout, lookup and sampling in sync with shader/common.glsl.
+class Environment {
+private:
+  std::uint32_t _width;
+  std::uint32_t _height;
+  std::vector<gpu::EnvironmentTexel> _texels;
+
+  [[nodiscard]] std::size_t _index(std::uint32_t x, std::uint32_t y) const;
+  [[nodiscard]] const gpu::EnvironmentTexel &
+  _texel(const glm::vec3 &direction) const;
+
+  void _build_alias_table();
+
+public:
+  static constexpr std::uint32_t TILE_SIZE = 8;
+
+  explicit Environment(const Image &image);
+
+  // Reads .pfm and Radiance .hdr files.
+  [[nodiscard]] static Environment load(const std::string &filename);
+
+  [[nodiscard]] std::uint32_t width() const;
+  [[nodiscard]] std::uint32_t height() const;
+  // In tile order, padded to whole tiles.
+  [[nodiscard]] const std::vector<gpu::EnvironmentTexel> &texels() const;
+
+  [[nodiscard]] glm::vec3 radiance(const glm::vec3 &direction) const;
+
+  // Density in solid angle of sample producing direction.
+  [[nodiscard]] float pdf(const glm::vec3 &direction) const;
+  // Unit direction that u and jitter, points of the unit square, map to.
+  // u.x picks an entry of the alias table and u.y the entry or its alias,
+  // and jitter places the direction within that texel.
+  [[nodiscard]] glm::vec3 sample(const glm::vec2 &u,
+                                 const glm::vec2 &jitter) const;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "aabb.hh"
 #include "interval.hh"
 #include "material.hh"
 #include "ray.hh"
@@ -31,4 +32,22 @@ public:
   virtual ~Hittable() = default;
   virtual std::optional<HitRecord> hit(const Ray &ray,
                                        Interval ray_t) const = 0;
+
+  // Whether anything is hit in (0.001, t_max). Unlike hit, implementations
+  // may stop at the first hit instead of looking for the closest one.
+  virtual bool occluded(const Ray &ray, float t_max) const;
+
+  // Light sampling: density in solid angle of random(origin, u) producing
+  // direction for uniform u, 0 if the direction misses this hittable.
+  virtual float pdf_value(const glm::vec3 &origin,
+                          const glm::vec3 &direction) const;
+  // Direction from origin towards the point of this hittable that u, a
+  // point of the unit square, maps to.
+  virtual glm::vec3 random(const glm::vec3 &origin, const glm::vec2 &u) const;
+
+  // Whether this is a light, see HittableList::lights.
+  virtual bool is_emissive() const;
+
+  // Encloses every point that hit can return.
+  virtual Aabb bounding_box() const = 0;
 };
@@ -1,10 +1,15 @@
 #pragma once
 
+#include "aabb.hh"
 #include "hittable.hh"
+#include "scene.hh"
 
 #include <memory>
+#include <optional>
 #include <vector>
 
+#include <glm/glm.hpp>
+
 struct HittableList : public Hittable {
   std::vector<std::shared_ptr<Hittable>> hittables;
 
@@ -12,5 +17,20 @@ struct HittableList : public Hittable {
   HittableList(const HittableList &) = default;
   HittableList(HittableList &&) = default;
 
+  // The same spheres, disks and materials the GPU tracer renders.
+  static HittableList from_scene(const gpu::Scene &scene);
+  // The emissive hittables of this list, shared with it, in the order of
+  // the light list of the scene it was built from.
+  [[nodiscard]] HittableList lights() const;
+
   std::optional<HitRecord> hit(const Ray &ray, Interval ray_t) const override;
+  bool occluded(const Ray &ray, float t_max) const override;
+
+  // Picks one of the hittables uniformly, so the density is their average.
+  float pdf_value(const glm::vec3 &origin,
+                  const glm::vec3 &direction) const override;
+  glm::vec3 random(const glm::vec3 &origin,
+                   const glm::vec2 &u) const override;
+
+  Aabb bounding_box() const override;
 };
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Linear RGB pixels, row by row from the top left.
+struct Image {
+  std::uint32_t width;
+  std::uint32_t height;
+  std::vector<glm::vec3> pixels;
+};
+
+// Portable float maps, which keep the linear values of a render exactly.
+void write_pfm(const std::string &filename, const Image &image);
+[[nodiscard]] Image read_pfm(const std::string &filename);
+
+// Radiance RGBE files with the -Y height +X width orientation, flat or run
+// length encoded.
+[[nodiscard]] Image read_hdr(const std::string &filename);
+
+// 8-bit ASCII PPM after the same gamma and clamp as the tracers' output,
+// with every line of comments as a "# " comment in the header.
+void write_ppm(const std::string &filename, const Image &image,
+               const std::vector<std::string> &comments = {});
+
+// A new empty directory in the system's temporary directory, for images that
+// are only written to time the writing. The caller removes it.
+[[nodiscard]] std::filesystem::path make_scratch_directory();
@@ -13,8 +13,27 @@ class Material {
 public:
   virtual ~Material() = default;
 
+  // u is a point of the unit square that the material may draw from.
   virtual std::optional<std::pair<Ray, glm::vec3>>
-  scatter(const Ray &ray_in, const HitRecord &record) const;
+  scatter(const Ray &ray_in, const HitRecord &record,
+          const glm::vec2 &u) const;
+
+  virtual glm::vec3 emitted(const Ray &ray_in, const HitRecord &record) const;
+
+  // Density in solid angle of scatter producing scattered. 0 for materials
+  // whose directions are not sampled by density, which are never combined
+  // with light sampling.
+  virtual float scattering_pdf(const Ray &ray_in, const HitRecord &record,
+                               const Ray &scattered) const;
+
+  // Surface color without lighting, for the denoiser's feature buffers.
+  virtual glm::vec3 albedo() const;
+
+  // Portals only move rays, so they do not use up a bounce of the path.
+  virtual bool is_portal() const;
+
+  // Hittables of emissive materials are the lights that are sampled.
+  virtual bool is_emissive() const;
 };
 
 class Lambertian : public Material {
@@ -31,7 +50,13 @@ public:
   Lambertian(const glm::vec3 &albedo);
 
   std::optional<std::pair<Ray, glm::vec3>>
-  scatter(const Ray &ray_in, const HitRecord &record) const override;
+  scatter(const Ray &ray_in, const HitRecord &record,
+          const glm::vec2 &u) const override;
+
+  float scattering_pdf(const Ray &ray_in, const HitRecord &record,
+                       const Ray &scattered) const override;
+
+  glm::vec3 albedo() const override;
 };
 
 class Metal : public Material {
@@ -49,7 +74,10 @@ public:
   Metal(const glm::vec3 &albedo, float fuzz);
 
   std::optional<std::pair<Ray, glm::vec3>>
-  scatter(const Ray &ray_in, const HitRecord &record) const override;
+  scatter(const Ray &ray_in, const HitRecord &record,
+          const glm::vec2 &u) const override;
+
+  glm::vec3 albedo() const override;
 };
 
 class Dielectric : public Material {
@@ -68,5 +96,25 @@ public:
   Dielectric(float refraction_index);
 
   std::optional<std::pair<Ray, glm::vec3>>
-  scatter(const Ray &ray_in, const HitRecord &record) const override;
+  scatter(const Ray &ray_in, const HitRecord &record,
+          const glm::vec2 &u) const override;
+};
+
+class Emissive : public Material {
+private:
+  glm::vec3 _emission;
+
+public:
+  Emissive() = default;
+  Emissive(const Emissive &) = default;
+  Emissive(Emissive &&) = default;
+  Emissive &operator=(const Emissive &) = default;
+  Emissive &operator=(Emissive &&) = default;
+
+  Emissive(const glm::vec3 &emission);
+
+  // Both faces emit, like on the GPU.
+  glm::vec3 emitted(const Ray &ray_in, const HitRecord &record) const override;
+
+  bool is_emissive() const override;
 };
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <vector>
+
+#define VULKAN_HPP_NO_CONSTRUCTORS
+#include <vulkan/vulkan.hpp>
+
+struct Allocation {
+  vk::DeviceMemory memory;
+  vk::DeviceSize offset;
+  vk::DeviceSize size;
+  // Points at offset in the persistently mapped block, nullptr if the memory
+  // is not host visible.
+  void *mapped;
+  std::uint32_t block_index;
+};
+
+struct MemoryStatistics {
+  std::uint32_t block_count;
+  std::uint32_t allocation_count;
+  vk::DeviceSize reserved_bytes;
+  vk::DeviceSize used_bytes;
+  vk::DeviceSize host_visible_bytes;
+};
+
+// Carves buffers and images out of a few large vk::DeviceMemory blocks per
+// memory type instead of allocating memory for every resource. Host visible
+// blocks stay mapped for their whole lifetime.
+class MemoryAllocator {
+private:
+  struct Block {
+    vk::DeviceMemory memory;
+    vk::DeviceSize size;
+    std::uint32_t memory_type_index;
+    void *mapped;
+    // Offset to size of every free range, adjacent ranges are merged.
+    std::map<vk::DeviceSize, vk::DeviceSize> free_ranges;
+    std::uint32_t allocation_count;
+  };
+
+  vk::PhysicalDevice _physical_device;
+  vk::Device _device;
+  vk::DeviceSize _block_size;
+  // Linear and optimal resources in the same block must be this far apart.
+  vk::DeviceSize _granularity;
+  vk::PhysicalDeviceMemoryProperties _memory_properties;
+  std::vector<Block> _blocks;
+
+  [[nodiscard]] std::uint32_t
+  _find_memory_type_index(std::uint32_t memory_type_bits,
+                          const vk::MemoryPropertyFlags &properties) const;
+
+  [[nodiscard]] static std::optional<vk::DeviceSize>
+  _take_range(Block &block, vk::DeviceSize size, vk::DeviceSize alignment);
+
+public:
+  MemoryAllocator(const vk::PhysicalDevice &physical_device,
+                  const vk::Device &device,
+                  vk::DeviceSize block_size = 64 << 20);
+  MemoryAllocator(const MemoryAllocator &) = delete;
+  MemoryAllocator &operator=(const MemoryAllocator &) = delete;
+  ~MemoryAllocator();
+
+  [[nodiscard]] Allocation
+  allocate(const vk::MemoryRequirements &requirements,
+           const vk::MemoryPropertyFlags &properties);
+
+  void free(const Allocation &allocation);
+
+  [[nodiscard]] MemoryStatistics statistics() const;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Learns from which directions light reaches the diffuse surfaces of a scene
+// and samples bounce directions after it (Müller et al. 2017, "Practical
+// Path Guiding"). Space is split by an octree whose leaves each hold a
+// histogram of incident radiance over an equal-area mapping of the sphere,
+// so every bin covers the same solid angle.
+//
+// Rendering happens in passes. During a pass the histograms learned by the
+// previous one are sampled while the paths record into new ones with atomic
+// adds, so any number of threads may call leaf, sample, pdf and record at
+// once. update runs between passes: it makes the new histograms the ones to
+// sample and splits the leaves that received many samples.
+class PathGuide {
+private:
+  struct Node {
+    // Index of the first of eight children, 0 for leaves.
+    std::uint32_t children;
+    std::uint32_t leaf;
+    std::uint32_t depth;
+  };
+
+  glm::vec3 _min;
+  glm::vec3 _max;
+  std::vector<Node> _nodes;
+  // BINS values per leaf: the density in solid angle of sample and the
+  // cumulative probability of the bins, learned by the last pass.
+  std::vector<float> _pdf;
+  std::vector<float> _cdf;
+  // Per leaf, what the current pass has recorded.
+  std::vector<std::atomic<float>> _learned;
+  std::vector<std::atomic<std::uint32_t>> _samples;
+  bool _trained = false;
+
+  [[nodiscard]] static std::uint32_t _bin(const glm::vec3 &direction);
+
+public:
+  static constexpr std::uint32_t BINS_PER_AXIS = 16;
+  static constexpr std::uint32_t BINS = BINS_PER_AXIS * BINS_PER_AXIS;
+  // Leaves that received this many samples in a pass are split in eight.
+  static constexpr std::uint32_t SPLIT_SAMPLES = 4096;
+  static constexpr std::uint32_t MAX_TREE_DEPTH = 12;
+
+  // Points outside of the box from min to max belong to the leaf next to
+  // them.
+  PathGuide(const glm::vec3 &min, const glm::vec3 &max);
+
+  [[nodiscard]] std::uint32_t leaf(const glm::vec3 &point) const;
+  [[nodiscard]] std::size_t leaf_count() const;
+
+  // Whether a pass has recorded any light yet. Until then sample and pdf
+  // are uniform over the sphere.
+  [[nodiscard]] bool trained() const;
+
+  // Unit direction that u, a point of the unit square, maps to in leaf.
+  [[nodiscard]] glm::vec3 sample(std::uint32_t leaf, const glm::vec2 &u) const;
+  [[nodiscard]] float pdf(std::uint32_t leaf,
+                          const glm::vec3 &direction) const;
+
+  // Adds a sample of the light arriving in leaf from direction, its
+  // luminance divided by the density the direction was sampled with.
+  void record(std::uint32_t leaf, const glm::vec3 &direction, float value);
+
+  // Not safe to call during a pass.
+  void update();
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/glm.hpp>
+
+// Host copy of the generator in shader/common.glsl. Keep both in sync.
+namespace pcg {
+inline std::uint32_t hash(std::uint32_t x) {
+  const std::uint32_t state = x * 747796405u + 2891336453u;
+  const std::uint32_t word =
+      ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+struct Generator {
+  std::uint32_t state;
+
+  static Generator seed(std::uint32_t pixel_x, std::uint32_t pixel_y,
+                        std::uint32_t render_call, std::uint32_t stream) {
+    const std::uint32_t call = hash(render_call ^ hash(stream));
+    return {.state = hash(pixel_x ^ hash(pixel_y ^ call))};
+  }
+
+  std::uint32_t next_uint() {
+    const std::uint32_t word = hash(state);
+    state = state * 747796405u + 2891336453u;
+    return word;
+  }
+
+  float next_float() {
+    return static_cast<float>(next_uint() >> 8u) * (1.0f / 16777216.0f);
+  }
+
+  glm::vec3 unit_vector() {
+    const float z = 1.0f - 2.0f * next_float(),
+                phi = 2.0f * glm::pi<float>() * next_float(),
+                r = std::sqrt(std::fmax(0.0f, 1.0f - z * z));
+    return {r * std::cos(phi), r * std::sin(phi), z};
+  }
+
+  glm::vec3 in_unit_disk() {
+    const float r = std::sqrt(next_float()),
+                phi = 2.0f * glm::pi<float>() * next_float();
+    return {r * std::cos(phi), r * std::sin(phi), 0};
+  }
+};
+} // namespace pcg
@@ -7,8 +7,11 @@
 
 class PortalMaterial : public Material {
 private:
-  glm::mat4 rotation_mat;
-  glm::mat4 translate_mat_before, translate_mat_after;
+  // Points move to _rotation * point + _translation and directions to
+  // _rotation * direction, like gpu::Material.
+  glm::mat3 _rotation;
+  glm::vec3 _translation;
+  glm::vec3 _attenuation = glm::vec3(1, 1, 1);
 
 public:
   PortalMaterial() = default;
@@ -17,10 +20,16 @@ public:
   PortalMaterial &operator=(const PortalMaterial &) = default;
   PortalMaterial &operator=(PortalMaterial &&) = default;
 
+  // The transform of gpu::Material::from_disk_pair.
   PortalMaterial(const glm::vec3 &source_origin, const glm::vec3 &source_normal,
                  const glm::vec3 &destination_origin,
                  const glm::vec3 &destination_normal);
+  PortalMaterial(const glm::mat3 &rotation, const glm::vec3 &translation,
+                 const glm::vec3 &attenuation);
 
   std::optional<std::pair<Ray, glm::vec3>>
-  scatter(const Ray &ray_in, const HitRecord &record) const override;
+  scatter(const Ray &ray_in, const HitRecord &record,
+          const glm::vec2 &u) const override;
+
+  bool is_portal() const override;
 };
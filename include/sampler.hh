@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <glm/glm.hpp>
+
+// Also the values of the SAMPLER specialization constant of the shaders.
+enum class SamplerKind : std::uint32_t {
+  INDEPENDENT = 0,
+  STRATIFIED = 1,
+  SOBOL = 2,
+  BLUE_NOISE = 3,
+};
+
+// Parses independent, stratified, sobol or blue-noise.
+[[nodiscard]] SamplerKind sampler_kind_from_name(const std::string &name);
+
+// Draws the random numbers of the samples of a pixel. Every use of
+// randomness along a path reads its own pair of dimensions, so the samplers
+// other than IndependentSampler can stratify each use across the samples of
+// a pixel. Keep the dimension layout and the samplers in sync with
+// shader/common.glsl.
+class Sampler {
+protected:
+  std::uint32_t _samples_per_pixel;
+  glm::uvec2 _pixel = {0, 0};
+  std::uint32_t _sample_index = 0;
+
+public:
+  static constexpr std::uint32_t PIXEL_DIMENSION = 0;
+  static constexpr std::uint32_t LENS_DIMENSION = 1;
+  // Bounce depth d reads the pair FIRST_BOUNCE_DIMENSION +
+  // DIMENSIONS_PER_BOUNCE * d + SCATTER_DIMENSION, LIGHT_DIMENSION,
+  // ENVIRONMENT_DIMENSION, GUIDE_DIMENSION or ENVIRONMENT_JITTER_DIMENSION.
+  static constexpr std::uint32_t FIRST_BOUNCE_DIMENSION = 2;
+  static constexpr std::uint32_t DIMENSIONS_PER_BOUNCE = 5;
+  static constexpr std::uint32_t SCATTER_DIMENSION = 0;
+  static constexpr std::uint32_t LIGHT_DIMENSION = 1;
+  static constexpr std::uint32_t ENVIRONMENT_DIMENSION = 2;
+  static constexpr std::uint32_t GUIDE_DIMENSION = 3;
+  // Where the environment sample lies within the texel it picked.
+  static constexpr std::uint32_t ENVIRONMENT_JITTER_DIMENSION = 4;
+
+  explicit Sampler(std::uint32_t samples_per_pixel);
+  virtual ~Sampler() = default;
+
+  [[nodiscard]] static std::unique_ptr<Sampler>
+  create(SamplerKind kind, std::uint32_t samples_per_pixel);
+
+  // sample_index counts the samples of the pixel from 0 across all calls.
+  void start_sample(std::uint32_t x, std::uint32_t y,
+                    std::uint32_t sample_index);
+
+  // A point of the unit square for pair number dimension of this sample.
+  virtual glm::vec2 get_2d(std::uint32_t dimension) = 0;
+
+  glm::vec2 get_bounce_2d(int depth, std::uint32_t dimension);
+};
+
+// Hashes the pixel, the sample index and the dimension, so a sample draws
+// the same numbers whichever thread traces it and whenever it does.
+class IndependentSampler : public Sampler {
+public:
+  using Sampler::Sampler;
+
+  glm::vec2 get_2d(std::uint32_t dimension) override;
+};
+
+// Jittered strata on a grid of about samples_per_pixel cells, visited in a
+// different random order for every pixel and dimension.
+class StratifiedSampler : public Sampler {
+public:
+  using Sampler::Sampler;
+
+  glm::vec2 get_2d(std::uint32_t dimension) override;
+};
+
+// The first two Sobol dimensions with hash-based Owen scrambling (Burley
+// 2020). Every dimension pair shuffles the sample order independently, so
+// the pairs do not correlate with each other.
+class SobolSampler : public Sampler {
+protected:
+  [[nodiscard]] static glm::vec2 _owen_sobol(std::uint32_t index,
+                                             std::uint32_t seed);
+
+public:
+  using Sampler::Sampler;
+
+  glm::vec2 get_2d(std::uint32_t dimension) override;
+};
+
+// One Owen-scrambled Sobol sequence for the whole image, with the samples
+// of each pixel at its Morton order position (Ahmed and Wonka 2020).
+// Neighbouring pixels get disjoint parts of the same stratification, which
+// spreads their error as blue noise. Assumes samples_per_pixel samples per
+// pixel, and images of up to 2^(16 - log2(samples_per_pixel) / 2) pixels
+// on a side before the indices of distant pixels repeat.
+class BlueNoiseSampler : public SobolSampler {
+public:
+  using SobolSampler::SobolSampler;
+
+  glm::vec2 get_2d(std::uint32_t dimension) override;
+};
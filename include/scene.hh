@@ -6,7 +6,14 @@
 
 namespace gpu {
 enum HittableKind { SPHERE = 0, DISK = 1 };
-enum MaterialKind { LAMBERTIAN = 0, METAL = 1, DIELECTRIC = 2, PORTAL = 3 };
+enum MaterialKind {
+  LAMBERTIAN = 0,
+  METAL = 1,
+  DIELECTRIC = 2,
+  PORTAL = 3,
+  // Emits color and scatters nothing.
+  EMISSIVE = 4
+};
 
 struct Hittable {
   alignas(4) std::uint32_t kind;
@@ -24,9 +31,10 @@ struct Material {
   alignas(4) std::uint32_t kind;
   alignas(16) glm::vec3 color;
   alignas(4) float parameter;
-  alignas(16) glm::mat4 translation_mat1;
-  alignas(16) glm::mat4 translation_mat2;
-  alignas(16) glm::mat4 rotation_mat;
+  // Portals move points to rotation * point + translation and rotate
+  // directions. std140 pads every column of a mat3 to a vec4.
+  alignas(16) glm::mat3x4 rotation;
+  alignas(16) glm::vec3 translation;
 
   static Material from_disk_pair(const glm::vec3 &source_center,
                                  const glm::vec3 &source_normal,
@@ -43,10 +51,21 @@ struct Camera {
   alignas(4) float focus_dist;
 };
 
+// Indices of the hittables with an emissive material. Same layout as Lights
+// in shader/common.glsl.
+struct LightList {
+  std::uint32_t count;
+  std::uint32_t indices[500];
+};
+
 struct Scene {
   alignas(4) std::uint32_t hittables_count;
   Camera camera;
   Hittable hittables[500];
   Material materials[500];
+
+  // Bit 1 << kind is set for the kind of every material a hittable uses.
+  [[nodiscard]] std::uint32_t material_kinds() const;
+  [[nodiscard]] LightList lights() const;
 };
 } // namespace gpu
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "aabb.hh"
 #include "hittable.hh"
 #include "interval.hh"
 #include "material.hh"
@@ -25,4 +26,13 @@ struct Sphere : public Hittable {
          std::shared_ptr<Material> material);
 
   std::optional<HitRecord> hit(const Ray &ray, Interval ray_t) const override;
+
+  float pdf_value(const glm::vec3 &origin,
+                  const glm::vec3 &direction) const override;
+  glm::vec3 random(const glm::vec3 &origin,
+                   const glm::vec2 &u) const override;
+
+  bool is_emissive() const override;
+
+  Aabb bounding_box() const override;
 };
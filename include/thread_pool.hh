@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads that all run the same job until each of them returns from
+// it. Jobs split their work between the workers themselves, parallel_for
+// does so with an atomic counter.
+class ThreadPool {
+private:
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _job_ready;
+  std::condition_variable _job_done;
+  std::function<void(std::size_t)> _job;
+  std::uint64_t _job_generation = 0;
+  std::size_t _running_workers = 0;
+  bool _stopping = false;
+
+  void _work(std::size_t worker);
+
+public:
+  explicit ThreadPool(
+      std::size_t thread_count = std::thread::hardware_concurrency());
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool();
+
+  [[nodiscard]] std::size_t size() const;
+
+  // Calls job(worker) on every worker and returns once all calls returned.
+  void run(const std::function<void(std::size_t)> &job);
+
+  // Calls body(index) for every index in [0, count).
+  void parallel_for(std::size_t count,
+                    const std::function<void(std::size_t)> &body);
+};
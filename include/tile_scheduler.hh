@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+struct Tile {
+  std::uint32_t x;
+  std::uint32_t y;
+  std::uint32_t width;
+  std::uint32_t height;
+};
+
+// Hands out the tiles of one image to a GPU and several CPU workers as they
+// become idle. The GPU takes batches sized from its measured time per tile,
+// and CPU workers stop taking tiles once the GPU would finish all remaining
+// ones before a CPU worker finished one more.
+class TileScheduler {
+private:
+  std::mutex _mutex;
+  std::vector<Tile> _tiles;
+  std::size_t _next_tile = 0;
+
+  std::size_t _gpu_tiles = 0;
+  double _gpu_seconds = 0;
+  std::size_t _cpu_tiles = 0;
+  double _cpu_seconds = 0;
+
+  // Tiles of the first GPU batch, before its throughput is known.
+  static constexpr std::size_t _first_gpu_batch = 4;
+
+public:
+  TileScheduler(std::uint32_t image_width, std::uint32_t image_height,
+                std::uint32_t tile_size);
+  TileScheduler(const TileScheduler &) = delete;
+  TileScheduler &operator=(const TileScheduler &) = delete;
+
+  // Empty once every tile has been handed out.
+  [[nodiscard]] std::vector<Tile> take_gpu_batch(double target_seconds);
+  [[nodiscard]] std::optional<Tile> take_cpu_tile();
+
+  void report_gpu(std::size_t tiles, double seconds);
+  void report_cpu(double seconds);
+
+  [[nodiscard]] std::size_t tile_count() const;
+  [[nodiscard]] std::size_t gpu_tiles();
+  [[nodiscard]] std::size_t cpu_tiles();
+};
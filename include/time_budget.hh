@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Plans the passes of a progressive render that has to be done by a wall
+// clock deadline, counted from construction. Passes double in size while
+// the time per sample measured so far says they fit into what is left of
+// the budget, and shrink to what fits once they do not. The first pass
+// always runs, so there is an image however short the budget.
+class TimeBudget {
+private:
+  std::chrono::steady_clock::time_point _begin;
+  std::chrono::steady_clock::time_point _pass_begin;
+  double _seconds;
+  double _reserve_seconds = 0;
+  double _traced_seconds = 0;
+  std::uint32_t _traced_samples = 0;
+  std::uint32_t _pass_samples = 0;
+  std::uint32_t _next_pass_samples = 1;
+
+public:
+  explicit TimeBudget(double seconds);
+
+  // Keeps seconds at the end of the budget free for denoising and writing
+  // the image.
+  void set_reserve(double seconds);
+
+  // Samples per pixel of the next pass, at most max_samples, or 0 once not
+  // even one more sample fits. Starts timing the pass.
+  [[nodiscard]] std::uint32_t next_pass(std::uint32_t max_samples);
+  void finish_pass();
+
+  [[nodiscard]] double elapsed_seconds() const;
+  // Of the passes so far, including what they spent besides tracing.
+  [[nodiscard]] double seconds_per_sample() const;
+};
+
+// Estimates the noise left in a progressive render from how much its passes
+// disagree. The mean of a pass of n samples has 1/n of the variance of one
+// sample, so n times its squared difference from the mean of all passes
+// estimates that variance, K - 1 times over K passes. Works on luminance.
+class PassVariance {
+private:
+  std::vector<double> _sums;
+  // Sum over the passes of n times the squared mean of the pass.
+  std::vector<double> _weighted_squares;
+  std::vector<std::uint32_t> _passes;
+  std::vector<std::uint32_t> _samples;
+
+public:
+  explicit PassVariance(std::size_t pixel_count);
+
+  // pass_sum is the sum of the pass_samples samples the current pass added
+  // to pixel, which may differ between pixels and passes. Different pixels
+  // may be added from different threads.
+  void add(std::size_t pixel, const glm::vec3 &pass_sum,
+           std::uint32_t pass_samples);
+
+  // Root mean square over the pixels of the standard error of their mean
+  // luminance. Pixels with fewer than two passes are left out, 0 if that is
+  // all of them.
+  [[nodiscard]] double rms_error() const;
+};
@@ -1,13 +1,21 @@
 #pragma once
 
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <random>
+#include <utility>
 
+#include <glm/ext/scalar_constants.hpp>
 #include <glm/glm.hpp>
 
+// Every thread draws from a generator of its own. The first thread to draw a
+// number gets the default seed, so scenes built on the main thread do not
+// change with the number of threads.
 inline float random_float() {
-  static std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-  static std::mt19937 gen;
+  static std::atomic<std::uint32_t> next_stream = 0;
+  thread_local std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+  thread_local std::mt19937 gen(std::mt19937::default_seed + next_stream++);
   return dist(gen);
 }
 
@@ -25,7 +33,7 @@ inline glm::vec3 random_vec(float lo, float hi) {
 
 inline glm::vec3 random_in_unit_sphere() {
   while (true) {
-    const auto v = random_vec();
+    const auto v = random_vec(-1, 1);
     if (glm::dot(v, v) < 1)
       return v;
   }
@@ -45,12 +53,35 @@ inline glm::vec3 random_on_hemisphere(const glm::vec3 &normal) {
 
 inline glm::vec3 random_in_unit_disk() {
   while (true) {
-    const auto v = glm::vec3(random_float(), random_float(), 0);
+    const auto v = glm::vec3(random_float(-1, 1), random_float(-1, 1), 0);
     if (glm::dot(v, v) < 1)
       return v;
   }
 }
 
+// Maps a point u of the unit square to the unit sphere, uniformly if u is
+// uniform. z is linear in u.x (Archimedes), like random_unit_vec in
+// shader/common.glsl.
+inline glm::vec3 unit_vector(const glm::vec2 &u) {
+  const auto z = 1.0f - 2.0f * u.x, phi = 2.0f * glm::pi<float>() * u.y,
+             r = std::sqrt(std::fmax(0.0f, 1.0f - z * z));
+  return {r * std::cos(phi), r * std::sin(phi), z};
+}
+
+// Maps a point u of the unit square to the unit disk in the xy plane.
+inline glm::vec3 in_unit_disk(const glm::vec2 &u) {
+  const auto r = std::sqrt(u.x), phi = 2.0f * glm::pi<float>() * u.y;
+  return {r * std::cos(phi), r * std::sin(phi), 0};
+}
+
+// Two unit vectors that form an orthonormal basis with the unit vector w.
+inline std::pair<glm::vec3, glm::vec3> orthonormal_basis(const glm::vec3 &w) {
+  const auto a =
+      std::fabs(w.x) > 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+  const auto v = glm::normalize(glm::cross(w, a));
+  return {glm::cross(w, v), v};
+}
+
 inline float linear_to_gamma(float linear_component) {
   if (linear_component > 0)
     return std::sqrt(linear_component);
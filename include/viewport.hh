@@ -0,0 +1,26 @@
+#pragma once
+
+#include "scene.hh"
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace gpu {
+// Where the rays of every pixel start and pass through, computed once per
+// camera on the host for both tracers. Uploaded as a uniform with the layout
+// of Viewport in shader/common.glsl.
+struct Viewport {
+  alignas(16) glm::vec3 eye;
+  alignas(16) glm::vec3 pixel00_location;
+  alignas(16) glm::vec3 pixel_delta_u;
+  alignas(16) glm::vec3 pixel_delta_v;
+  alignas(16) glm::vec3 defocus_disk_u;
+  alignas(16) glm::vec3 defocus_disk_v;
+  // 1 if rays start on the defocus disk instead of at the eye.
+  alignas(4) std::uint32_t defocus;
+
+  static Viewport from_camera(const Camera &camera, std::uint32_t image_width,
+                              std::uint32_t image_height);
+};
+} // namespace gpu
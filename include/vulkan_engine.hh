@@ -1,8 +1,17 @@
 #pragma once
 
+#include "environment.hh"
+#include "memory_allocator.hh"
+#include "sampler.hh"
 #include "scene.hh"
+#include "tile_scheduler.hh"
+#include "viewport.hh"
 
+#include <array>
+#include <chrono>
 #include <cstdint>
+#include <fstream>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -12,12 +21,39 @@
 
 #include <GLFW/glfw3.h>
 
+enum class Integrator { MEGAKERNEL, WAVEFRONT, PERSISTENT };
+
 struct Settings {
   std::uint32_t window_height;
   std::uint32_t window_width;
   std::string shader_file;
   std::uint32_t group_size_x;
   std::uint32_t group_size_y;
+  std::uint32_t max_depth;
+  // Portal traversals per path in the megakernel and the persistent kernel,
+  // which do not count towards max_depth there.
+  std::uint32_t max_portal_hops;
+  std::uint32_t samples_per_pass;
+  bool auto_tune_group_size;
+  std::string profile_csv_file;
+  std::string wavefront_shader_file;
+  std::string persistent_shader_file;
+  // Workgroups of the persistent kernel, 0 to derive it from the device.
+  std::uint32_t persistent_group_count;
+  Integrator integrator;
+  std::string pipeline_cache_file;
+  std::string resolve_shader_file;
+  std::string reproject_shader_file;
+  bool temporal_reprojection;
+  std::uint32_t reprojection_history_samples;
+  float preview_frame_ms;
+  // Renders into an offscreen image without a window, swapchain or ImGui.
+  bool headless;
+  // Only devices whose name contains this are used, any device if empty.
+  std::string device_name;
+  // Sampler of the megakernel. The wavefront and persistent kernels always
+  // draw independent samples.
+  SamplerKind sampler;
 };
 
 struct RenderCallInfo {
@@ -28,14 +64,89 @@ struct RenderCallInfo {
   std::uint32_t total_samples;
 };
 
+struct FrameStats {
+  std::uint64_t frame;
+  float dispatch_ms;
+  float imgui_ms;
+  float present_ms;
+  std::uint32_t rays;
+  std::uint32_t portal_traversals;
+  float mrays_per_second;
+  float lane_utilization;
+  std::uint32_t group_size_x;
+  std::uint32_t group_size_y;
+  std::uint32_t pixel_stride;
+  std::uint32_t upload_bytes;
+};
+
+// Counters written by the shaders, see Statistics in shader/common.glsl.
+struct ShaderStatistics {
+  std::uint32_t next_work_item;
+  std::uint32_t rays;
+  std::uint32_t lane_steps;
+  std::uint32_t portal_traversals;
+};
+
+struct WavefrontPushConstants {
+  std::uint32_t ray_queue;
+  std::uint32_t consumed_queues;
+  std::uint32_t sample_index;
+  std::uint32_t depth;
+};
+
+struct WavefrontPipelines {
+  vk::Pipeline generate;
+  vk::Pipeline intersect;
+  std::array<vk::Pipeline, 4> shade;
+  vk::Pipeline compact;
+  vk::Pipeline accumulate;
+};
+
+// Push constants of the megakernel and the resolve kernel. Passes that only
+// trace every pixel_stride-th pixel along both axes are upscaled by resolve.
+struct PassPushConstants {
+  std::uint32_t pixel_stride;
+  std::uint32_t samples;
+  std::uint32_t tile_x;
+  std::uint32_t tile_y;
+  std::uint32_t tile_width;
+  std::uint32_t tile_height;
+};
+
+struct ReprojectionInfo {
+  gpu::Viewport previous_viewport;
+  alignas(4) std::uint32_t history_valid;
+  alignas(4) std::uint32_t history_samples;
+  alignas(4) float position_tolerance;
+};
+
+// Byte range of the scene buffer that differs from the scene to render.
+struct SceneUpdate {
+  std::uint32_t offset;
+  std::uint32_t size;
+};
+
+struct SpecializationConstant {
+  std::uint32_t id;
+  std::uint32_t value;
+};
+
+struct GroupSizeCandidate {
+  std::uint32_t x;
+  std::uint32_t y;
+  vk::Pipeline pipeline;
+  // Of the frames that count, see VulkanEngine::_tuning_rounds.
+  float total_ms;
+};
+
 struct VulkanBuffer {
   vk::Buffer buffer;
-  vk::DeviceMemory memory;
+  Allocation allocation;
 };
 
 struct VulkanImage {
   vk::Image image;
-  vk::DeviceMemory memory;
+  Allocation allocation;
   vk::ImageView view;
 };
 
@@ -57,13 +168,67 @@ private:
   std::vector<const char *> _required_device_extensions = {
       VK_KHR_SWAPCHAIN_EXTENSION_NAME, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME};
   vk::Device _device;
+  // Created with the logical device and released right before it.
+  std::optional<MemoryAllocator> _allocator;
 
   vk::Queue _compute_queue;
   vk::Queue _present_queue;
 
   VulkanBuffer _scene_buffer;
+  // What the scene buffer holds once the recorded updates have run. Every
+  // frame's scene is compared against it per camera, hittable and material.
+  gpu::Scene _uploaded_scene;
+  bool _scene_uploaded = false;
+  std::vector<SceneUpdate> _scene_updates;
+  std::uint32_t _recorded_upload_bytes = 0;
+  static constexpr std::uint32_t _max_update_buffer_size = 65536;
   VulkanBuffer _render_call_info_buffer;
+  VulkanBuffer _viewport_buffer;
+  VulkanBuffer _light_buffer;
+  // gpu::EnvironmentHeader followed by the texels, see set_environment.
+  VulkanBuffer _environment_buffer;
   VulkanImage _summed_image;
+  bool _summed_image_initialized = false;
+  // Created by the first read_summed_image, which then submits the same
+  // copy into the mapped buffer every time.
+  VulkanBuffer _summed_readback_buffer;
+  vk::CommandBuffer _summed_readback_command_buffer;
+
+  // First hits and accumulation of the view before the last camera change,
+  // used by the reprojection pass.
+  VulkanImage _history_image;
+  VulkanImage _first_hit_image;
+  VulkanImage _previous_first_hit_image;
+  VulkanBuffer _reprojection_info_buffer;
+  vk::Pipeline _reproject_pipeline;
+  bool _temporal_reprojection;
+  bool _reproject_history = false;
+  bool _has_accumulated_viewport = false;
+  gpu::Viewport _accumulated_viewport;
+  // Relative to the distance to the camera.
+  static constexpr float _reprojection_position_tolerance = 0.01f;
+
+  // Pixel stride of the reduced resolution passes traced while the camera
+  // moves, adjusted towards Settings::preview_frame_ms.
+  std::uint32_t _preview_pixel_stride = 4;
+  std::uint32_t _profiled_pixel_stride = 1;
+  bool _profiled_preview = false;
+  static constexpr std::uint32_t _max_preview_pixel_stride = 8;
+
+  // Wavefront path state, see shader/wavefront.comp for the layouts.
+  static constexpr vk::DeviceSize _path_state_size = 6 * 16;
+  static constexpr std::uint32_t _ray_queue_count = 2;
+  static constexpr std::uint32_t _queue_count = _ray_queue_count + 4;
+  VulkanBuffer _path_buffer;
+  VulkanBuffer _queue_buffer;
+  // Bounces recorded per submission. The live paths are read back after
+  // each, and once none are left the rest of the bounces is not recorded.
+  static constexpr std::uint32_t _wavefront_bounces_per_submit = 8;
+  VulkanBuffer _live_path_readback_buffer;
+
+  VulkanBuffer _statistics_buffer;
+  VulkanBuffer _statistics_readback_buffer;
+  VulkanBuffer _accumulation_buffer;
 
   vk::DescriptorSetLayout _descriptor_set_layout;
 
@@ -72,25 +237,70 @@ private:
   vk::DescriptorSet _descriptor_set;
 
   vk::PipelineLayout _pipeline_layout;
+  vk::PipelineCache _pipeline_cache;
 
   vk::Pipeline _pipeline;
+  WavefrontPipelines _wavefront_pipelines;
+  // Material kinds the pipelines are specialized for, see MATERIAL_KINDS in
+  // shader/common.glsl. Starts with every kind until the first scene is seen.
+  std::uint32_t _material_kinds = 0x1F;
+  vk::Pipeline _persistent_pipeline;
+  vk::Pipeline _persistent_accumulate_pipeline;
+  // Invocations the device keeps in flight at once, 0 if it does not say.
+  std::uint64_t _resident_invocations = 0;
+  std::uint32_t _max_group_count_x = 1;
+  vk::Pipeline _resolve_pipeline;
+  Integrator _integrator;
+
+  // Megakernel pipelines that are timed during the first traced frames when
+  // the workgroup size is auto-tuned. Empty once the tuning is done.
+  std::vector<GroupSizeCandidate> _group_size_candidates;
+  // The timed frames go round the candidates, so that a change of clocks
+  // affects all of them alike. The first round only warms them up.
+  static constexpr std::size_t _tuning_rounds = 5;
+  std::size_t _tuned_frames = 0;
+  std::optional<std::size_t> _profiled_candidate;
 
   vk::CommandBuffer _command_buffer;
 
   vk::CommandPool _command_pool;
 
   vk::Fence _fence;
+  // Signalled by the submissions that the host waits for right away.
+  vk::Fence _flush_fence;
 
   vk::Semaphore _sema;
   vk::Semaphore _render_sema;
 
+  enum TimestampQuery {
+    TIMESTAMP_FRAME_BEGIN = 0,
+    TIMESTAMP_DISPATCH_END = 1,
+    TIMESTAMP_IMGUI_END = 2,
+    TIMESTAMP_COUNT = 3,
+  };
+  vk::QueryPool _timestamp_query_pool;
+  bool _timestamps_supported;
+  bool _timestamps_pending = false;
+  float _timestamp_period;
+  Integrator _profiled_integrator;
+  std::uint32_t _profiled_group_size_x;
+  std::uint32_t _profiled_group_size_y;
+  std::uint64_t _frame_count = 0;
+  FrameStats _frame_stats = {};
+  std::ofstream _profile_csv;
+
+  std::chrono::steady_clock::time_point _startup_begin;
+  bool _pipeline_cache_loaded = false;
+
   vk::SwapchainKHR _swap_chain;
   vk::Image _swap_chain_image;
   vk::ImageView _swap_chain_image_view;
+  // What resolve.comp last made of the accumulation. Copied into the swapchain
+  // image every frame, and takes its place in headless mode.
+  VulkanImage _resolved_image;
 
-  [[nodiscard]] std::uint32_t
-  _find_memory_type_index(std::uint32_t memory_type_bits,
-                          const vk::MemoryPropertyFlags &properties);
+  // Tiles the megakernel is restricted to, the whole image if empty.
+  std::vector<Tile> _tiles;
 
   [[nodiscard]] VulkanBuffer
   _create_buffer(const vk::DeviceSize &size,
@@ -108,6 +318,14 @@ private:
   [[nodiscard]]
   std::vector<char> _read_binary_file(const std::string &filename);
 
+  [[nodiscard]]
+  vk::ShaderModule _create_shader_module(const std::string &filename);
+
+  [[nodiscard]] vk::Pipeline _create_compute_pipeline(
+      const vk::ShaderModule &module, std::uint32_t group_size_x,
+      std::uint32_t group_size_y,
+      const std::vector<SpecializationConstant> &stage_constants = {});
+
   [[nodiscard]]
   vk::ImageMemoryBarrier _image_pipeline_barrier(
       const vk::AccessFlagBits &src_flags, const vk::AccessFlagBits &dst_flags,
@@ -118,28 +336,75 @@ private:
 
   void _destroy_buffer(const VulkanBuffer &buffer) const;
 
+  void _memory_barrier(const vk::PipelineStageFlags &src_stages,
+                       const vk::AccessFlags &src_access,
+                       const vk::PipelineStageFlags &dst_stages,
+                       const vk::AccessFlags &dst_access) const;
+
+  void _compute_memory_barrier() const;
+
+  void _dispatch_pixels(std::uint32_t group_size_x, std::uint32_t group_size_y,
+                        std::uint32_t pixel_stride = 1) const;
+
   void _create_window();
   void _create_instance();
   void _create_surface();
   void _select_phys_device();
   void _find_queue_families();
+  void _query_resident_invocations();
   void _create_logical_device();
   void _create_scene_buffer();
   void _update_scene_buffer(const gpu::Scene &scene);
+  void _record_scene_updates();
   void _create_render_call_info_buffer();
   void _update_render_call_info_buffer(const RenderCallInfo &render_call_info);
+  void _create_viewport_buffer();
+  void _update_viewport_buffer(const gpu::Viewport &viewport);
+  void _create_light_buffer();
+  void _update_light_buffer(const gpu::Scene &scene);
+  void _upload_environment(const gpu::EnvironmentHeader &header,
+                           const std::vector<gpu::EnvironmentTexel> &texels);
+  void _write_environment_descriptor();
   void _create_summed_pixel_color_image();
+  void _create_reprojection_resources();
+  void _update_reprojection_info_buffer(const gpu::Viewport &viewport);
+  void _create_wavefront_buffers();
+  void _create_statistics_buffers();
+  void _create_accumulation_buffer();
   void _create_command_pool();
   void _create_swap_chain();
   void _create_descriptor_set_layout();
   void _create_descriptor_pool();
   void _create_descriptor_set();
   void _create_pipeline_layout();
+  void _create_pipeline_cache();
+  void _save_pipeline_cache() const;
   void _create_pipeline();
+  void _create_wavefront_pipelines();
+  void _create_persistent_pipelines();
+  void _create_resolve_pipeline();
+  void _create_reproject_pipeline();
+  void _destroy_pipelines();
+  void _create_group_size_candidates();
+  void _finish_group_size_tuning();
+  void _recreate_pipelines();
+  void _specialize_material_kinds(std::uint32_t material_kinds);
   void _setup_imgui();
-  void _create_command_buffer();
+  void _record_megakernel(std::uint32_t pixel_stride, std::uint32_t samples);
+  void _record_wavefront();
+  [[nodiscard]] std::uint32_t _persistent_group_count() const;
+  void _record_persistent();
+  void _record_reprojection();
+  void _record_resolve(std::uint32_t pixel_stride);
+  void _begin_command_buffer();
+  void _flush_command_buffer();
+  void _submit_and_wait(const vk::CommandBuffer &command_buffer);
+  void _create_summed_readback();
+  void _create_command_buffer(const RenderCallInfo &render_call_info);
   void _create_fence();
   void _create_semaphore();
+  void _create_timestamp_query_pool();
+  void _read_frame_stats();
 
 public:
   VulkanEngine(const Settings &settings);
@@ -150,4 +415,31 @@ public:
   void render(const RenderCallInfo &render_call_info, const gpu::Scene &scene);
 
   [[nodiscard]] bool should_exit() const;
+
+  [[nodiscard]] const FrameStats &frame_stats() const;
+
+  void set_integrator(Integrator integrator);
+
+  [[nodiscard]] Integrator integrator() const;
+
+  void set_temporal_reprojection(bool enabled);
+
+  [[nodiscard]] bool temporal_reprojection() const;
+
+  [[nodiscard]] MemoryStatistics memory_statistics() const;
+
+  // Following render calls only trace these tiles, all of the image if
+  // tiles is empty. Tiled render calls always use the megakernel.
+  void set_tiles(const std::vector<Tile> &tiles);
+
+  // Lights the rays that escape the scene with environment instead of the
+  // gradient sky. Waits for the GPU, and does not clear the samples traced
+  // so far, so the next render call should.
+  void set_environment(const Environment &environment);
+
+  // Waits until the GPU has finished the last render call.
+  void wait_for_frame();
+
+  // Sum (rgb) and count (a) of the samples of every pixel, row by row.
+  [[nodiscard]] std::vector<glm::vec4> read_summed_image();
 };
@@ -0,0 +1,834 @@
+struct Hittable {
+  uint kind;
+  vec3 center;
+  vec3 normal;
+  float radius;
+  uint material_index;
+};
+
+struct Material {
+  uint kind;
+  vec3 color;
+  float parameter;
+  mat3 rotation;
+  vec3 translation;
+};
+
+struct Camera {
+  vec3 eye;
+  vec3 center;
+  vec3 up;
+  float vfov;
+  float defocus_angle;
+  float focus_dist;
+};
+
+struct Ray {
+  vec3 origin;
+  vec3 direction;
+};
+
+vec3 ray_at(Ray ray, float t) { return ray.origin + t * ray.direction; }
+
+struct HitRecord {
+  bool valid;
+  vec3 point;
+  vec3 normal;
+  float t;
+  bool front_face;
+  uint material_index;
+};
+
+struct ScatterResult {
+  bool valid;
+  Ray scattered_ray;
+  vec3 attenuation;
+};
+
+// Computed on the host by gpu::Viewport::from_camera in src/viewport.cc.
+struct Viewport {
+  vec3 eye;
+  vec3 pixel00_location;
+  vec3 pixel_delta_u;
+  vec3 pixel_delta_v;
+  vec3 defocus_disk_u;
+  vec3 defocus_disk_v;
+  uint defocus;
+};
+
+layout(binding = 0, rgba8_snorm) uniform image2D render_target;
+// rgb holds the sum of every sample traced for the pixel, a their count.
+layout(binding = 1, rgba32f) uniform image2D summed_image;
+layout(binding = 2) uniform Scene {
+  uint hittables_count;
+  Camera camera;
+  Hittable[500] hittables;
+  Material[500] materials;
+}
+scene;
+
+layout(binding = 12) uniform ViewportInfo { Viewport viewport; };
+
+// Indices of the emissive hittables, see gpu::LightList.
+layout(binding = 13, std430) readonly buffer Lights {
+  uint light_count;
+  uint light_indices[];
+};
+
+// A tiled lat-long map with an alias table entry per texel, see Environment
+// in include/environment.hh. A width of 0 selects the gradient sky.
+struct EnvironmentTexel {
+  vec3 color;
+  float pdf;
+  float probability;
+  uint alias;
+};
+layout(binding = 14, std430) readonly buffer EnvironmentMap {
+  uint environment_width;
+  uint environment_height;
+  EnvironmentTexel environment_texels[];
+};
+
+layout(binding = 3) uniform RenderCallInfo {
+  uint read_only;
+  uint clear;
+  uint number;
+  uint total_render_calls;
+  uint total_samples;
+}
+render_call_info;
+
+// Counters that are read back by the host one frame late. rays counts every
+// ray that is intersected with the world and lane_steps counts the lanes of
+// the subgroups that were executing while those rays were traced, so their
+// ratio is the SIMD utilization of the kernel. portal_traversals counts the
+// rays moved by portals.
+layout(binding = 6, std430) buffer Statistics {
+  uint next_work_item;
+  uint rays;
+  uint lane_steps;
+  uint portal_traversals;
+}
+statistics;
+
+const uint HITTABLE_KIND_SPHERE = 0;
+const uint HITTABLE_KIND_DISK = 1;
+
+const uint MATERIAL_KIND_LAMBERTIAN = 0;
+const uint MATERIAL_KIND_METAL = 1;
+const uint MATERIAL_KIND_DIELECTRIC = 2;
+const uint MATERIAL_KIND_PORTAL = 3;
+const uint MATERIAL_KIND_EMISSIVE = 4;
+
+// Set by the host when the pipelines are created, see _create_compute_pipeline
+// in src/vulkan_engine.cc. Constants 0 and 1 are the workgroup size.
+layout(constant_id = 2) const uint MAX_DEPTH = 50;
+layout(constant_id = 3) const uint SAMPLES_PER_PASS = 5;
+// Bit 1 << kind is set for every material kind in the scene. Pipelines are
+// rebuilt when the scene's mix changes, so the code of the other kinds is
+// compiled out of scatter.
+layout(constant_id = 4) const uint MATERIAL_KINDS = 0x1F;
+// Portal traversals per path, which do not count towards MAX_DEPTH in
+// ray_color and the persistent kernel.
+layout(constant_id = 6) const uint MAX_PORTAL_HOPS = 16;
+const float MAX_RAY_COLLISION_DISTANCE = 1e8;
+
+void count_rays() {
+  const uint active_lanes = subgroupBallotBitCount(subgroupBallot(true));
+  if (subgroupElect()) {
+    atomicAdd(statistics.rays, active_lanes);
+    atomicAdd(statistics.lane_steps, gl_SubgroupSize);
+  }
+}
+
+void count_portal_traversals() {
+  const uint active_lanes = subgroupBallotBitCount(subgroupBallot(true));
+  if (subgroupElect())
+    atomicAdd(statistics.portal_traversals, active_lanes);
+}
+
+const float PI = 3.1415926535897932385;
+
+// PCG-RXS-M-XS with 32 bits of state, see include/pcg.hh for the host copy
+// used by rng_check.
+uint random_state;
+
+void add_samples(ivec2 pixel, vec3 sum, uint count) {
+  imageStore(summed_image, pixel,
+             imageLoad(summed_image, pixel) + vec4(sum, float(count)));
+}
+
+uint pcg_hash(uint x) {
+  const uint state = x * 747796405u + 2891336453u;
+  const uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+// Every (pixel, render call, stream) triple gets its own generator, so results
+// do not depend on which invocation traces the sample.
+void seed_random(uvec2 pixel, uint stream) {
+  const uint call = pcg_hash(render_call_info.number ^ pcg_hash(stream));
+  random_state = pcg_hash(pixel.x ^ pcg_hash(pixel.y ^ call));
+}
+
+// pcg_hash advances the state once and permutes it, so this is one step of
+// the generator. The top 24 bits become a float in [0, 1).
+float random() {
+  const uint word = pcg_hash(random_state);
+  random_state = random_state * 747796405u + 2891336453u;
+  return float(word >> 8u) * (1.0f / 16777216.0f);
+}
+
+// Maps a point of the unit square to the unit sphere, uniformly if u is
+// uniform: z is linear in u.x (Archimedes).
+vec3 unit_vec(vec2 u) {
+  const float z = 1.0f - 2.0f * u.x, phi = 2.0f * PI * u.y,
+              r = sqrt(max(0.0f, 1.0f - z * z));
+  return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+// Maps a point of the unit square to the unit disk in the xy plane.
+vec3 in_unit_disk(vec2 u) {
+  const float r = sqrt(u.x), phi = 2.0f * PI * u.y;
+  return vec3(r * cos(phi), r * sin(phi), 0);
+}
+
+// Samplers, see include/sampler.hh for the host copies and the dimension
+// layout. Only kernels that call start_sample use SAMPLER, the others draw
+// from random() for every dimension.
+const uint SAMPLER_INDEPENDENT = 0;
+const uint SAMPLER_STRATIFIED = 1;
+const uint SAMPLER_SOBOL = 2;
+const uint SAMPLER_BLUE_NOISE = 3;
+layout(constant_id = 5) const uint SAMPLER = SAMPLER_INDEPENDENT;
+
+const uint DIMENSION_PIXEL = 0;
+const uint DIMENSION_LENS = 1;
+const uint DIMENSION_FIRST_BOUNCE = 2;
+const uint DIMENSIONS_PER_BOUNCE = 5;
+const uint DIMENSION_SCATTER = 0;
+const uint DIMENSION_LIGHT = 1;
+const uint DIMENSION_ENVIRONMENT = 2;
+// Read by the path guide of the CPU tracer only.
+const uint DIMENSION_GUIDE = 3;
+const uint DIMENSION_ENVIRONMENT_JITTER = 4;
+
+bool sequence_active = false;
+uvec2 sequence_pixel;
+uint sequence_index;
+uint sequence_samples;
+// The bounce whose dimensions sample_bounce_2d reads.
+uint sample_depth = 0;
+
+// sample_index counts the samples of the pixel across all passes, samples
+// is the number the pixel will get in total.
+void start_sample(uvec2 pixel, uint sample_index, uint samples) {
+  sequence_active = SAMPLER != SAMPLER_INDEPENDENT;
+  sequence_pixel = pixel;
+  sequence_index = sample_index;
+  sequence_samples = max(samples, 1u);
+  sample_depth = 0;
+}
+
+float bits_to_float(uint bits) {
+  return float(bits >> 8u) * (1.0f / 16777216.0f);
+}
+
+uint laine_karras_permutation(uint x, uint seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+// Owen scramble: every bit is flipped depending on the bits above it.
+uint nested_uniform_scramble(uint x, uint seed) {
+  return bitfieldReverse(laine_karras_permutation(bitfieldReverse(x), seed));
+}
+
+uvec2 sobol(uint index) {
+  const uint first = bitfieldReverse(index);
+  uint second = 0;
+  for (uint v = 1u << 31u; index != 0; index >>= 1u, v ^= v >> 1u)
+    if ((index & 1u) != 0)
+      second ^= v;
+  return uvec2(first, second);
+}
+
+vec2 owen_sobol(uint index, uint seed) {
+  const uvec2 point = sobol(nested_uniform_scramble(index, seed));
+  return vec2(
+      bits_to_float(nested_uniform_scramble(point.x, pcg_hash(seed ^ 1u))),
+      bits_to_float(nested_uniform_scramble(point.y, pcg_hash(seed ^ 2u))));
+}
+
+// Random permutation of [0, length) picked by seed (Kensler 2013).
+uint permute(uint i, uint length, uint seed) {
+  uint w = length - 1;
+  w |= w >> 1u;
+  w |= w >> 2u;
+  w |= w >> 4u;
+  w |= w >> 8u;
+  w |= w >> 16u;
+  do {
+    i ^= seed;
+    i *= 0xe170893du;
+    i ^= seed >> 16u;
+    i ^= (i & w) >> 4u;
+    i ^= seed >> 8u;
+    i *= 0x0929eb3fu;
+    i ^= seed >> 23u;
+    i ^= (i & w) >> 1u;
+    i *= 1u | seed >> 27u;
+    i *= 0x6935fa69u;
+    i ^= (i & w) >> 11u;
+    i *= 0x74dcb303u;
+    i ^= (i & w) >> 2u;
+    i *= 0x9e501cc3u;
+    i ^= (i & w) >> 2u;
+    i *= 0xc860a3dfu;
+    i &= w;
+    i ^= i >> 5u;
+  } while (i >= length);
+  return (i + seed) % length;
+}
+
+uint morton(uvec2 pixel) {
+  uint index = 0;
+  for (uint bit = 0; bit < 16; bit++)
+    index |= ((pixel.x >> bit) & 1u) << (2 * bit) |
+             ((pixel.y >> bit) & 1u) << (2 * bit + 1);
+  return index;
+}
+
+vec2 sample_2d(uint dimension) {
+  if (!sequence_active)
+    return vec2(random(), random());
+
+  if (SAMPLER == SAMPLER_BLUE_NOISE) {
+    const uint sample_bits = uint(findMSB(sequence_samples - 1) + 1);
+    return owen_sobol((morton(sequence_pixel) << sample_bits) + sequence_index,
+                      pcg_hash(dimension));
+  }
+
+  const uint seed = pcg_hash(
+      sequence_pixel.x ^ pcg_hash(sequence_pixel.y ^ pcg_hash(dimension)));
+  if (SAMPLER == SAMPLER_STRATIFIED) {
+    // sqrt may be off by an ulp, the correction keeps columns exact.
+    uint columns = uint(sqrt(float(sequence_samples)));
+    if ((columns + 1) * (columns + 1) <= sequence_samples)
+      columns++;
+    const uint rows = sequence_samples / columns, cells = columns * rows;
+    const uint stratum = permute(sequence_index % cells, cells, seed),
+               jitter = pcg_hash(seed ^ pcg_hash(sequence_index));
+    return vec2((float(stratum % columns) + bits_to_float(jitter)) /
+                    float(columns),
+                (float(stratum / columns) + bits_to_float(pcg_hash(jitter))) /
+                    float(rows));
+  }
+  return owen_sobol(sequence_index, seed);
+}
+
+vec2 sample_bounce_2d(uint dimension) {
+  return sample_2d(DIMENSION_FIRST_BOUNCE +
+                   DIMENSIONS_PER_BOUNCE * sample_depth + dimension);
+}
+
+HitRecord hit_sphere(uint index, Ray ray, float lo, float hi) {
+  const Hittable sphere = scene.hittables[index];
+  const vec3 oc = sphere.center - ray.origin;
+  const float a = dot(ray.direction, ray.direction), h = dot(ray.direction, oc),
+              c = dot(oc, oc) - sphere.radius * sphere.radius,
+              discriminant = h * h - a * c;
+
+  HitRecord res;
+  res.valid = false;
+  if (discriminant < 0)
+    return res;
+
+  const float sqrtd = sqrt(discriminant);
+  float root = (h - sqrtd) / a;
+  if (root <= lo || hi <= root) {
+    root = (h + sqrtd) / a;
+    if (root <= lo || hi <= root)
+      return res;
+  }
+
+  res.valid = true;
+  res.point = ray_at(ray, root);
+  const vec3 outward_normal = (res.point - sphere.center) / sphere.radius;
+  res.front_face = dot(ray.direction, outward_normal) < 0;
+  res.normal = res.front_face ? outward_normal : -outward_normal;
+  res.material_index = sphere.material_index;
+  res.t = root;
+  return res;
+}
+
+HitRecord hit_disk(uint index, Ray ray, float lo, float hi) {
+  const Hittable disk = scene.hittables[index];
+  const vec3 oc = disk.center - ray.origin;
+
+  HitRecord res;
+  res.valid = false;
+  const float signed_dist = dot(oc, disk.normal);
+  if (signed_dist <= 0)
+    return res;
+
+  const vec3 direction_normal = dot(disk.normal, ray.direction) * disk.normal;
+  const float root = abs(signed_dist / dot(ray.direction, disk.normal));
+  if (root <= lo || hi <= root)
+    return res;
+
+  res.point = ray_at(ray, root);
+  if (distance(res.point, disk.center) > disk.radius)
+    return res;
+  res.valid = true;
+  res.front_face = dot(ray.direction, disk.normal) < 0;
+  res.normal = res.front_face ? disk.normal : -disk.normal;
+  res.material_index = disk.material_index;
+  res.t = root;
+  return res;
+}
+
+HitRecord hit_hittable(uint index, Ray ray, float lo, float hi) {
+  if (scene.hittables[index].kind == HITTABLE_KIND_SPHERE)
+    return hit_sphere(index, ray, lo, hi);
+  return hit_disk(index, ray, lo, hi);
+}
+
+HitRecord hit_world(Ray ray, float lo, float hi) {
+  HitRecord world_hit;
+  world_hit.valid = false;
+  float closest = hi;
+
+  for (uint i = 0; i < scene.hittables_count; i++) {
+    const uint kind = scene.hittables[i].kind;
+    HitRecord current;
+    if (kind == HITTABLE_KIND_SPHERE)
+      current = hit_sphere(i, ray, lo, closest);
+    else
+      current = hit_disk(i, ray, lo, closest);
+
+    if (!current.valid)
+      continue;
+
+    world_hit = current;
+    closest = current.t;
+  }
+
+  return world_hit;
+}
+
+// Any-hit query for shadow rays, stops at the first hit in (lo, hi).
+bool occluded(Ray ray, float lo, float hi) {
+  for (uint i = 0; i < scene.hittables_count; i++)
+    if (hit_hittable(i, ray, lo, hi).valid)
+      return true;
+  return false;
+}
+
+ScatterResult scatter_lambertian(Ray ray, HitRecord record) {
+  const vec3 scatter_direction =
+      record.normal + unit_vec(sample_bounce_2d(DIMENSION_SCATTER));
+  const Ray scattered = Ray(record.point, scatter_direction);
+  return ScatterResult(true, scattered,
+                       scene.materials[record.material_index].color);
+}
+
+ScatterResult scatter_metal(Ray ray, HitRecord record) {
+  const uint index = record.material_index;
+  const vec3 reflected =
+      normalize(reflect(ray.direction, record.normal)) +
+      scene.materials[index].parameter *
+          unit_vec(sample_bounce_2d(DIMENSION_SCATTER));
+  const Ray scattered = Ray(record.point, reflected);
+
+  if (dot(scattered.direction, record.normal) > 0)
+    return ScatterResult(true, scattered, scene.materials[index].color);
+  else
+    return ScatterResult(false, Ray(vec3(0), vec3(0)), vec3(0));
+}
+
+float reflectance(float cosine, float refraction_index) {
+  const float r0 =
+      pow((1.0f - refraction_index) / (1.0f + refraction_index), 2.0f);
+  return r0 + (1.0f - r0) * pow(1.0f - cosine, 5.0f);
+}
+
+ScatterResult scatter_dielectric(Ray ray, HitRecord record) {
+  const float parameter = scene.materials[record.material_index].parameter;
+  const float ri = record.front_face ? 1.0f / parameter : parameter;
+  const vec3 unit_direction = normalize(ray.direction);
+
+  const float cos_theta = min(dot(-unit_direction, record.normal), 1.0f),
+              sin_theta = sqrt(1.0f - cos_theta * cos_theta);
+
+  vec3 direction;
+  if (ri * sin_theta > 1.0f ||
+      reflectance(cos_theta, ri) > sample_bounce_2d(DIMENSION_SCATTER).x)
+    direction = reflect(unit_direction, record.normal);
+  else {
+    const vec3 r_out_perp = ri * (unit_direction + cos_theta * record.normal),
+               r_out_parallel = -sqrt(abs(1.0f - dot(r_out_perp, r_out_perp))) *
+                                record.normal;
+    direction = r_out_perp + r_out_parallel;
+  }
+
+  const Ray scattered = Ray(record.point, direction);
+  return ScatterResult(true, scattered, vec3(1, 1, 1));
+}
+
+ScatterResult scatter_portal(Ray ray, HitRecord record) {
+  const uint index = record.material_index;
+  const mat3 rotation = scene.materials[index].rotation;
+  const Ray scattered =
+      Ray(rotation * record.point + scene.materials[index].translation,
+          rotation * ray.direction);
+  return ScatterResult(true, scattered, scene.materials[index].color);
+}
+
+bool has_material_kind(uint kind) {
+  return (MATERIAL_KINDS & (1u << kind)) != 0;
+}
+
+bool is_portal(uint material_index) {
+  return has_material_kind(MATERIAL_KIND_PORTAL) &&
+         scene.materials[material_index].kind == MATERIAL_KIND_PORTAL;
+}
+
+// The portal traversals of a path so far, see PortalRun in
+// include/camera.hh. Hops in a row are checked for a loop with Brent's
+// algorithm against the ray saved after 1, 2, 4, ... hops of the run.
+struct PortalRun {
+  uint hops;
+  uint length;
+  Ray saved;
+};
+
+PortalRun start_portal_run() { return PortalRun(0, 0, Ray(vec3(0), vec3(0))); }
+
+bool same_ray(Ray a, Ray b) {
+  const float tolerance = 1e-4f;
+  return distance(a.origin, b.origin) <= tolerance &&
+         distance(normalize(a.direction), normalize(b.direction)) <=
+             tolerance;
+}
+
+// Whether the path may go on after a portal moved it to ray. Portals move
+// rays without randomness, so a run of hops that comes back to an earlier
+// ray repeats forever and never reaches a light.
+bool portal_hop(inout PortalRun run, Ray ray) {
+  count_portal_traversals();
+  run.hops++;
+  if (run.hops > MAX_PORTAL_HOPS)
+    return false;
+  if (run.length > 0 && same_ray(run.saved, ray))
+    return false;
+  run.length++;
+  if ((run.length & (run.length - 1)) == 0)
+    run.saved = ray;
+  return true;
+}
+
+ScatterResult scatter(uint index, Ray ray, HitRecord record) {
+  // Scenes with a single material kind do not have to read it.
+  const uint kind = bitCount(MATERIAL_KINDS) == 1
+                        ? uint(findLSB(MATERIAL_KINDS))
+                        : scene.materials[index].kind;
+  if (has_material_kind(MATERIAL_KIND_LAMBERTIAN) &&
+      kind == MATERIAL_KIND_LAMBERTIAN)
+    return scatter_lambertian(ray, record);
+  if (has_material_kind(MATERIAL_KIND_METAL) && kind == MATERIAL_KIND_METAL)
+    return scatter_metal(ray, record);
+  if (has_material_kind(MATERIAL_KIND_DIELECTRIC) &&
+      kind == MATERIAL_KIND_DIELECTRIC)
+    return scatter_dielectric(ray, record);
+  if (has_material_kind(MATERIAL_KIND_PORTAL) && kind == MATERIAL_KIND_PORTAL)
+    return scatter_portal(ray, record);
+  return ScatterResult(false, Ray(vec3(0), vec3(0)), vec3(0));
+}
+
+bool is_emissive(uint material_index) {
+  return has_material_kind(MATERIAL_KIND_EMISSIVE) &&
+         scene.materials[material_index].kind == MATERIAL_KIND_EMISSIVE;
+}
+
+// 1 - cos of the half angle of the cone that a sphere subtends, as in
+// sphere.cc.
+float cone_height(float radius, vec3 to_center) {
+  const float s = min(radius * radius / dot(to_center, to_center), 1.0f);
+  return s / (1 + sqrt(1 - s));
+}
+
+// Light sampling, the same densities as Sphere and Disk in src/sphere.cc and
+// src/disk.cc: spheres are sampled uniformly in the cone they subtend, disks
+// uniformly by area. Directions that miss the light have density 0.
+float light_pdf(uint index, Ray ray) {
+  const Hittable light = scene.hittables[index];
+  const HitRecord record =
+      hit_hittable(index, ray, 0.001, MAX_RAY_COLLISION_DISTANCE);
+  if (!record.valid)
+    return 0;
+
+  if (light.kind == HITTABLE_KIND_SPHERE) {
+    const vec3 to_center = light.center - ray.origin;
+    return 1 / (2 * PI * cone_height(light.radius, to_center));
+  }
+  const float distance_squared =
+                  record.t * record.t * dot(ray.direction, ray.direction),
+              cosine =
+                  abs(dot(light.normal, ray.direction)) / length(ray.direction);
+  return distance_squared / (cosine * PI * light.radius * light.radius);
+}
+
+// Every light is picked with the same probability.
+float lights_pdf(Ray ray) {
+  float sum = 0;
+  for (uint i = 0; i < light_count; i++)
+    sum += light_pdf(light_indices[i], ray);
+  return sum / float(light_count);
+}
+
+mat3 orthonormal_basis(vec3 w) {
+  const vec3 a = abs(w.x) > 0.9f ? vec3(0, 1, 0) : vec3(1, 0, 0);
+  const vec3 v = normalize(cross(w, a));
+  return mat3(cross(w, v), v, w);
+}
+
+// u.x picks the light, and what is left of it after scaling to the number of
+// lights is uniform again and reused.
+vec3 sample_light_direction(vec3 origin) {
+  vec2 u = sample_bounce_2d(DIMENSION_LIGHT);
+  const float scaled = u.x * float(light_count);
+  const uint chosen = min(uint(scaled), light_count - 1);
+  u.x = min(scaled - float(chosen), 0.99999994f);
+  const Hittable light = scene.hittables[light_indices[chosen]];
+  if (light.kind == HITTABLE_KIND_SPHERE) {
+    const vec3 to_center = light.center - origin;
+    const float height = u.x * cone_height(light.radius, to_center),
+                z = 1 - height, phi = 2 * PI * u.y,
+                r = sqrt(max(height * (2 - height), 0.0f));
+    return orthonormal_basis(normalize(to_center)) *
+           vec3(r * cos(phi), r * sin(phi), z);
+  }
+  const vec3 p = in_unit_disk(u) * light.radius;
+  return light.center + orthonormal_basis(normalize(light.normal)) * p -
+         origin;
+}
+
+// As a ratio, so that a pdf too large to square still weighs 1.
+float power_heuristic(float pdf, float other_pdf) {
+  const float ratio = other_pdf / pdf;
+  return 1 / (1 + ratio * ratio);
+}
+
+// Next-event estimation at a diffuse surface: one shadow ray towards a random
+// point of a random light, weighted against finding the same light by
+// scattering.
+vec3 sample_direct_light(HitRecord record, vec3 albedo) {
+  const Ray shadow_ray =
+      Ray(record.point, sample_light_direction(record.point));
+  const float light_pdf = lights_pdf(shadow_ray),
+              cosine = dot(record.normal, normalize(shadow_ray.direction)),
+              bsdf_pdf = max(cosine, 0.0f) / PI;
+  if (light_pdf <= 0 || bsdf_pdf <= 0)
+    return vec3(0);
+
+  // The closest light along the ray, anything closer occludes it.
+  HitRecord light_hit;
+  light_hit.valid = false;
+  float closest = MAX_RAY_COLLISION_DISTANCE;
+  for (uint i = 0; i < light_count; i++) {
+    const HitRecord current =
+        hit_hittable(light_indices[i], shadow_ray, 0.001, closest);
+    if (current.valid) {
+      light_hit = current;
+      closest = current.t;
+    }
+  }
+  if (!light_hit.valid)
+    return vec3(0);
+  count_rays();
+  if (occluded(shadow_ray, 0.001, light_hit.t * 0.999f))
+    return vec3(0);
+
+  return albedo * bsdf_pdf * scene.materials[light_hit.material_index].color *
+         power_heuristic(light_pdf, bsdf_pdf) / light_pdf;
+}
+
+const uint ENVIRONMENT_TILE_SIZE = 8;
+
+uint environment_index(uvec2 texel) {
+  const uint tiles_x = (environment_width + ENVIRONMENT_TILE_SIZE - 1) /
+                       ENVIRONMENT_TILE_SIZE;
+  const uvec2 tile = texel / ENVIRONMENT_TILE_SIZE,
+              within_tile = texel % ENVIRONMENT_TILE_SIZE;
+  return (tile.y * tiles_x + tile.x) * ENVIRONMENT_TILE_SIZE *
+             ENVIRONMENT_TILE_SIZE +
+         within_tile.y * ENVIRONMENT_TILE_SIZE + within_tile.x;
+}
+
+EnvironmentTexel environment_texel(vec3 direction) {
+  const vec3 unit_direction = normalize(direction);
+  const float theta = acos(clamp(unit_direction.y, -1.0f, 1.0f));
+  float phi = atan(unit_direction.z, unit_direction.x);
+  if (phi < 0)
+    phi += 2 * PI;
+  const uvec2 size = uvec2(environment_width, environment_height),
+              texel = min(uvec2(vec2(phi / (2 * PI), theta / PI) * vec2(size)),
+                          size - 1);
+  return environment_texels[environment_index(texel)];
+}
+
+// Density in solid angle of sample_environment_direction.
+float environment_pdf(vec3 direction) {
+  // Unlike 1 - y^2, keeps its precision next to the poles.
+  const float sin_theta = length(normalize(direction).xz);
+  if (sin_theta <= 0)
+    return 0;
+  return environment_texel(direction).pdf / (2 * PI * PI * sin_theta);
+}
+
+// u.x picks the alias table entry and u.y the entry or its alias, as in
+// Environment::sample. jitter places the direction within the texel.
+vec3 sample_environment_direction() {
+  const vec2 u = sample_bounce_2d(DIMENSION_ENVIRONMENT),
+             jitter = sample_bounce_2d(DIMENSION_ENVIRONMENT_JITTER);
+  const uint count = uint(environment_texels.length());
+  uint index = min(uint(u.x * float(count)), count - 1);
+  const EnvironmentTexel entry = environment_texels[index];
+  if (u.y >= entry.probability)
+    index = entry.alias;
+
+  const uint tile_area = ENVIRONMENT_TILE_SIZE * ENVIRONMENT_TILE_SIZE,
+             tiles_x = (environment_width + ENVIRONMENT_TILE_SIZE - 1) /
+                       ENVIRONMENT_TILE_SIZE,
+             tile = index / tile_area, within_tile = index % tile_area;
+  const uvec2 texel =
+      uvec2(tile % tiles_x, tile / tiles_x) * ENVIRONMENT_TILE_SIZE +
+      uvec2(within_tile % ENVIRONMENT_TILE_SIZE,
+            within_tile / ENVIRONMENT_TILE_SIZE);
+  const float phi = 2 * PI * (float(texel.x) + jitter.x) /
+                    float(environment_width),
+              theta = PI * (float(texel.y) + jitter.y) /
+                      float(environment_height);
+  return vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+// The same for the environment, whose shadow rays escape the world.
+vec3 sample_direct_environment(HitRecord record, vec3 albedo) {
+  const Ray shadow_ray = Ray(record.point, sample_environment_direction());
+  const float pdf = environment_pdf(shadow_ray.direction),
+              cosine = dot(record.normal, normalize(shadow_ray.direction)),
+              bsdf_pdf = max(cosine, 0.0f) / PI;
+  if (pdf <= 0 || bsdf_pdf <= 0)
+    return vec3(0);
+
+  count_rays();
+  if (occluded(shadow_ray, 0.001, MAX_RAY_COLLISION_DISTANCE))
+    return vec3(0);
+
+  return albedo * bsdf_pdf * environment_texel(shadow_ray.direction).color *
+         power_heuristic(pdf, bsdf_pdf) / pdf;
+}
+
+vec3 ambient_light(Ray ray) {
+  if (environment_width > 0)
+    return environment_texel(ray.direction).color;
+  const vec3 unit_direction = normalize(ray.direction);
+  const float a = 0.5f * (unit_direction.y + 1.0f);
+  return (1.0f - a) * vec3(1, 1, 1) + a * vec3(0.5, 0.7, 1.0);
+}
+
+// Lights and the environment are sampled at every diffuse bounce and
+// combined with what scattered rays hit through multiple importance
+// sampling.
+vec3 ray_color(Ray ray) {
+  vec3 attenuation = vec3(1, 1, 1), radiance = vec3(0, 0, 0);
+  Ray current_ray = ray;
+  // Density of the diffuse bounce that cast current_ray, 0 if the bounce did
+  // not sample lights.
+  float bsdf_pdf = 0;
+  PortalRun portal_run = start_portal_run();
+
+  for (uint depth = 0; depth < MAX_DEPTH;) {
+    sample_depth = depth;
+    count_rays();
+    HitRecord record =
+        hit_world(current_ray, 0.001, MAX_RAY_COLLISION_DISTANCE);
+    if (!record.valid) {
+      const float weight = bsdf_pdf > 0 && environment_width > 0
+                               ? power_heuristic(
+                                     bsdf_pdf,
+                                     environment_pdf(current_ray.direction))
+                               : 1.0f;
+      return radiance + attenuation * weight * ambient_light(current_ray);
+    }
+
+    if (is_emissive(record.material_index)) {
+      const float weight =
+          bsdf_pdf > 0 ? power_heuristic(bsdf_pdf, lights_pdf(current_ray))
+                       : 1.0f;
+      return radiance + attenuation * weight *
+                            scene.materials[record.material_index].color;
+    }
+
+    ScatterResult material_hit =
+        scatter(record.material_index, current_ray, record);
+    if (!material_hit.valid)
+      return radiance;
+
+    bsdf_pdf = 0;
+    // Lights are not sampled through portals, so the lights that rays find
+    // through them are not weighted.
+    if (is_portal(record.material_index)) {
+      current_ray = material_hit.scattered_ray;
+      attenuation *= material_hit.attenuation;
+      if (!portal_hop(portal_run, current_ray))
+        return radiance;
+      continue;
+    }
+    portal_run.length = 0;
+
+    const bool sample_lights =
+        has_material_kind(MATERIAL_KIND_EMISSIVE) && light_count > 0;
+    if ((sample_lights || environment_width > 0) &&
+        scene.materials[record.material_index].kind ==
+            MATERIAL_KIND_LAMBERTIAN) {
+      if (sample_lights)
+        radiance += attenuation *
+                    sample_direct_light(record, material_hit.attenuation);
+      if (environment_width > 0)
+        radiance += attenuation * sample_direct_environment(
+                                      record, material_hit.attenuation);
+      bsdf_pdf = max(dot(record.normal,
+                         normalize(material_hit.scattered_ray.direction)),
+                     0.0f) /
+                 PI;
+    }
+    current_ray = material_hit.scattered_ray;
+    attenuation *= material_hit.attenuation;
+    depth++;
+  }
+
+  return radiance + attenuation * ambient_light(current_ray);
+}
+
+vec3 defocus_disk_sample() {
+  const vec3 p = in_unit_disk(sample_2d(DIMENSION_LENS));
+  return viewport.eye + p.x * viewport.defocus_disk_u +
+         p.y * viewport.defocus_disk_v;
+}
+
+Ray get_ray(uvec2 pixel) {
+  const vec3 offset = vec3(sample_2d(DIMENSION_PIXEL) - 1, 0),
+             pixel_sample = viewport.pixel00_location +
+                            (pixel.x + offset.x) * viewport.pixel_delta_u +
+                            (pixel.y + offset.y) * viewport.pixel_delta_v,
+             origin = viewport.defocus != 0 ? defocus_disk_sample()
+                                            : viewport.eye,
+             direction = pixel_sample - origin;
+  return Ray(origin, direction);
+}
@@ -0,0 +1,34 @@
+#include "aabb.hh"
+
+#include "interval.hh"
+#include "ray.hh"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+Aabb::Aabb() : min(+INFINITY), max(-INFINITY) {}
+
+Aabb::Aabb(const glm::vec3 &min, const glm::vec3 &max) : min(min), max(max) {}
+
+glm::vec3 Aabb::center() const { return (min + max) * 0.5f; }
+
+void Aabb::merge(const Aabb &other) {
+  min = glm::min(min, other.min);
+  max = glm::max(max, other.max);
+}
+
+// The ray is clipped to the slab between the two planes of every axis.
+bool Aabb::hit(const Ray &ray, const glm::vec3 &inverse_direction,
+               Interval ray_t) const {
+  for (int axis = 0; axis < 3; axis++) {
+    const auto t0 = (min[axis] - ray.origin()[axis]) * inverse_direction[axis],
+               t1 = (max[axis] - ray.origin()[axis]) * inverse_direction[axis];
+    ray_t.lo = std::max(ray_t.lo, std::min(t0, t1));
+    ray_t.hi = std::min(ray_t.hi, std::max(t0, t1));
+    if (ray_t.hi < ray_t.lo)
+      return false;
+  }
+  return true;
+}
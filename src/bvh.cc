@@ -0,0 +1,128 @@
+#include "bvh.hh"
+
+#include "aabb.hh"
+#include "hittable.hh"
+#include "hittable_list.hh"
+#include "interval.hh"
+#include "ray.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+Bvh::Bvh(const HittableList &list) {
+  std::vector<Item> items;
+  for (const auto &hittable : list.hittables)
+    items.push_back({.box = hittable->bounding_box(), .hittable = hittable});
+  if (!items.empty())
+    _build(items, 0, items.size());
+}
+
+void Bvh::_build(std::vector<Item> &items, std::size_t begin,
+                 std::size_t end) {
+  const auto index = _nodes.size();
+  _nodes.push_back({.box = {}, .second_child = 0, .first = 0, .count = 0,
+                    .axis = 0});
+  Aabb box, centers;
+  for (auto i = begin; i < end; i++) {
+    box.merge(items[i].box);
+    const auto center = items[i].box.center();
+    centers.merge({center, center});
+  }
+  const auto spread = centers.max - centers.min;
+  const auto axis = spread.x > spread.y && spread.x > spread.z ? 0
+                    : spread.y > spread.z                      ? 1
+                                                               : 2;
+  if (end - begin <= LEAF_SIZE || !(spread[axis] > 0)) {
+    _nodes[index] = {.box = box,
+                     .second_child = 0,
+                     .first = static_cast<std::uint32_t>(_hittables.size()),
+                     .count = static_cast<std::uint32_t>(end - begin),
+                     .axis = 0};
+    for (auto i = begin; i < end; i++)
+      _hittables.push_back(items[i].hittable);
+    return;
+  }
+
+  const auto middle = begin + (end - begin) / 2;
+  std::nth_element(items.begin() + begin, items.begin() + middle,
+                   items.begin() + end, [&](const Item &a, const Item &b) {
+                     return a.box.center()[axis] < b.box.center()[axis];
+                   });
+  _build(items, begin, middle);
+  const auto second_child = static_cast<std::uint32_t>(_nodes.size());
+  _build(items, middle, end);
+  _nodes[index] = {.box = box,
+                   .second_child = second_child,
+                   .first = 0,
+                   .count = 0,
+                   .axis = static_cast<std::uint32_t>(axis)};
+}
+
+// The child on the side the ray comes from is visited first, so that its
+// hits shorten the interval the other child is tested with.
+std::optional<HitRecord> Bvh::hit(const Ray &ray, Interval ray_t) const {
+  std::optional<HitRecord> closest;
+  if (_nodes.empty())
+    return closest;
+  const auto inverse_direction = 1.0f / ray.direction();
+  std::uint32_t stack[64];
+  std::size_t stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size > 0) {
+    const auto index = stack[--stack_size];
+    const auto &node = _nodes[index];
+    if (!node.box.hit(ray, inverse_direction, ray_t))
+      continue;
+    if (node.count > 0) {
+      for (auto i = node.first; i < node.first + node.count; i++)
+        if (auto record = _hittables[i]->hit(ray, ray_t)) {
+          ray_t.hi = record->t;
+          closest = std::move(record);
+        }
+      continue;
+    }
+    if (ray.direction()[node.axis] < 0) {
+      stack[stack_size++] = index + 1;
+      stack[stack_size++] = node.second_child;
+    } else {
+      stack[stack_size++] = node.second_child;
+      stack[stack_size++] = index + 1;
+    }
+  }
+  return closest;
+}
+
+bool Bvh::occluded(const Ray &ray, float t_max) const {
+  if (_nodes.empty())
+    return false;
+  const auto inverse_direction = 1.0f / ray.direction();
+  const Interval ray_t(0.001f, t_max);
+  std::uint32_t stack[64];
+  std::size_t stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size > 0) {
+    const auto index = stack[--stack_size];
+    const auto &node = _nodes[index];
+    if (!node.box.hit(ray, inverse_direction, ray_t))
+      continue;
+    if (node.count > 0) {
+      for (auto i = node.first; i < node.first + node.count; i++)
+        if (_hittables[i]->occluded(ray, t_max))
+          return true;
+      continue;
+    }
+    stack[stack_size++] = node.second_child;
+    stack[stack_size++] = index + 1;
+  }
+  return false;
+}
+
+Aabb Bvh::bounding_box() const {
+  return _nodes.empty() ? Aabb() : _nodes.front().box;
+}
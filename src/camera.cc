@@ -1,43 +1,62 @@
 #include "camera.hh"
 
 #include "hittable.hh"
+#include "hittable_list.hh"
 #include "interval.hh"
 #include "ray.hh"
 #include "utils.hh"
+#include "viewport.hh"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <utility>
 
 #include <glm/glm.hpp>
 
 Camera::Camera() : Camera(DEFAULT_CONFIG) {}
 
-Camera::Camera(const CameraConfig &config) : _config(config) {
-  _image_height =
-      std::max(static_cast<int>(_config.image_width / _config.aspect_ratio), 1);
-
-  const auto theta = glm::radians(_config.vfov), h = std::tan(theta / 2),
-             viewport_height = 2.0f * h * _config.focus_dist,
-             viewport_width =
-                 viewport_height *
-                 (static_cast<float>(_config.image_width) / _image_height);
-  const auto w = glm::normalize(_config.eye - _config.center),
-             u = glm::normalize(glm::cross(_config.up, w)),
-             v = glm::cross(w, u), viewport_u = viewport_width * u,
-             viewport_v = -viewport_height * v,
-             viewport_upper_left = _config.eye - (_config.focus_dist * w) -
-                                   viewport_u / 2.0f - viewport_v / 2.0f;
-  _pixel_delta_u = viewport_u / static_cast<float>(_config.image_width);
-  _pixel_delta_v = viewport_v / static_cast<float>(_image_height);
-  _pixel00_location =
-      viewport_upper_left + 0.5f * (_pixel_delta_u + _pixel_delta_v);
-
-  const auto defocus_radius =
-      _config.focus_dist * tan(glm::radians(_config.defocus_angle / 2));
-  _defocus_disk_u = defocus_radius * u;
-  _defocus_disk_v = defocus_radius * v;
+Camera::Camera(const CameraConfig &config)
+    : Camera(config, std::max(static_cast<int>(config.image_width /
+                                               config.aspect_ratio),
+                              1)) {}
+
+CameraConfig scene_camera_config(const gpu::Camera &camera,
+                                 std::uint32_t width, std::uint32_t height,
+                                 int samples_per_pixel, int max_depth,
+                                 int max_portal_hops) {
+  return {
+      .aspect_ratio = static_cast<float>(width) / static_cast<float>(height),
+      .image_width = static_cast<int>(width),
+      .samples_per_pixel = samples_per_pixel,
+      .max_depth = max_depth,
+      .max_portal_hops = max_portal_hops,
+      .vfov = camera.vfov,
+      .eye = camera.eye,
+      .center = camera.center,
+      .up = camera.up,
+      .defocus_angle = camera.defocus_angle,
+      .focus_dist = camera.focus_dist,
+      .bsdf_sampling_only = false,
+      .sampler = SamplerKind::INDEPENDENT,
+  };
+}
+
+Camera::Camera(const CameraConfig &config, int image_height)
+    : _config(config), _image_height(image_height) {
+  _viewport = gpu::Viewport::from_camera(
+      {
+          .eye = _config.eye,
+          .center = _config.center,
+          .up = _config.up,
+          .vfov = _config.vfov,
+          .defocus_angle = _config.defocus_angle,
+          .focus_dist = _config.focus_dist,
+      },
+      _config.image_width, _image_height);
 }
 
 void Camera::_write_color(std::ostream &out, const glm::vec3 &color) const {
@@ -51,23 +70,38 @@ void Camera::_write_color(std::ostream &out, const glm::vec3 &color) const {
   out << r << " " << g << " " << b << "\n";
 }
 
-glm::vec3 Camera::_sample_square() const {
-  return {random_float() - 1.0f, random_float() - 1.0f, 0};
+void Camera::set_environment(std::shared_ptr<const Environment> environment) {
+  _environment = std::move(environment);
+}
+
+void Camera::set_path_guide(std::shared_ptr<PathGuide> path_guide) {
+  _path_guide = std::move(path_guide);
 }
 
-glm::vec3 Camera::_defocus_disk_sample() const {
-  const auto p = random_in_unit_disk();
-  return _config.eye + p[0] * _defocus_disk_u + p[1] * _defocus_disk_v;
+glm::vec3 Camera::_background(const Ray &ray) const {
+  if (_environment)
+    return _environment->radiance(ray.direction());
+  const auto unit_direction = glm::normalize(ray.direction());
+  const auto a = 0.5f * (unit_direction[1] + 1.0f);
+  return (1.0f - a) * glm::vec3(1, 1, 1) + a * glm::vec3(0.5, 0.7, 1.0);
 }
 
-Ray Camera::_ray_at_pixel(int y, int x) const {
-  const auto offset = _sample_square();
+glm::vec3 Camera::_defocus_disk_sample(const glm::vec2 &u) const {
+  const auto p = in_unit_disk(u);
+  return _viewport.eye + p[0] * _viewport.defocus_disk_u +
+         p[1] * _viewport.defocus_disk_v;
+}
+
+Ray Camera::_ray_at_pixel(int y, int x, Sampler &sampler) const {
+  const auto offset = sampler.get_2d(Sampler::PIXEL_DIMENSION) - 1.0f;
   const auto pixel_sample =
-                 _pixel00_location +
-                 (static_cast<float>(x) + offset[0]) * _pixel_delta_u +
-                 (static_cast<float>(y) + offset[1]) * _pixel_delta_v,
-             origin = _config.defocus_angle <= 0 ? _config.eye
-                                                 : _defocus_disk_sample(),
+                 _viewport.pixel00_location +
+                 (static_cast<float>(x) + offset[0]) * _viewport.pixel_delta_u +
+                 (static_cast<float>(y) + offset[1]) * _viewport.pixel_delta_v,
+             origin = _viewport.defocus
+                          ? _defocus_disk_sample(
+                                sampler.get_2d(Sampler::LENS_DIMENSION))
+                          : _viewport.eye,
              direction = pixel_sample - origin;
   return {origin, direction};
 }
@@ -79,37 +113,274 @@ void Camera::render_to_file(const std::string &filename,
   for (int y = 0; y < _image_height; y++) {
     std::clog << "\rRemaining scanlines: " << (_image_height - y) << ' '
               << std::flush;
-    for (int x = 0; x < _config.image_width; x++) {
-      auto pixel_color = glm::vec3(0, 0, 0);
-      for (int sample = 0; sample < _config.samples_per_pixel; sample++) {
-        const auto ray = _ray_at_pixel(y, x);
-        pixel_color += _ray_color(ray, world);
-      }
-      _write_color(outfile,
-                   pixel_color / static_cast<float>(_config.samples_per_pixel));
-    }
+    for (int x = 0; x < _config.image_width; x++)
+      _write_color(outfile, trace_pixel(y, x, world) /
+                                static_cast<float>(_config.samples_per_pixel));
   }
   std::clog << "\rDone.                 \n";
 }
 
+glm::vec3 Camera::trace_pixel(int y, int x, const Hittable &world) const {
+  TraceCounters counters = {.rays = 0, .portal_traversals = 0};
+  return trace_pixel(y, x, world, HittableList(), counters);
+}
+
+glm::vec3 Camera::trace_pixel(int y, int x, const Hittable &world,
+                              const HittableList &lights,
+                              TraceCounters &counters,
+                              std::uint32_t first_sample) const {
+  auto pixel_color = glm::vec3(0, 0, 0);
+  accumulate_pixel(y, x, world, lights, counters, first_sample,
+                   static_cast<std::uint32_t>(_config.samples_per_pixel),
+                   pixel_color);
+  return pixel_color;
+}
+
+void Camera::accumulate_pixel(int y, int x, const Hittable &world,
+                              const HittableList &lights,
+                              TraceCounters &counters,
+                              std::uint32_t first_sample, std::uint32_t count,
+                              glm::vec3 &sum, PixelFeatures *features) const {
+  const auto sampler = Sampler::create(
+      _config.sampler, static_cast<std::uint32_t>(_config.samples_per_pixel));
+  for (std::uint32_t sample = 0; sample < count; sample++) {
+    sampler->start_sample(static_cast<std::uint32_t>(x),
+                          static_cast<std::uint32_t>(y),
+                          first_sample + sample);
+    sum += _ray_color(_ray_at_pixel(y, x, *sampler), world, lights, counters,
+                      *sampler, {.hops = 0, .length = 0, .saved = Ray()}, 0, 0,
+                      features);
+  }
+}
+
+PixelFeatures Camera::trace_features(int y, int x,
+                                     const Hittable &world) const {
+  IndependentSampler sampler(1);
+  PixelFeatures features = {
+      .albedo = {0, 0, 0}, .normal = {0, 0, 0}, .depth = 0};
+  for (int sample = 0; sample < _config.samples_per_pixel; sample++) {
+    sampler.start_sample(static_cast<std::uint32_t>(x),
+                         static_cast<std::uint32_t>(y),
+                         static_cast<std::uint32_t>(sample));
+    const auto ray = _ray_at_pixel(y, x, sampler);
+    const auto record = world.hit(ray, Interval(0.001f, INFINITY));
+    if (!record.has_value()) {
+      features.albedo += _background(ray);
+      continue;
+    }
+    features.albedo += record->material->albedo();
+    features.normal += record->normal;
+    features.depth += record->t * glm::length(ray.direction());
+  }
+  const auto samples = static_cast<float>(_config.samples_per_pixel);
+  return {.albedo = features.albedo / samples,
+          .normal = features.normal / samples,
+          .depth = features.depth / samples};
+}
+
+namespace {
+// Weight of a sample with density pdf that could also have been drawn with
+// density other_pdf. As a ratio, so that a pdf too large to square still
+// weighs 1 instead of inf / inf.
+float power_heuristic(float pdf, float other_pdf) {
+  const auto ratio = other_pdf / pdf;
+  return 1 / (1 + ratio * ratio);
+}
+
+float luminance(const glm::vec3 &color) {
+  return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+} // namespace
+
+float Camera::_scattering_pdf(const HitRecord &record, const Ray &scattered,
+                              std::optional<std::uint32_t> guide_leaf) const {
+  const auto bsdf_pdf =
+      record.material->scattering_pdf(Ray(), record, scattered);
+  if (!guide_leaf.has_value() || !_path_guide->trained())
+    return bsdf_pdf;
+  return GUIDE_FRACTION *
+             _path_guide->pdf(*guide_leaf, scattered.direction()) +
+         (1 - GUIDE_FRACTION) * bsdf_pdf;
+}
+
+// Next-event estimation: one shadow ray towards a random point of a random
+// light, weighted against finding the same light by scattering.
+glm::vec3 Camera::_sample_light(const HitRecord &record,
+                                const glm::vec3 &albedo, const Hittable &world,
+                                const HittableList &lights,
+                                TraceCounters &counters,
+                                std::optional<std::uint32_t> guide_leaf,
+                                const glm::vec2 &u) const {
+  const Ray shadow_ray(record.point, lights.random(record.point, u));
+  const auto light_pdf =
+                 lights.pdf_value(record.point, shadow_ray.direction()),
+             bsdf_pdf = record.material->scattering_pdf(Ray(), record,
+                                                        shadow_ray);
+  if (light_pdf <= 0 || bsdf_pdf <= 0)
+    return {0, 0, 0};
+
+  const auto light_hit = lights.hit(shadow_ray, Interval(0.001f, INFINITY));
+  if (!light_hit.has_value())
+    return {0, 0, 0};
+  counters.rays++;
+  if (world.occluded(shadow_ray, light_hit->t * 0.999f))
+    return {0, 0, 0};
+
+  return albedo * bsdf_pdf *
+         light_hit->material->emitted(shadow_ray, *light_hit) *
+         power_heuristic(light_pdf,
+                         _scattering_pdf(record, shadow_ray, guide_leaf)) /
+         light_pdf;
+}
+
+// The same for the environment, whose shadow rays escape the world.
+glm::vec3 Camera::_sample_environment(const HitRecord &record,
+                                      const glm::vec3 &albedo,
+                                      const Hittable &world,
+                                      TraceCounters &counters,
+                                      std::optional<std::uint32_t> guide_leaf,
+                                      const glm::vec2 &u,
+                                      const glm::vec2 &jitter) const {
+  const Ray shadow_ray(record.point, _environment->sample(u, jitter));
+  const auto environment_pdf = _environment->pdf(shadow_ray.direction()),
+             bsdf_pdf = record.material->scattering_pdf(Ray(), record,
+                                                        shadow_ray);
+  if (environment_pdf <= 0 || bsdf_pdf <= 0)
+    return {0, 0, 0};
+
+  counters.rays++;
+  if (world.occluded(shadow_ray, INFINITY))
+    return {0, 0, 0};
+
+  return albedo * bsdf_pdf * _environment->radiance(shadow_ray.direction()) *
+         power_heuristic(environment_pdf,
+                         _scattering_pdf(record, shadow_ray, guide_leaf)) /
+         environment_pdf;
+}
+
+namespace {
+bool same_ray(const Ray &a, const Ray &b) {
+  constexpr auto tolerance = 1e-4f;
+  return glm::distance(a.origin(), b.origin()) <= tolerance &&
+         glm::distance(glm::normalize(a.direction()),
+                       glm::normalize(b.direction())) <= tolerance;
+}
+} // namespace
+
+// Portals move rays without randomness, so a run of hops that comes back to
+// an earlier ray repeats forever and never reaches a light.
+bool Camera::_portal_hop(PortalRun &portal_run, const Ray &ray) const {
+  portal_run.hops++;
+  if (portal_run.hops > _config.max_portal_hops)
+    return false;
+  if (portal_run.length > 0 && same_ray(portal_run.saved, ray))
+    return false;
+  portal_run.length++;
+  if ((portal_run.length & (portal_run.length - 1)) == 0)
+    portal_run.saved = ray;
+  return true;
+}
+
 glm::vec3 Camera::_ray_color(const Ray &ray, const Hittable &world,
-                             int depth) const {
+                             const HittableList &lights,
+                             TraceCounters &counters, Sampler &sampler,
+                             PortalRun portal_run, int depth,
+                             float bsdf_pdf, PixelFeatures *features) const {
   if (depth >= _config.max_depth)
     return {0, 0, 0};
 
+  counters.rays++;
   const auto record = world.hit(ray, Interval(0.001f, INFINITY));
+  if (features != nullptr) {
+    if (record.has_value()) {
+      features->albedo += record->material->albedo();
+      features->normal += record->normal;
+      features->depth += record->t * glm::length(ray.direction());
+    } else {
+      features->albedo += _background(ray);
+    }
+  }
   if (record.has_value()) {
-    const auto direction =
-        random_on_hemisphere(record->normal) + record->normal;
-    const auto material_hit = record->material->scatter(ray, *record);
-    if (material_hit.has_value()) {
-      const auto &[scattered, attenuation] = *material_hit;
-      return _ray_color(scattered, world, depth + 1) * attenuation;
+    auto color = record->material->emitted(ray, *record);
+    if (bsdf_pdf > 0)
+      color *= power_heuristic(
+          bsdf_pdf, lights.pdf_value(ray.origin(), ray.direction()));
+
+    const auto material_hit = record->material->scatter(
+        ray, *record,
+        sampler.get_bounce_2d(depth, Sampler::SCATTER_DIMENSION));
+    if (!material_hit.has_value())
+      return color;
+
+    auto [scattered, attenuation] = *material_hit;
+    // Lights are not sampled through portals, so the lights that rays find
+    // through them are not weighted.
+    if (record->material->is_portal()) {
+      counters.portal_traversals++;
+      if (!_portal_hop(portal_run, scattered))
+        return color;
+      return color + _ray_color(scattered, world, lights, counters, sampler,
+                                portal_run, depth) *
+                         attenuation;
     }
-    return {0, 0, 0};
+    portal_run.length = 0;
+
+    // Diffuse bounces, whose directions have a density, are guided. Their
+    // attenuation is the albedo for cosine weighted directions, and the
+    // albedo times the cosine density over the mixture density for the
+    // directions of the mixture.
+    std::optional<std::uint32_t> guide_leaf;
+    if (_path_guide &&
+        record->material->scattering_pdf(ray, *record, scattered) > 0)
+      guide_leaf = _path_guide->leaf(record->point);
+    const auto guided = guide_leaf.has_value() && _path_guide->trained();
+    if (guided) {
+      const auto u = sampler.get_bounce_2d(depth, Sampler::GUIDE_DIMENSION);
+      if (u.x < GUIDE_FRACTION)
+        scattered =
+            Ray(record->point,
+                _path_guide->sample(*guide_leaf, {u.x / GUIDE_FRACTION, u.y}));
+    }
+    const auto scatter_pdf = _scattering_pdf(*record, scattered, guide_leaf);
+    if (guided)
+      attenuation =
+          scatter_pdf > 0
+              ? attenuation *
+                    record->material->scattering_pdf(ray, *record, scattered) /
+                    scatter_pdf
+              : glm::vec3(0, 0, 0);
+
+    float next_bsdf_pdf = 0;
+    if (!_config.bsdf_sampling_only &&
+        (!lights.hittables.empty() || _environment)) {
+      next_bsdf_pdf = scatter_pdf;
+      const auto albedo = record->material->albedo();
+      if (next_bsdf_pdf > 0 && !lights.hittables.empty())
+        color += _sample_light(
+            *record, albedo, world, lights, counters, guide_leaf,
+            sampler.get_bounce_2d(depth, Sampler::LIGHT_DIMENSION));
+      if (next_bsdf_pdf > 0 && _environment)
+        color += _sample_environment(
+            *record, albedo, world, counters, guide_leaf,
+            sampler.get_bounce_2d(depth, Sampler::ENVIRONMENT_DIMENSION),
+            sampler.get_bounce_2d(depth,
+                                  Sampler::ENVIRONMENT_JITTER_DIMENSION));
+    }
+    // Guided directions below the surface carry nothing.
+    if (attenuation == glm::vec3(0, 0, 0))
+      return color;
+
+    const auto incoming = _ray_color(scattered, world, lights, counters,
+                                     sampler, portal_run, depth + 1,
+                                     next_bsdf_pdf);
+    if (guide_leaf.has_value() && scatter_pdf > 0)
+      _path_guide->record(*guide_leaf, scattered.direction(),
+                          luminance(incoming) / scatter_pdf);
+    return color + incoming * attenuation;
   }
 
-  const auto unit_direction = glm::normalize(ray.direction());
-  const auto a = 0.5f * (unit_direction[1] + 1.0f);
-  return (1.0f - a) * glm::vec3(1, 1, 1) + a * glm::vec3(0.5, 0.7, 1.0);
+  if (bsdf_pdf > 0 && _environment)
+    return _background(ray) *
+           power_heuristic(bsdf_pdf, _environment->pdf(ray.direction()));
+  return _background(ray);
 }
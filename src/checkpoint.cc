@@ -0,0 +1,187 @@
+#include "checkpoint.hh"
+
+#include "sampler.hh"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glm/glm.hpp>
+
+namespace {
+// Version 2 numbers five sampler dimension pairs per bounce, so version 1
+// files would not resume the same sample sequences.
+constexpr auto magic = std::bit_cast<std::uint64_t>(
+    std::array<char, 8>{'R', 'T', 'C', 'K', 'P', 'T', '2', '\0'});
+
+std::size_t file_size(std::uint32_t width, std::uint32_t height,
+                      std::size_t header_size) {
+  return header_size +
+         static_cast<std::size_t>(width) * height * sizeof(glm::vec4);
+}
+} // namespace
+
+Checkpoint::Checkpoint(const std::string &filename,
+                       const CheckpointSettings &settings)
+    : _filename(filename),
+      _size(file_size(settings.width, settings.height, sizeof(Header))) {
+  _file = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (_file < 0)
+    throw std::runtime_error("Failed to open: " + filename);
+
+  struct stat status = {};
+  const auto created = fstat(_file, &status) == 0 && status.st_size == 0;
+  // A new file reads as zeros: no samples in any pixel.
+  if ((created && ftruncate(_file, static_cast<off_t>(_size)) != 0) ||
+      (!created && static_cast<std::size_t>(status.st_size) != _size)) {
+    close(_file);
+    throw std::runtime_error("Checkpoint of another image size: " + filename);
+  }
+  _map(PROT_READ | PROT_WRITE);
+
+  auto &header = _header();
+  if (created) {
+    header.width = settings.width;
+    header.height = settings.height;
+    header.sampler = static_cast<std::uint32_t>(settings.sampler);
+    header.sequence_samples = settings.sequence_samples;
+    std::atomic_ref(header.magic).store(magic, std::memory_order_release);
+    return;
+  }
+  if (std::atomic_ref(header.magic).load(std::memory_order_acquire) !=
+          magic ||
+      header.width != settings.width || header.height != settings.height ||
+      header.sampler != static_cast<std::uint32_t>(settings.sampler)) {
+    munmap(_mapping, _size);
+    close(_file);
+    throw std::runtime_error("Checkpoint of another render: " + filename);
+  }
+  // A render killed inside store_pixel leaves that pixel's count negative
+  // and its sum possibly torn. Its samples are traced again from the
+  // first, which sums them to the same result.
+  auto *sums = pixels();
+  const auto pixel_count =
+      static_cast<std::size_t>(header.width) * header.height;
+  for (std::size_t i = 0; i < pixel_count; i++)
+    if (sums[i].w < 0)
+      sums[i] = glm::vec4(0);
+}
+
+Checkpoint::Checkpoint(const std::string &filename) : _filename(filename) {
+  _file = open(filename.c_str(), O_RDONLY);
+  if (_file < 0)
+    throw std::runtime_error("Failed to open: " + filename);
+
+  struct stat status = {};
+  if (fstat(_file, &status) != 0 ||
+      static_cast<std::size_t>(status.st_size) < sizeof(Header)) {
+    close(_file);
+    throw std::runtime_error("Not a checkpoint: " + filename);
+  }
+  _size = static_cast<std::size_t>(status.st_size);
+  _map(PROT_READ);
+
+  auto &header = _header();
+  if (std::atomic_ref(header.magic).load(std::memory_order_acquire) !=
+          magic ||
+      file_size(header.width, header.height, sizeof(Header)) != _size) {
+    munmap(_mapping, _size);
+    close(_file);
+    throw std::runtime_error("Not a checkpoint: " + _filename);
+  }
+}
+
+Checkpoint::~Checkpoint() {
+  munmap(_mapping, _size);
+  close(_file);
+}
+
+void Checkpoint::_map(int protection) {
+  _mapping = mmap(nullptr, _size, protection, MAP_SHARED, _file, 0);
+  if (_mapping == MAP_FAILED) {
+    close(_file);
+    throw std::runtime_error("Failed to map: " + _filename);
+  }
+}
+
+Checkpoint::Header &Checkpoint::_header() const {
+  return *static_cast<Header *>(_mapping);
+}
+
+CheckpointSettings Checkpoint::settings() const {
+  const auto &header = _header();
+  return {.width = header.width,
+          .height = header.height,
+          .sampler = static_cast<SamplerKind>(header.sampler),
+          .sequence_samples = header.sequence_samples};
+}
+
+glm::vec4 &Checkpoint::_pixel(std::size_t index) const {
+  return reinterpret_cast<glm::vec4 *>(static_cast<char *>(_mapping) +
+                                       sizeof(Header))[index];
+}
+
+glm::vec4 *Checkpoint::pixels() { return &_pixel(0); }
+
+// The count is negated first, and the fence keeps the sum from being
+// written before it, so a reader that saw the old count before reading the
+// sum sees a different one after it.
+void Checkpoint::store_pixel(std::size_t index, const glm::vec3 &sum,
+                             std::uint32_t samples) {
+  auto &pixel = _pixel(index);
+  std::atomic_ref count(pixel.w);
+  count.store(-static_cast<float>(samples), std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (int channel = 0; channel < 3; channel++)
+    std::atomic_ref(pixel[channel])
+        .store(sum[channel], std::memory_order_relaxed);
+  count.store(static_cast<float>(samples), std::memory_order_release);
+}
+
+glm::vec4 Checkpoint::load_pixel(std::size_t index) const {
+  auto &pixel = _pixel(index);
+  std::atomic_ref count(pixel.w);
+  for (;;) {
+    const auto before = count.load(std::memory_order_acquire);
+    glm::vec4 copy;
+    for (int channel = 0; channel < 3; channel++)
+      copy[channel] =
+          std::atomic_ref(pixel[channel]).load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    copy.w = count.load(std::memory_order_relaxed);
+    if (before >= 0 && copy.w == before)
+      return copy;
+  }
+}
+
+std::uint32_t Checkpoint::samples() const {
+  return std::atomic_ref(_header().samples).load(std::memory_order_acquire);
+}
+
+std::uint32_t Checkpoint::generation() const {
+  return std::atomic_ref(_header().generation)
+      .load(std::memory_order_acquire);
+}
+
+// The samples are stored before the generation moves on, so a reader that
+// sees the new generation also sees them.
+void Checkpoint::publish(std::uint32_t samples) {
+  auto &header = _header();
+  std::atomic_ref(header.samples).store(samples, std::memory_order_release);
+  std::atomic_ref(header.generation)
+      .fetch_add(1, std::memory_order_release);
+}
+
+void Checkpoint::flush() {
+  if (msync(_mapping, _size, MS_SYNC) != 0)
+    throw std::runtime_error("Failed to write: " + _filename);
+}
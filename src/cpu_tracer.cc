@@ -1,16 +1,247 @@
+#include "bvh.hh"
 #include "camera.hh"
+#include "checkpoint.hh"
+#include "denoiser.hh"
 #include "disk.hh"
+#include "environment.hh"
 #include "hittable_list.hh"
+#include "image_io.hh"
 #include "material.hh"
+#include "path_guide.hh"
 #include "portal_material.hh"
+#include "sampler.hh"
 #include "sphere.hh"
+#include "thread_pool.hh"
+#include "time_budget.hh"
 #include "utils.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
 #include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include <glm/ext/scalar_constants.hpp>
 #include <glm/glm.hpp>
 
-int main() {
+namespace {
+// The features of every pixel, summed over samples samples, as images.
+FeatureImages average_features(const std::vector<PixelFeatures> &sums,
+                               std::uint32_t width, std::uint32_t height,
+                               std::uint32_t samples) {
+  const Image image = {.width = width,
+                       .height = height,
+                       .pixels = std::vector<glm::vec3>(sums.size())};
+  FeatureImages features = {.albedo = image,
+                            .normal = image,
+                            .depth = std::vector<float>(sums.size())};
+  const auto scale = 1 / static_cast<float>(samples);
+  for (std::size_t i = 0; i < sums.size(); i++) {
+    features.albedo.pixels[i] = sums[i].albedo * scale;
+    features.normal.pixels[i] = sums[i].normal * scale;
+    features.depth[i] = sums[i].depth * scale;
+  }
+  return features;
+}
+
+// Writes stem.ppm, and also stem.raw.ppm before denoising or the feature
+// maps if asked to.
+void write_outputs(const std::string &stem, const Image &color,
+                   const FeatureImages &features, bool denoise,
+                   bool write_features,
+                   const std::vector<std::string> &metadata,
+                   ThreadPool &pool) {
+  if (denoise) {
+    write_ppm(stem + ".raw.ppm", color, metadata);
+    write_ppm(stem + ".ppm", Denoiser(pool).denoise(color, features),
+              metadata);
+  } else {
+    write_ppm(stem + ".ppm", color, metadata);
+  }
+  if (write_features) {
+    Image depth = {.width = color.width, .height = color.height, .pixels = {}};
+    for (const auto distance : features.depth)
+      depth.pixels.emplace_back(distance);
+    write_pfm(stem + ".albedo.pfm", features.albedo);
+    write_pfm(stem + ".normal.pfm", features.normal);
+    write_pfm(stem + ".depth.pfm", depth);
+  }
+}
+
+// Seconds that write_outputs takes for an image of width by height, from
+// running it on a black strip of a few rows in a scratch directory.
+double output_seconds(std::uint32_t width, std::uint32_t height, bool denoise,
+                      bool write_features, ThreadPool &pool) {
+  const auto rows = std::min(height, 32u);
+  const auto pixel_count = static_cast<std::size_t>(width) * rows;
+  const Image strip = {.width = width,
+                       .height = rows,
+                       .pixels = std::vector<glm::vec3>(pixel_count)};
+  const FeatureImages features = {.albedo = strip,
+                                  .normal = strip,
+                                  .depth = std::vector<float>(pixel_count)};
+  const auto directory = make_scratch_directory();
+  const auto begin = std::chrono::steady_clock::now();
+  write_outputs((directory / "strip").string(), strip, features, denoise,
+                write_features, {}, pool);
+  const auto seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - begin)
+                           .count();
+  std::filesystem::remove_all(directory);
+  return seconds * height / rows;
+}
+
+// count views around the vertical axis through config.center, the first of
+// them config itself, like the pan angle of gpu_tracer.
+std::vector<CameraConfig> orbit_views(const CameraConfig &config, int count) {
+  std::vector<CameraConfig> views;
+  const auto offset = config.eye - config.center;
+  for (int view = 0; view < count; view++) {
+    const auto angle = 2 * glm::pi<float>() * static_cast<float>(view) /
+                       static_cast<float>(count);
+    auto view_config = config;
+    view_config.eye =
+        config.center +
+        glm::vec3(offset.x * std::cos(angle) - offset.z * std::sin(angle),
+                  offset.y,
+                  offset.x * std::sin(angle) + offset.z * std::cos(angle));
+    views.push_back(view_config);
+  }
+  return views;
+}
+
+// One view per line: the eye, the center and optionally the vertical field
+// of view, the defocus angle and the focus distance, separated by spaces.
+// What a line leaves out is taken from config. Empty lines and lines that
+// start with # are skipped.
+std::vector<CameraConfig> read_camera_list(const std::string &filename,
+                                           const CameraConfig &config) {
+  std::ifstream in(filename);
+  if (!in.is_open())
+    throw std::runtime_error("Failed to open: " + filename);
+  std::vector<CameraConfig> views;
+  std::string line;
+  for (int number = 1; std::getline(in, line); number++) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream fields(line);
+    auto view = config;
+    fields >> view.eye.x >> view.eye.y >> view.eye.z >> view.center.x >>
+        view.center.y >> view.center.z;
+    if (!fields)
+      throw std::runtime_error("Bad camera on line " + std::to_string(number) +
+                               " of " + filename);
+    if (fields >> view.vfov)
+      fields >> view.defocus_angle >> view.focus_dist;
+    views.push_back(view);
+  }
+  return views;
+}
+
+// stem.0000, stem.0001, ...
+std::string numbered_stem(const std::string &stem, std::size_t number) {
+  std::ostringstream numbered;
+  numbered << stem << "." << std::setw(4) << std::setfill('0') << number;
+  return numbered.str();
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string output_stem = "out";
+  int samples = 500;
+  std::size_t threads = std::thread::hardware_concurrency();
+  bool denoise = false, write_features = false, guide = false;
+  auto sampler = SamplerKind::INDEPENDENT;
+  std::string environment_file, checkpoint_file, live_file;
+  double checkpoint_interval = 60, time_budget = 0;
+  int orbit = 0;
+  std::string camera_file;
+  for (int arg = 1; arg < argc; arg++) {
+    const std::string option = argv[arg];
+    if (option == "--output" && arg + 1 < argc)
+      output_stem = argv[++arg];
+    else if (option == "--samples" && arg + 1 < argc)
+      samples = std::stoi(argv[++arg]);
+    else if (option == "--threads" && arg + 1 < argc)
+      threads = std::stoul(argv[++arg]);
+    else if (option == "--denoise")
+      denoise = true;
+    else if (option == "--features")
+      write_features = true;
+    else if (option == "--sampler" && arg + 1 < argc)
+      sampler = sampler_kind_from_name(argv[++arg]);
+    else if (option == "--environment" && arg + 1 < argc)
+      environment_file = argv[++arg];
+    else if (option == "--guide")
+      guide = true;
+    else if (option == "--checkpoint" && arg + 1 < argc)
+      checkpoint_file = argv[++arg];
+    else if (option == "--checkpoint-interval" && arg + 1 < argc)
+      checkpoint_interval = std::stod(argv[++arg]);
+    else if (option == "--live" && arg + 1 < argc)
+      live_file = argv[++arg];
+    else if (option == "--time-budget" && arg + 1 < argc)
+      time_budget = std::stod(argv[++arg]);
+    else if (option == "--orbit" && arg + 1 < argc)
+      orbit = std::stoi(argv[++arg]);
+    else if (option == "--cameras" && arg + 1 < argc)
+      camera_file = argv[++arg];
+    else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--output <stem>] [--samples <n>] [--threads <n>]"
+                   " [--denoise] [--features]"
+                   " [--sampler <independent|stratified|sobol|blue-noise>]"
+                   " [--environment <file.pfm|file.hdr>] [--guide]"
+                   " [--checkpoint <file>] [--checkpoint-interval <s>]"
+                   " [--live <file>] [--time-budget <s>]"
+                   " [--orbit <views> | --cameras <file>]"
+                << std::endl;
+      return 1;
+    }
+  }
+  // What the guide learned is not kept, and depends on the order in which
+  // the threads record into it.
+  if (guide && !(checkpoint_file.empty() && live_file.empty())) {
+    std::cerr << "--guide cannot be combined with --checkpoint or --live"
+              << std::endl;
+    return 1;
+  }
+  // A checkpoint can be watched like a live file already.
+  if (!checkpoint_file.empty() && !live_file.empty()) {
+    std::cerr << "--checkpoint and --live cannot be combined" << std::endl;
+    return 1;
+  }
+  if (time_budget > 0 && !(checkpoint_file.empty() && live_file.empty())) {
+    std::cerr << "--time-budget cannot be combined with --checkpoint or --live"
+              << std::endl;
+    return 1;
+  }
+  const auto batch = orbit > 0 || !camera_file.empty();
+  if (batch && (guide || time_budget > 0 || !checkpoint_file.empty() ||
+                !live_file.empty())) {
+    std::cerr << "--orbit and --cameras cannot be combined with --guide,"
+                 " --time-budget, --checkpoint or --live"
+              << std::endl;
+    return 1;
+  }
+  // The deadline includes building the scene.
+  std::optional<TimeBudget> budget;
+  if (time_budget > 0)
+    budget.emplace(time_budget);
+
   HittableList world;
 
   auto ground_material = std::make_shared<Lambertian>(glm::vec3(0.5, 0.5, 0.5));
@@ -73,20 +304,257 @@ int main() {
                                                    1.0f, source_material));
   world.hittables.push_back(std::make_shared<Disk>(
       destination_center, destination_normal, 1.0f, destination_material));
+  const auto lights = world.lights();
+  // Built once, and shared by every view of a batch.
+  const Bvh bvh(world);
 
   const CameraConfig config = {
       .aspect_ratio = 16.0f / 9.0f,
       .image_width = 400,
-      .samples_per_pixel = 500,
+      .samples_per_pixel = samples,
       .max_depth = 50,
+      .max_portal_hops = 16,
       .vfov = 20,
       .eye = {9, 2, 8},
       .center = {0, 0, 0},
       .up = {0, 1, 0},
       .defocus_angle = 0.6f,
       .focus_dist = 10.0f,
+      .bsdf_sampling_only = false,
+      .sampler = sampler,
   };
-  Camera cam(config);
+  std::shared_ptr<const Environment> environment;
+  if (!environment_file.empty())
+    environment = std::make_shared<const Environment>(
+        Environment::load(environment_file));
+  // Around the spheres and portals, the ground outside shares the leaves at
+  // the border.
+  std::shared_ptr<PathGuide> path_guide;
+  if (guide)
+    path_guide = std::make_shared<PathGuide>(glm::vec3(-12, -1, -12),
+                                             glm::vec3(12, 4, 12));
+  const auto width = static_cast<std::uint32_t>(config.image_width),
+             height = static_cast<std::uint32_t>(width / config.aspect_ratio);
+
+  Image color = {.width = width, .height = height, .pixels = {}};
+  color.pixels.resize(static_cast<std::size_t>(width) * height);
+
+  ThreadPool pool(threads);
+  std::atomic<std::uint64_t> portal_traversals = 0;
+  // The first hits of the samples are summed while the colors are traced.
+  const auto collect_features = denoise || write_features;
+  const PixelFeatures no_features = {
+      .albedo = {0, 0, 0}, .normal = {0, 0, 0}, .depth = 0};
+  const auto begin = std::chrono::steady_clock::now();
+
+  if (batch) {
+    const auto views = orbit > 0 ? orbit_views(config, orbit)
+                                 : read_camera_list(camera_file, config);
+    std::vector<Camera> cameras;
+    for (const auto &view : views) {
+      cameras.emplace_back(view);
+      cameras.back().set_environment(environment);
+    }
+    std::vector<Image> colors(views.size(), color);
+    std::vector<std::vector<PixelFeatures>> features(
+        views.size(),
+        std::vector<PixelFeatures>(collect_features ? color.pixels.size() : 0,
+                                   no_features));
+    // The rows of all views are handed out together, so the threads only
+    // run out of work at the end of the batch instead of every view.
+    pool.parallel_for(views.size() * height, [&](std::size_t row) {
+      const auto view = row / height, y = row % height;
+      TraceCounters counters = {.rays = 0, .portal_traversals = 0};
+      for (std::uint32_t x = 0; x < width; x++) {
+        const auto i = y * width + x;
+        auto sum = glm::vec3(0, 0, 0);
+        cameras[view].accumulate_pixel(
+            static_cast<int>(y), static_cast<int>(x), bvh, lights, counters,
+            0, static_cast<std::uint32_t>(samples), sum,
+            collect_features ? &features[view][i] : nullptr);
+        colors[view].pixels[i] = sum / static_cast<float>(samples);
+      }
+      portal_traversals += counters.portal_traversals;
+    });
+    const auto rendered = std::chrono::steady_clock::now();
+
+    for (std::size_t view = 0; view < views.size(); view++)
+      write_outputs(numbered_stem(output_stem, view), colors[view],
+                    average_features(features[view], width, height,
+                                     static_cast<std::uint32_t>(samples)),
+                    denoise, write_features, {}, pool);
+    std::clog << "Rendered " << views.size() << " views in "
+              << std::chrono::duration<float>(rendered - begin).count()
+              << " s, " << portal_traversals << " portal traversals"
+              << std::endl;
+    return 0;
+  }
+
+  auto traced = static_cast<std::uint32_t>(samples);
+  // Written into the header of the PPM output.
+  std::vector<std::string> metadata;
+  std::vector<PixelFeatures> feature_sums(
+      collect_features ? color.pixels.size() : 0, no_features);
+  FeatureImages features;
+  // A live file is a checkpoint that starts over and is not flushed.
+  if (!live_file.empty())
+    std::remove(live_file.c_str());
+  const auto &mapped_file = live_file.empty() ? checkpoint_file : live_file;
+  if (!mapped_file.empty()) {
+    Checkpoint checkpoint(mapped_file,
+                          {.width = width,
+                           .height = height,
+                           .sampler = sampler,
+                           .sequence_samples =
+                               static_cast<std::uint32_t>(samples)});
+    // The sequences of these samplers depend on the samples per pixel, so
+    // more samples than the render started with would repeat them.
+    const auto sequence_samples = checkpoint.settings().sequence_samples;
+    if ((sampler == SamplerKind::STRATIFIED ||
+         sampler == SamplerKind::BLUE_NOISE) &&
+        static_cast<std::uint32_t>(samples) != sequence_samples)
+      throw std::runtime_error("Checkpoint was rendered with " +
+                               std::to_string(sequence_samples) +
+                               " samples per pixel");
+    auto checkpoint_config = config;
+    checkpoint_config.samples_per_pixel = static_cast<int>(sequence_samples);
+    Camera cam(checkpoint_config);
+    cam.set_environment(environment);
+
+    // Every round adds a sample to each pixel that lacks some and is
+    // published to watchers, and the checkpoint is flushed after the round
+    // that ends an interval.
+    auto *sums = checkpoint.pixels();
+    auto completed = static_cast<std::uint32_t>(samples);
+    for (std::size_t i = 0; i < color.pixels.size(); i++)
+      completed = std::min(completed, static_cast<std::uint32_t>(sums[i].w));
+    checkpoint.publish(completed);
+    auto flushed = begin;
+    // Samples whose features this run added up.
+    std::vector<std::uint32_t> feature_samples(feature_sums.size(), 0);
+    for (auto added = true; added;) {
+      std::atomic<bool> round_added = false;
+      pool.parallel_for(height, [&](std::size_t y) {
+        TraceCounters counters = {.rays = 0, .portal_traversals = 0};
+        for (std::uint32_t x = 0; x < width; x++) {
+          const auto i = y * width + x;
+          const auto &pixel = sums[i];
+          const auto pixel_samples = static_cast<std::uint32_t>(pixel.w);
+          if (pixel_samples >= static_cast<std::uint32_t>(samples))
+            continue;
+          glm::vec3 sum(pixel);
+          cam.accumulate_pixel(static_cast<int>(y), static_cast<int>(x),
+                               bvh, lights, counters,
+                               pixel_samples, 1, sum,
+                               collect_features ? &feature_sums[i] : nullptr);
+          if (collect_features)
+            feature_samples[i]++;
+          checkpoint.store_pixel(i, sum, pixel_samples + 1);
+          round_added.store(true, std::memory_order_relaxed);
+        }
+        portal_traversals += counters.portal_traversals;
+      });
+      added = round_added;
+      if (added)
+        checkpoint.publish(++completed);
+      const auto now = std::chrono::steady_clock::now();
+      if (live_file.empty() &&
+          (!added || std::chrono::duration<double>(now - flushed).count() >=
+                         checkpoint_interval)) {
+        checkpoint.flush();
+        flushed = now;
+      }
+    }
+    for (std::size_t i = 0; i < color.pixels.size(); i++)
+      color.pixels[i] = glm::vec3(sums[i]) / sums[i].w;
+    // The features are of the samples this run added, and of primary rays
+    // of their own where it added none.
+    if (collect_features)
+      pool.parallel_for(height, [&](std::size_t y) {
+        for (std::uint32_t x = 0; x < width; x++) {
+          const auto i = y * width + x;
+          const auto count = static_cast<float>(feature_samples[i]);
+          feature_sums[i] =
+              feature_samples[i] == 0
+                  ? cam.trace_features(static_cast<int>(y),
+                                       static_cast<int>(x), bvh)
+                  : PixelFeatures{.albedo = feature_sums[i].albedo / count,
+                                  .normal = feature_sums[i].normal / count,
+                                  .depth = feature_sums[i].depth / count};
+        }
+      });
+    if (collect_features)
+      features = average_features(feature_sums, width, height, 1);
+  } else {
+    // Without guiding or a time budget every sample is traced in one pass.
+    // The guide learns from passes of 1, 2, 4, ... samples, each of which
+    // samples what the passes before it have learned, and a time budget
+    // traces passes of such sizes for as long as they fit.
+    Camera cam(config);
+    cam.set_environment(environment);
+    cam.set_path_guide(path_guide);
+    std::optional<PassVariance> variance;
+    if (budget) {
+      variance.emplace(color.pixels.size());
+      budget->set_reserve(
+          output_seconds(width, height, denoise, write_features, pool));
+    }
+    traced = 0;
+    for (auto pass_samples = static_cast<std::uint32_t>(guide ? 1 : samples);
+         traced < static_cast<std::uint32_t>(samples); pass_samples *= 2) {
+      auto pass = std::min(pass_samples,
+                           static_cast<std::uint32_t>(samples) - traced);
+      if (budget && (pass = budget->next_pass(pass)) == 0)
+        break;
+      pool.parallel_for(height, [&](std::size_t y) {
+        TraceCounters counters = {.rays = 0, .portal_traversals = 0};
+        for (std::uint32_t x = 0; x < width; x++) {
+          const auto i = y * width + x;
+          auto pass_sum = glm::vec3(0, 0, 0);
+          cam.accumulate_pixel(static_cast<int>(y), static_cast<int>(x),
+                               bvh, lights, counters, traced, pass,
+                               pass_sum,
+                               collect_features ? &feature_sums[i] : nullptr);
+          color.pixels[i] += pass_sum;
+          if (variance)
+            variance->add(i, pass_sum, pass);
+        }
+        portal_traversals += counters.portal_traversals;
+      });
+      traced += pass;
+      if (path_guide)
+        path_guide->update();
+      if (budget)
+        budget->finish_pass();
+    }
+    for (auto &pixel : color.pixels)
+      pixel /= static_cast<float>(traced);
+    if (collect_features)
+      features = average_features(feature_sums, width, height, traced);
+    if (budget) {
+      std::ostringstream seconds, noise;
+      seconds << budget->elapsed_seconds();
+      noise << variance->rms_error();
+      metadata = {"samples_per_pixel " + std::to_string(traced),
+                  "elapsed_seconds " + seconds.str(),
+                  "estimated_rms_error " + noise.str()};
+    }
+  }
+
+  const auto rendered = std::chrono::steady_clock::now();
+  write_outputs(output_stem, color, features, denoise, write_features,
+                metadata, pool);
 
-  cam.render_to_file("out.ppm", world);
+  std::clog << "Rendered in "
+            << std::chrono::duration<float>(rendered - begin).count()
+            << " s, " << portal_traversals << " portal traversals";
+  for (const auto &line : metadata)
+    std::clog << ", " << line;
+  if (denoise)
+    std::clog << ", denoised in "
+              << std::chrono::duration<float>(
+                     std::chrono::steady_clock::now() - rendered)
+                     .count()
+              << " s";
+  std::clog << std::endl;
 }
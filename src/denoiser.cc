@@ -0,0 +1,170 @@
+#include "denoiser.hh"
+
+#include "image_io.hh"
+#include "thread_pool.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace {
+constexpr float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4,
+                             1.0f / 16};
+// Keeps black surfaces from dividing by zero when removing the albedo.
+constexpr float albedo_epsilon = 1e-3f;
+
+// e^x for x <= 0, to a relative error of about 3e-5, in operations the
+// compiler can vectorize, which std::exp is not. Splits x log2(e) into an
+// integer part i, which becomes the exponent bits, and a fraction f in
+// (-1, 0] for a polynomial of 2^f. x is clamped to -87, where e^x is about
+// the smallest normal float, by its bits, which grow with -x: clamping the
+// float takes a branch that keeps the loop from vectorizing.
+float exp_nonpositive(float x) {
+  constexpr auto lowest = std::bit_cast<std::uint32_t>(-87.0f);
+  const float t =
+      std::bit_cast<float>(std::min(std::bit_cast<std::uint32_t>(x), lowest)) *
+      1.44269504f;
+  const int i = static_cast<int>(t);
+  const float f = (t - static_cast<float>(i)) * 0.693147181f;
+  const float fraction =
+      1 + f * (1 + f * (0.5f + f * (1.0f / 6 +
+                                    f * (1.0f / 24 +
+                                         f * (1.0f / 120 + f / 720)))));
+  return fraction * std::bit_cast<float>((i + 127) << 23);
+}
+
+// Adds scale times the squared difference of p[x] and q[x] to distance[x].
+// One plane at a time, since the compiler vectorizes loops over only a few
+// arrays.
+void add_distance(const float *p, const float *q, float scale, int begin,
+                  int end, float *distance) {
+  for (int x = begin; x < end; x++) {
+    const float difference = p[x] - q[x];
+    distance[x] += difference * difference * scale;
+  }
+}
+} // namespace
+
+Denoiser::Denoiser(ThreadPool &pool, const DenoiserSettings &settings)
+    : _pool(pool), _settings(settings) {}
+
+void Denoiser::_filter_row(std::uint32_t y, int step, float color_sigma) {
+  const auto width = static_cast<int>(_width),
+             height = static_cast<int>(_height);
+  const auto row = static_cast<std::size_t>(y) * _width;
+  const float *color[3] = {_color[0].data(), _color[1].data(),
+                           _color[2].data()};
+  const float *normal[3] = {_normal[0].data(), _normal[1].data(),
+                            _normal[2].data()};
+  const float *depth = _depth.data();
+  float *sum[3] = {&_filtered[0][row], &_filtered[1][row],
+                   &_filtered[2][row]};
+  float *weight_sum = &_weight_sum[row], *weights = &_tap_weights[row];
+  const float color_scale = 1 / (color_sigma * color_sigma),
+              normal_scale =
+                  1 / (_settings.normal_sigma * _settings.normal_sigma),
+              depth_scale = 1 / _settings.depth_sigma;
+
+  std::fill_n(weight_sum, _width, 0.0f);
+  for (auto &channel : sum)
+    std::fill_n(channel, _width, 0.0f);
+
+  for (int ky = -2; ky <= 2; ky++) {
+    const int qy = static_cast<int>(y) + ky * step;
+    if (qy < 0 || qy >= height)
+      continue;
+    const auto q_row = static_cast<std::size_t>(qy) * _width;
+    for (int kx = -2; kx <= 2; kx++) {
+      // Taps outside the image are skipped, the normalization makes up for
+      // them, so the loop below runs over a contiguous range.
+      const int offset = kx * step;
+      const int begin = std::max(0, -offset),
+                end = std::min(width, width - offset);
+      const float tap_weight = kernel[ky + 2] * kernel[kx + 2];
+      // The weights first and then the sums, with the color and normal
+      // distances in weights until the weights replace them.
+      std::fill(weights + begin, weights + end, 0.0f);
+      for (int channel = 0; channel < 3; channel++) {
+        add_distance(color[channel] + row, color[channel] + q_row + offset,
+                     color_scale, begin, end, weights);
+        add_distance(normal[channel] + row, normal[channel] + q_row + offset,
+                     normal_scale, begin, end, weights);
+      }
+      const float *depth_p = depth + row, *depth_q = depth + q_row + offset;
+      for (int x = begin; x < end; x++) {
+        const float depth_distance =
+            std::abs(depth_p[x] - depth_q[x]) /
+            std::max(std::max(depth_p[x], depth_q[x]), 1e-6f);
+        weights[x] = tap_weight * exp_nonpositive(-weights[x] -
+                                                  depth_distance * depth_scale);
+      }
+      const float *color_q[3] = {color[0] + q_row + offset,
+                                 color[1] + q_row + offset,
+                                 color[2] + q_row + offset};
+      for (int channel = 0; channel < 3; channel++)
+        for (int x = begin; x < end; x++)
+          sum[channel][x] += weights[x] * color_q[channel][x];
+      for (int x = begin; x < end; x++)
+        weight_sum[x] += weights[x];
+    }
+  }
+
+  // The center tap always has a positive weight.
+  for (std::uint32_t x = 0; x < _width; x++)
+    for (auto &channel : sum)
+      channel[x] /= weight_sum[x];
+}
+
+Image Denoiser::denoise(const Image &color, const FeatureImages &features) {
+  const auto pixel_count = color.pixels.size();
+  if (features.albedo.pixels.size() != pixel_count ||
+      features.normal.pixels.size() != pixel_count ||
+      features.depth.size() != pixel_count)
+    throw std::runtime_error("Feature images do not match the color image");
+
+  _width = color.width;
+  _height = color.height;
+  for (int channel = 0; channel < 3; channel++) {
+    _color[channel].resize(pixel_count);
+    _filtered[channel].resize(pixel_count);
+    _normal[channel].resize(pixel_count);
+  }
+  _weight_sum.resize(pixel_count);
+  _tap_weights.resize(pixel_count);
+  _depth = features.depth;
+  for (std::size_t i = 0; i < pixel_count; i++)
+    for (int channel = 0; channel < 3; channel++) {
+      _color[channel][i] =
+          color.pixels[i][channel] /
+          (features.albedo.pixels[i][channel] + albedo_epsilon);
+      _normal[channel][i] = features.normal.pixels[i][channel];
+    }
+
+  for (std::uint32_t iteration = 0; iteration < _settings.iterations;
+       iteration++) {
+    // Later iterations average over more pixels that are already smooth, so
+    // they tolerate less color difference.
+    const auto color_sigma =
+        std::ldexp(_settings.color_sigma, -static_cast<int>(iteration));
+    _pool.parallel_for(_height, [&](std::size_t y) {
+      _filter_row(static_cast<std::uint32_t>(y), 1 << iteration, color_sigma);
+    });
+    std::swap(_color, _filtered);
+  }
+
+  Image denoised = {.width = _width, .height = _height, .pixels = {}};
+  denoised.pixels.resize(pixel_count);
+  for (std::size_t i = 0; i < pixel_count; i++)
+    for (int channel = 0; channel < 3; channel++)
+      denoised.pixels[i][channel] =
+          _color[channel][i] *
+          (features.albedo.pixels[i][channel] + albedo_epsilon);
+  return denoised;
+}
@@ -1,12 +1,17 @@
 #include "disk.hh"
 
+#include "aabb.hh"
 #include "hittable.hh"
+#include "interval.hh"
 #include "material.hh"
+#include "ray.hh"
+#include "utils.hh"
 
 #include <cmath>
 #include <memory>
 #include <optional>
 
+#include <glm/ext/scalar_constants.hpp>
 #include <glm/glm.hpp>
 
 Disk::Disk(const glm::vec3 &center, const glm::vec3 &normal, float radius,
@@ -30,3 +35,31 @@ std::optional<HitRecord> Disk::hit(const Ray &ray, Interval ray_t) const {
 
   return HitRecord(ray, normal, root, material);
 }
+
+// Points are drawn uniformly from the area of the disk.
+float Disk::pdf_value(const glm::vec3 &origin,
+                      const glm::vec3 &direction) const {
+  const auto record = hit(Ray(origin, direction), Interval(0.001f, INFINITY));
+  if (!record.has_value())
+    return 0;
+
+  const auto distance_squared =
+                 record->t * record->t * glm::dot(direction, direction),
+             cosine = std::fabs(glm::dot(normal, direction)) /
+                      glm::length(direction);
+  return distance_squared / (cosine * glm::pi<float>() * radius * radius);
+}
+
+glm::vec3 Disk::random(const glm::vec3 &origin, const glm::vec2 &u) const {
+  const auto p = in_unit_disk(u) * radius;
+  const auto [tangent, bitangent] = orthonormal_basis(glm::normalize(normal));
+  return center + p.x * tangent + p.y * bitangent - origin;
+}
+
+bool Disk::is_emissive() const { return material->is_emissive(); }
+
+// hit accepts points within radius of the center, and rays that leave the
+// plane get the mirror image of their root, off the plane, like on the GPU.
+Aabb Disk::bounding_box() const {
+  return {center - glm::vec3(radius), center + glm::vec3(radius)};
+}
@@ -0,0 +1,171 @@
+#include "environment.hh"
+
+#include "image_io.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/glm.hpp>
+
+namespace {
+float luminance(const glm::vec3 &color) {
+  return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+bool has_extension(const std::string &filename, const std::string &extension) {
+  return filename.size() >= extension.size() &&
+         filename.compare(filename.size() - extension.size(),
+                          extension.size(), extension) == 0;
+}
+} // namespace
+
+Environment::Environment(const Image &image)
+    : _width(image.width), _height(image.height) {
+  if (_width == 0 || _height == 0)
+    throw std::runtime_error("Empty environment map");
+
+  const auto tiles_x = (_width + TILE_SIZE - 1) / TILE_SIZE,
+             tiles_y = (_height + TILE_SIZE - 1) / TILE_SIZE;
+  _texels.assign(static_cast<std::size_t>(tiles_x) * tiles_y * TILE_SIZE *
+                     TILE_SIZE,
+                 {.color = {0, 0, 0}, .pdf = 0, .probability = 0, .alias = 0});
+  for (std::uint32_t y = 0; y < _height; y++)
+    for (std::uint32_t x = 0; x < _width; x++)
+      _texels[_index(x, y)].color =
+          image.pixels[static_cast<std::size_t>(y) * _width + x];
+  _build_alias_table();
+}
+
+Environment Environment::load(const std::string &filename) {
+  if (has_extension(filename, ".pfm"))
+    return Environment(read_pfm(filename));
+  if (has_extension(filename, ".hdr"))
+    return Environment(read_hdr(filename));
+  throw std::runtime_error("Unknown environment map format: " + filename);
+}
+
+std::size_t Environment::_index(std::uint32_t x, std::uint32_t y) const {
+  const auto tiles_x = (_width + TILE_SIZE - 1) / TILE_SIZE;
+  const auto tile = static_cast<std::size_t>(y / TILE_SIZE) * tiles_x +
+                    x / TILE_SIZE;
+  return tile * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE +
+         x % TILE_SIZE;
+}
+
+// Texels are weighted by their luminance and by the solid angle they cover,
+// which shrinks with sin(theta) towards the poles.
+void Environment::_build_alias_table() {
+  std::vector<double> weights(_texels.size(), 0.0);
+  double total = 0;
+  for (std::uint32_t y = 0; y < _height; y++) {
+    const auto sin_theta = std::sin(glm::pi<double>() * (y + 0.5) / _height);
+    for (std::uint32_t x = 0; x < _width; x++) {
+      const auto index = _index(x, y);
+      weights[index] =
+          std::max(luminance(_texels[index].color), 0.0f) * sin_theta;
+      total += weights[index];
+    }
+  }
+  // A black map is sampled uniformly.
+  if (total <= 0)
+    for (std::uint32_t y = 0; y < _height; y++)
+      for (std::uint32_t x = 0; x < _width; x++) {
+        weights[_index(x, y)] = 1;
+        total += 1;
+      }
+
+  // Every texel of the image covers 1 / (width * height) of the map, so its
+  // density over the map is its probability times that many texels.
+  const auto texel_count = static_cast<double>(_width) * _height;
+  std::vector<double> scaled(_texels.size());
+  std::vector<std::uint32_t> small, large;
+  for (std::size_t i = 0; i < _texels.size(); i++) {
+    _texels[i].pdf = static_cast<float>(weights[i] / total * texel_count);
+    scaled[i] = weights[i] / total * _texels.size();
+    (scaled[i] < 1 ? small : large).push_back(static_cast<std::uint32_t>(i));
+  }
+  // Texels of zero weight go first, so rounding cannot leave one over.
+  std::stable_partition(small.begin(), small.end(),
+                        [&](std::uint32_t i) { return weights[i] > 0; });
+  while (!small.empty() && !large.empty()) {
+    const auto less = small.back(), more = large.back();
+    small.pop_back();
+    large.pop_back();
+    _texels[less].probability = static_cast<float>(scaled[less]);
+    _texels[less].alias = more;
+    scaled[more] -= 1 - scaled[less];
+    (scaled[more] < 1 ? small : large).push_back(more);
+  }
+  // Whatever is left is 1 up to rounding.
+  for (const auto i : large)
+    _texels[i].probability = 1;
+  for (const auto i : small)
+    _texels[i].probability = 1;
+}
+
+std::uint32_t Environment::width() const { return _width; }
+
+std::uint32_t Environment::height() const { return _height; }
+
+const std::vector<gpu::EnvironmentTexel> &Environment::texels() const {
+  return _texels;
+}
+
+const gpu::EnvironmentTexel &
+Environment::_texel(const glm::vec3 &direction) const {
+  const auto unit_direction = glm::normalize(direction);
+  const auto theta = std::acos(std::clamp(unit_direction.y, -1.0f, 1.0f));
+  auto phi = std::atan2(unit_direction.z, unit_direction.x);
+  if (phi < 0)
+    phi += 2 * glm::pi<float>();
+  const auto x = std::min(static_cast<std::uint32_t>(
+                              phi / (2 * glm::pi<float>()) * _width),
+                          _width - 1),
+             y = std::min(
+                 static_cast<std::uint32_t>(theta / glm::pi<float>() * _height),
+                 _height - 1);
+  return _texels[_index(x, y)];
+}
+
+glm::vec3 Environment::radiance(const glm::vec3 &direction) const {
+  return _texel(direction).color;
+}
+
+float Environment::pdf(const glm::vec3 &direction) const {
+  // Unlike 1 - y^2, keeps its precision next to the poles.
+  const auto unit_direction = glm::normalize(direction);
+  const auto sin_theta = std::sqrt(unit_direction.x * unit_direction.x +
+                                   unit_direction.z * unit_direction.z);
+  if (sin_theta <= 0)
+    return 0;
+  return _texel(direction).pdf /
+         (2 * glm::pi<float>() * glm::pi<float>() * sin_theta);
+}
+
+glm::vec3 Environment::sample(const glm::vec2 &u,
+                              const glm::vec2 &jitter) const {
+  auto index = std::min(
+      static_cast<std::size_t>(u.x * static_cast<float>(_texels.size())),
+      _texels.size() - 1);
+  const auto &entry = _texels[index];
+  if (u.y >= entry.probability)
+    index = entry.alias;
+
+  const auto tile = index / (TILE_SIZE * TILE_SIZE),
+             within_tile = index % (TILE_SIZE * TILE_SIZE);
+  const auto tiles_x = (_width + TILE_SIZE - 1) / TILE_SIZE;
+  const auto x = (tile % tiles_x) * TILE_SIZE + within_tile % TILE_SIZE,
+             y = (tile / tiles_x) * TILE_SIZE + within_tile / TILE_SIZE;
+  const auto phi = 2 * glm::pi<float>() * (static_cast<float>(x) + jitter.x) /
+                   static_cast<float>(_width),
+             theta = glm::pi<float>() * (static_cast<float>(y) + jitter.y) /
+                     static_cast<float>(_height);
+  return {std::sin(theta) * std::cos(phi), std::cos(theta),
+          std::sin(theta) * std::sin(phi)};
+}
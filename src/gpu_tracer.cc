@@ -1,10 +1,21 @@
+#include "demo_scene.hh"
+#include "environment.hh"
+#include "image_io.hh"
+#include "sampler.hh"
 #include "scene.hh"
+#include "time_budget.hh"
 #include "utils.hh"
 #include "vulkan_engine.hh"
 
 #include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include <imgui.h>
@@ -16,145 +27,185 @@
 
 using namespace std::chrono_literals;
 
-int main() {
-  std::vector<gpu::Material> materials;
-  std::vector<gpu::Hittable> hittables;
-  hittables.push_back({
-      .kind = gpu::HittableKind::SPHERE,
-      .center = glm::vec3(0, -1000, 0),
-      .radius = 1000,
-      .material_index = static_cast<uint32_t>(materials.size()),
-  });
-  materials.push_back(
-      {.kind = gpu::MaterialKind::LAMBERTIAN, .color = {0.5f, 0.5f, 0.5f}});
-
-  for (int a = -11; a < 11; a++) {
-    for (int b = -11; b < 11; b++) {
-      const auto choose_mat = random_float();
-      const auto center =
-          glm::vec3(a + 0.9f * random_float(), 0.2f, b + 0.9f * random_float());
-      hittables.push_back({
-          .kind = gpu::HittableKind::SPHERE,
-          .center = center,
-          .radius = 0.2f,
-          .material_index = static_cast<uint32_t>(materials.size()),
-      });
-
-      if ((center - glm::vec3(4.0, 0.2, 0.0)).length() > 0.9f) {
-        gpu::Material sphere_material;
-
-        if (choose_mat < 0.8f) {
-          // diffuse
-          const auto albedo = random_vec() * random_vec();
-          sphere_material.kind = gpu::MaterialKind::LAMBERTIAN;
-          sphere_material.color = albedo;
-        } else if (choose_mat < 0.95f) {
-          // metal
-          const auto albedo = random_vec(0.5f, 1);
-          const auto fuzz = random_float(0, 0.5f);
-          sphere_material.kind = gpu::MaterialKind::METAL;
-          sphere_material.color = albedo;
-          sphere_material.parameter = fuzz;
-        } else {
-          // glass
-          sphere_material.kind = gpu::MaterialKind::DIELECTRIC;
-          sphere_material.parameter = 1.5;
-        }
-        materials.push_back(sphere_material);
-      }
+namespace {
+// Renders without a window in passes of render calls of one sample each,
+// reading the image back after every pass, until budget runs out or every
+// pixel has samples samples.
+void render_headless(Settings settings, const gpu::Scene &scene,
+                     const std::string &environment_file, TimeBudget &budget,
+                     std::uint32_t samples, const std::string &output_file) {
+  settings.samples_per_pass = 1;
+  settings.auto_tune_group_size = false;
+  settings.temporal_reprojection = false;
+  settings.preview_frame_ms = 0.0f;
+  settings.headless = true;
+  VulkanEngine engine(settings);
+  if (!environment_file.empty())
+    engine.set_environment(Environment::load(environment_file));
+
+  std::uint32_t render_call = 0;
+  const auto render = [&](std::uint32_t read_only, std::uint32_t clear) {
+    engine.render({.read_only = read_only,
+                   .clear = clear,
+                   .number = render_call++,
+                   .total_render_calls = samples,
+                   .total_samples = samples},
+                  scene);
+  };
+  render(1, 1);
+
+  const auto pixel_count =
+      static_cast<std::size_t>(settings.window_width) * settings.window_height;
+  std::vector<glm::vec4> sums(pixel_count, glm::vec4(0));
+  PassVariance variance(pixel_count);
+  // Writing a black strip of a few rows to a scratch directory tells how
+  // long writing the image takes.
+  const auto rows = std::min(settings.window_height, 32u);
+  const auto scratch = make_scratch_directory();
+  const auto write_begin = std::chrono::steady_clock::now();
+  write_ppm((scratch / "strip.ppm").string(),
+            {.width = settings.window_width,
+             .height = rows,
+             .pixels = std::vector<glm::vec3>(
+                 static_cast<std::size_t>(settings.window_width) * rows)});
+  const auto write_seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - write_begin)
+                                 .count();
+  std::filesystem::remove_all(scratch);
+  budget.set_reserve(write_seconds * settings.window_height / rows);
+  std::uint32_t traced = 0;
+  while (const auto pass = budget.next_pass(samples - traced)) {
+    for (std::uint32_t i = 0; i < pass; i++)
+      render(0, 0);
+    const auto pass_sums = engine.read_summed_image();
+    for (std::size_t i = 0; i < pixel_count; i++)
+      variance.add(i, glm::vec3(pass_sums[i] - sums[i]), pass);
+    sums = pass_sums;
+    traced += pass;
+    budget.finish_pass();
+  }
+
+  Image image = {.width = settings.window_width,
+                 .height = settings.window_height,
+                 .pixels = {}};
+  for (const auto &sum : sums)
+    image.pixels.push_back(sum.w > 0 ? glm::vec3(sum) / sum.w : glm::vec3(0));
+  std::ostringstream seconds, noise;
+  seconds << budget.elapsed_seconds();
+  noise << variance.rms_error();
+  const std::vector<std::string> metadata = {
+      "samples_per_pixel " + std::to_string(traced),
+      "elapsed_seconds " + seconds.str(),
+      "estimated_rms_error " + noise.str()};
+  write_ppm(output_file, image, metadata);
+  for (const auto &line : metadata)
+    std::cout << line << std::endl;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string profile_csv_file;
+  bool auto_tune_group_size = true;
+  auto sampler = SamplerKind::INDEPENDENT;
+  std::string environment_file, output_file = "gpu.ppm";
+  std::uint32_t samples = 100;
+  double time_budget = 0;
+  for (int arg = 1; arg < argc; arg++) {
+    const std::string option = argv[arg];
+    if (option == "--profile-csv" && arg + 1 < argc)
+      profile_csv_file = argv[++arg];
+    else if (option == "--no-auto-tune")
+      auto_tune_group_size = false;
+    else if (option == "--sampler" && arg + 1 < argc)
+      sampler = sampler_kind_from_name(argv[++arg]);
+    else if (option == "--environment" && arg + 1 < argc)
+      environment_file = argv[++arg];
+    else if (option == "--samples" && arg + 1 < argc)
+      samples = std::stoul(argv[++arg]);
+    else if (option == "--time-budget" && arg + 1 < argc)
+      time_budget = std::stod(argv[++arg]);
+    else if (option == "--output" && arg + 1 < argc)
+      output_file = argv[++arg];
+    else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--profile-csv <file>] [--no-auto-tune]"
+                   " [--sampler <independent|stratified|sobol|blue-noise>]"
+                   " [--environment <file.pfm|file.hdr>] [--samples <n>]"
+                   " [--time-budget <s> [--output <file>]]"
+                << std::endl;
+      return 1;
     }
   }
+  // The deadline includes creating the engine.
+  std::optional<TimeBudget> budget;
+  if (time_budget > 0)
+    budget.emplace(time_budget);
 
-  gpu::Material material1 = {
-      .kind = gpu::MaterialKind::DIELECTRIC,
-      .parameter = 1.5f,
-  };
-  hittables.push_back({
-      .kind = gpu::HittableKind::SPHERE,
-      .center = {0, 1, 0},
-      .radius = 1.0f,
-      .material_index = static_cast<uint32_t>(materials.size()),
-  });
-  materials.push_back(material1);
-
-  gpu::Material material2 = {
-      .kind = gpu::MaterialKind::LAMBERTIAN,
-      .color = glm::vec3(0.4, 0.2, 0.1),
-  };
-  hittables.push_back({
-      .kind = gpu::HittableKind::SPHERE,
-      .center = {-2.5, 1, 0},
-      .radius = 1.0f,
-      .material_index = static_cast<uint32_t>(materials.size()),
-  });
-  materials.push_back(material2);
-
-  gpu::Material material3 = {
-      .kind = gpu::MaterialKind::METAL,
-      .color = glm::vec3(0.7, 0.6, 0.5),
-      .parameter = 0.0f,
-  };
-  hittables.push_back({
-      .kind = gpu::HittableKind::SPHERE,
-      .center = glm::vec3(2.5, 1, 0),
-      .radius = 1.0f,
-      .material_index = static_cast<uint32_t>(materials.size()),
-  });
-  materials.push_back(material3);
-
-  const auto source_center = glm::vec3(3.5, 1, 0),
-             source_normal = glm::vec3(-1, 0, 0),
-             destination_center = glm::vec3(0, 1, 2),
-             destination_normal = glm::vec3(0, 0, -1);
-  auto source_material = gpu::Material::from_disk_pair(
-      source_center, source_normal, destination_center, destination_normal);
-  source_material.color = {1, 0.9, 0.3};
-  hittables.push_back({
-      .kind = gpu::HittableKind::DISK,
-      .center = source_center,
-      .normal = source_normal,
-      .radius = 1.0f,
-      .material_index = static_cast<uint32_t>(materials.size()),
-  });
-  materials.push_back(source_material);
-  auto destination_material = gpu::Material::from_disk_pair(
-      destination_center, destination_normal, source_center, source_normal);
-  destination_material.color = {0.3, 0.9, 1};
-  hittables.push_back({
-      .kind = gpu::HittableKind::DISK,
-      .center = destination_center,
-      .normal = destination_normal,
-      .radius = 1.0f,
-      .material_index = static_cast<uint32_t>(materials.size()),
-  });
-  materials.push_back(destination_material);
-
-  gpu::Scene scene;
-  scene.camera = {
-      .eye = {0, 2, 12},
-      .center = {0, 0, 0},
-      .up = {0, 1, 0},
-      .vfov = 20,
-      .defocus_angle = 0.6f,
-      .focus_dist = 10.0f,
-  };
-  std::cout << "Number of hittable objects: " << hittables.size() << std::endl;
-  scene.hittables_count = hittables.size();
-  std::copy(hittables.begin(), hittables.end(), scene.hittables);
-  std::copy(materials.begin(), materials.end(), scene.materials);
+  auto scene = make_demo_scene();
+  std::cout << "Number of hittable objects: " << scene.hittables_count
+            << std::endl;
 
-  const std::uint32_t render_calls = 20, samples = 100;
+  const std::uint32_t render_calls = 20;
   Settings settings{.window_height = 720,
                     .window_width = 1280,
                     .shader_file = "shader.comp.spv",
                     .group_size_x = 16,
-                    .group_size_y = 8};
+                    .group_size_y = 8,
+                    .max_depth = 50,
+                    .max_portal_hops = 16,
+                    .samples_per_pass =
+                        std::max(samples / render_calls, 1u),
+                    .auto_tune_group_size = auto_tune_group_size,
+                    .profile_csv_file = profile_csv_file,
+                    .wavefront_shader_file = "wavefront.comp.spv",
+                    .persistent_shader_file = "persistent.comp.spv",
+                    .persistent_group_count = 0,
+                    .integrator = Integrator::MEGAKERNEL,
+                    .pipeline_cache_file = "gpu_tracer.pipeline_cache",
+                    .resolve_shader_file = "resolve.comp.spv",
+                    .reproject_shader_file = "reproject.comp.spv",
+                    .temporal_reprojection = true,
+                    .reprojection_history_samples = 32,
+                    .preview_frame_ms = 16.0f,
+                    .sampler = sampler};
+
+  if (budget) {
+    render_headless(settings, scene, environment_file, *budget, samples,
+                    output_file);
+    return 0;
+  }
 
   VulkanEngine engine(settings);
+  if (!environment_file.empty())
+    engine.set_environment(Environment::load(environment_file));
 
   std::uint32_t i = 0;
   float pan_angle = 90.0f;
   bool clear = false;
+  // Time from the last camera move until the estimated noise of the image
+  // falls below converged_rms_error, to compare convergence with and without
+  // reprojection. The image is read back every few render calls for it,
+  // which stalls those frames, so it is only measured when asked for.
+  const std::uint32_t convergence_check_calls = 4;
+  const double converged_rms_error = 0.01;
+  const auto pixel_count =
+      static_cast<std::size_t>(settings.window_width) * settings.window_height;
+  bool measure_convergence = false;
+  auto camera_moved_at = std::chrono::steady_clock::now();
+  std::optional<std::chrono::steady_clock::time_point> converged_at;
+  std::optional<PassVariance> variance;
+  std::vector<glm::vec4> checked_sums;
+  double rms_error = 0;
+  const auto restart_convergence = [&]() {
+    camera_moved_at = std::chrono::steady_clock::now();
+    converged_at.reset();
+    variance.reset();
+    if (measure_convergence) {
+      variance.emplace(pixel_count);
+      checked_sums.assign(pixel_count, glm::vec4(0));
+    }
+    rms_error = 0;
+  };
   while (!engine.should_exit()) {
     std::cout << "Render call #" << i << std::endl;
     engine.update();
@@ -164,14 +215,57 @@ int main() {
     ImGui::NewFrame();
 
     ImGui::Begin("Camera Control");
-    ImGui::SliderFloat("Pan Angle", &pan_angle, 0, 360.0f);
-    if (i == render_calls)
-      if (ImGui::Button("Render")) {
-        i = 0;
-        clear = true;
-        scene.camera.eye = {12 * std::cos(glm::radians(pan_angle)), 2,
-                            12 * std::sin(glm::radians(pan_angle))};
-      }
+    // The camera follows the slider while it is dragged; the engine previews
+    // at reduced resolution until it stops.
+    if (ImGui::SliderFloat("Pan Angle", &pan_angle, 0, 360.0f)) {
+      i = 0;
+      clear = true;
+      restart_convergence();
+      scene.camera.eye = {12 * std::cos(glm::radians(pan_angle)), 2,
+                          12 * std::sin(glm::radians(pan_angle))};
+    }
+    auto integrator = static_cast<int>(engine.integrator());
+    ImGui::RadioButton("Megakernel", &integrator,
+                       static_cast<int>(Integrator::MEGAKERNEL));
+    ImGui::SameLine();
+    ImGui::RadioButton("Wavefront", &integrator,
+                       static_cast<int>(Integrator::WAVEFRONT));
+    ImGui::SameLine();
+    ImGui::RadioButton("Persistent", &integrator,
+                       static_cast<int>(Integrator::PERSISTENT));
+    engine.set_integrator(static_cast<Integrator>(integrator));
+    const auto &stats = engine.frame_stats();
+    ImGui::Text("Path tracing: %.3f ms", stats.dispatch_ms);
+    ImGui::Text("ImGui: %.3f ms", stats.imgui_ms);
+    ImGui::Text("Present: %.3f ms", stats.present_ms);
+    ImGui::Text("Rays: %.2f Mrays/s", stats.mrays_per_second);
+    ImGui::Text("Portal traversals: %u", stats.portal_traversals);
+    ImGui::Text("Lane utilization: %.1f%%", stats.lane_utilization * 100.0f);
+    ImGui::Text("Workgroup: %ux%u", stats.group_size_x, stats.group_size_y);
+    ImGui::Text("Pixel stride: %u", stats.pixel_stride);
+    ImGui::Text("Scene upload: %u bytes", stats.upload_bytes);
+    const auto memory = engine.memory_statistics();
+    ImGui::Text("GPU memory: %.1f / %.1f MiB in %u blocks",
+                memory.used_bytes / 1048576.0f,
+                memory.reserved_bytes / 1048576.0f, memory.block_count);
+    auto temporal_reprojection = engine.temporal_reprojection();
+    ImGui::Checkbox("Temporal reprojection", &temporal_reprojection);
+    engine.set_temporal_reprojection(temporal_reprojection);
+    // Measures from a restarted accumulation, like after a camera move.
+    if (ImGui::Checkbox("Measure convergence", &measure_convergence)) {
+      i = 0;
+      clear = true;
+      restart_convergence();
+    }
+    if (!measure_convergence)
+      ImGui::Text("Convergence not measured");
+    else if (converged_at)
+      ImGui::Text("Converged after camera move: %.2f s",
+                  std::chrono::duration<float>(*converged_at -
+                                               camera_moved_at)
+                      .count());
+    else
+      ImGui::Text("Not converged, RMS error: %.4f", rms_error);
     ImGui::End();
     ImGui::Render();
 
@@ -182,8 +276,26 @@ int main() {
                            .total_samples = samples};
     engine.render(info, scene);
 
-    if (!clear)
-      i = std::min(i + 1, render_calls);
+    // Every check is a pass of PassVariance, with the samples the pixels
+    // got since the previous one, the reprojected ones included.
+    if (variance && i < render_calls &&
+        ((i + 1) % convergence_check_calls == 0 || i + 1 == render_calls)) {
+      const auto sums = engine.read_summed_image();
+      for (std::size_t pixel = 0; pixel < pixel_count; pixel++) {
+        const auto pass_sum = sums[pixel] - checked_sums[pixel];
+        variance->add(pixel, glm::vec3(pass_sum),
+                      static_cast<std::uint32_t>(pass_sum.w + 0.5f));
+      }
+      checked_sums = sums;
+      rms_error = variance->rms_error();
+      if (rms_error > 0 && rms_error < converged_rms_error) {
+        converged_at = std::chrono::steady_clock::now();
+        variance.reset();
+      } else if (i + 1 == render_calls)
+        variance.reset();
+    }
+
+    i = std::min(i + 1, render_calls);
     clear = false;
   }
 }
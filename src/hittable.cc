@@ -1,5 +1,6 @@
 #include "hittable.hh"
 
+#include "interval.hh"
 #include "material.hh"
 #include "ray.hh"
 
@@ -14,3 +15,18 @@ HitRecord::HitRecord(const Ray &ray, const glm::vec3 &outward_normal, float t,
   front_face = glm::dot(ray.direction(), outward_normal) < 0;
   normal = front_face ? outward_normal : -outward_normal;
 }
+
+bool Hittable::occluded(const Ray &ray, float t_max) const {
+  return hit(ray, Interval(0.001f, t_max)).has_value();
+}
+
+float Hittable::pdf_value(const glm::vec3 &origin,
+                          const glm::vec3 &direction) const {
+  return 0;
+}
+
+glm::vec3 Hittable::random(const glm::vec3 &origin, const glm::vec2 &u) const {
+  return {1, 0, 0};
+}
+
+bool Hittable::is_emissive() const { return false; }
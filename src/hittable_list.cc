@@ -1,9 +1,78 @@
 #include "hittable_list.hh"
 
+#include "aabb.hh"
+#include "disk.hh"
 #include "hittable.hh"
 #include "interval.hh"
+#include "material.hh"
+#include "portal_material.hh"
+#include "scene.hh"
+#include "sphere.hh"
+#include "utils.hh"
 
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <memory>
 #include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+HittableList HittableList::from_scene(const gpu::Scene &scene) {
+  // Hittables that share a material share it on the CPU as well.
+  std::vector<std::shared_ptr<Material>> materials(std::size(scene.materials));
+  const auto material_of = [&](std::uint32_t index) {
+    if (materials[index] != nullptr)
+      return materials[index];
+
+    const auto &material = scene.materials[index];
+    switch (material.kind) {
+    case gpu::MaterialKind::LAMBERTIAN:
+      materials[index] = std::make_shared<Lambertian>(material.color);
+      break;
+    case gpu::MaterialKind::METAL:
+      materials[index] =
+          std::make_shared<Metal>(material.color, material.parameter);
+      break;
+    case gpu::MaterialKind::DIELECTRIC:
+      materials[index] = std::make_shared<Dielectric>(material.parameter);
+      break;
+    case gpu::MaterialKind::PORTAL:
+      materials[index] = std::make_shared<PortalMaterial>(
+          glm::mat3(material.rotation), material.translation, material.color);
+      break;
+    case gpu::MaterialKind::EMISSIVE:
+      materials[index] = std::make_shared<Emissive>(material.color);
+      break;
+    default:
+      throw std::invalid_argument("invalid material kind");
+    }
+    return materials[index];
+  };
+
+  HittableList world;
+  for (std::uint32_t i = 0; i < scene.hittables_count; i++) {
+    const auto &hittable = scene.hittables[i];
+    const auto material = material_of(hittable.material_index);
+    if (hittable.kind == gpu::HittableKind::SPHERE)
+      world.hittables.push_back(std::make_shared<Sphere>(
+          hittable.center, hittable.radius, material));
+    else
+      world.hittables.push_back(std::make_shared<Disk>(
+          hittable.center, hittable.normal, hittable.radius, material));
+  }
+  return world;
+}
+
+HittableList HittableList::lights() const {
+  HittableList lights;
+  std::copy_if(hittables.begin(), hittables.end(),
+               std::back_inserter(lights.hittables),
+               [](const auto &hittable) { return hittable->is_emissive(); });
+  return lights;
+}
 
 std::optional<HitRecord> HittableList::hit(const Ray &ray,
                                            Interval ray_t) const {
@@ -22,3 +91,39 @@ std::optional<HitRecord> HittableList::hit(const Ray &ray,
 
   return current_record;
 }
+
+bool HittableList::occluded(const Ray &ray, float t_max) const {
+  return std::any_of(hittables.begin(), hittables.end(),
+                     [&](const auto &hittable) {
+                       return hittable->occluded(ray, t_max);
+                     });
+}
+
+float HittableList::pdf_value(const glm::vec3 &origin,
+                              const glm::vec3 &direction) const {
+  if (hittables.empty())
+    return 0;
+
+  float sum = 0;
+  for (const auto &hittable : hittables)
+    sum += hittable->pdf_value(origin, direction);
+  return sum / hittables.size();
+}
+
+// u.x picks the hittable, and what is left of it after scaling to the
+// number of hittables is uniform again and reused.
+glm::vec3 HittableList::random(const glm::vec3 &origin,
+                               const glm::vec2 &u) const {
+  const auto scaled = u.x * static_cast<float>(hittables.size());
+  const auto index =
+      std::min(static_cast<std::size_t>(scaled), hittables.size() - 1);
+  return hittables[index]->random(
+      origin, {std::min(scaled - static_cast<float>(index), 0.99999994f), u.y});
+}
+
+Aabb HittableList::bounding_box() const {
+  Aabb box;
+  for (const auto &hittable : hittables)
+    box.merge(hittable->bounding_box());
+  return box;
+}
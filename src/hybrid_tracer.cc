@@ -0,0 +1,155 @@
+#include "camera.hh"
+#include "demo_scene.hh"
+#include "hittable_list.hh"
+#include "image_io.hh"
+#include "scene.hh"
+#include "thread_pool.hh"
+#include "tile_scheduler.hh"
+#include "vulkan_engine.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Renders one image of the demo scene with the GPU and the CPU at the same
+// time. Both take tiles from a TileScheduler and add raw sample sums to
+// images of their own, which are merged and averaged at the end.
+
+namespace {
+// Long enough for the submission overhead not to dominate a batch, short
+// enough for the last batches not to leave the CPU waiting.
+constexpr double gpu_batch_seconds = 0.05;
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string output_file = "hybrid.ppm";
+  std::uint32_t samples = 100, tile_size = 32;
+  std::size_t threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+  for (int arg = 1; arg < argc; arg++) {
+    const std::string option = argv[arg];
+    if (option == "--output" && arg + 1 < argc)
+      output_file = argv[++arg];
+    else if (option == "--samples" && arg + 1 < argc)
+      samples = std::stoul(argv[++arg]);
+    else if (option == "--tile-size" && arg + 1 < argc)
+      tile_size = std::stoul(argv[++arg]);
+    else if (option == "--threads" && arg + 1 < argc)
+      threads = std::stoul(argv[++arg]);
+    else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--output <file>] [--samples <n>] [--tile-size <n>]"
+                   " [--threads <n>]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  const auto scene = make_demo_scene();
+  const auto world = HittableList::from_scene(scene);
+  const auto lights = world.lights();
+
+  const std::uint32_t width = 1280, height = 720;
+  const auto config = scene_camera_config(
+      scene.camera, width, height, static_cast<int>(samples), 50, 16);
+  const Camera camera(config, static_cast<int>(height));
+
+  Settings settings{.window_height = height,
+                    .window_width = width,
+                    .shader_file = "shader.comp.spv",
+                    .group_size_x = 16,
+                    .group_size_y = 8,
+                    .max_depth = 50,
+                    .max_portal_hops = 16,
+                    .samples_per_pass = samples,
+                    .auto_tune_group_size = false,
+                    .profile_csv_file = "",
+                    .wavefront_shader_file = "wavefront.comp.spv",
+                    .persistent_shader_file = "persistent.comp.spv",
+                    .persistent_group_count = 0,
+                    .integrator = Integrator::MEGAKERNEL,
+                    .pipeline_cache_file = "hybrid_tracer.pipeline_cache",
+                    .resolve_shader_file = "resolve.comp.spv",
+                    .reproject_shader_file = "reproject.comp.spv",
+                    .temporal_reprojection = false,
+                    .reprojection_history_samples = 32,
+                    .preview_frame_ms = 0.0f,
+                    .headless = true};
+  VulkanEngine engine(settings);
+
+  // Zeroes the accumulation without tracing anything.
+  std::uint32_t render_call = 0;
+  engine.render({.read_only = 1,
+                 .clear = 1,
+                 .number = render_call++,
+                 .total_render_calls = 1,
+                 .total_samples = samples},
+                scene);
+  engine.wait_for_frame();
+
+  TileScheduler scheduler(width, height, tile_size);
+  const auto begin = std::chrono::steady_clock::now();
+
+  std::thread gpu_thread([&] {
+    while (true) {
+      const auto batch = scheduler.take_gpu_batch(gpu_batch_seconds);
+      if (batch.empty())
+        break;
+      const auto batch_begin = std::chrono::steady_clock::now();
+      engine.set_tiles(batch);
+      engine.render({.read_only = 0,
+                     .clear = 0,
+                     .number = render_call++,
+                     .total_render_calls = 1,
+                     .total_samples = samples},
+                    scene);
+      engine.wait_for_frame();
+      scheduler.report_gpu(
+          batch.size(), std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - batch_begin)
+                            .count());
+    }
+  });
+
+  std::vector<glm::vec4> cpu_sums(static_cast<std::size_t>(width) * height,
+                                  glm::vec4(0));
+  ThreadPool pool(threads);
+  pool.run([&](std::size_t) {
+    TraceCounters counters = {.rays = 0, .portal_traversals = 0};
+    while (const auto tile = scheduler.take_cpu_tile()) {
+      const auto tile_begin = std::chrono::steady_clock::now();
+      for (auto y = tile->y; y < tile->y + tile->height; y++)
+        for (auto x = tile->x; x < tile->x + tile->width; x++)
+          cpu_sums[static_cast<std::size_t>(y) * width + x] = glm::vec4(
+              camera.trace_pixel(static_cast<int>(y), static_cast<int>(x),
+                                 world, lights, counters),
+              static_cast<float>(samples));
+      scheduler.report_cpu(std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - tile_begin)
+                               .count());
+    }
+  });
+  gpu_thread.join();
+  const auto end = std::chrono::steady_clock::now();
+
+  // Every pixel was traced by exactly one side, the other one left it zero.
+  const auto sums = engine.read_summed_image();
+  Image image = {.width = width, .height = height, .pixels = {}};
+  for (std::size_t i = 0; i < sums.size(); i++) {
+    const auto sum = sums[i] + cpu_sums[i];
+    image.pixels.push_back(sum.w > 0 ? glm::vec3(sum) / sum.w : glm::vec3(0));
+  }
+  write_ppm(output_file, image);
+
+  std::cout << "Rendered " << scheduler.tile_count() << " tiles in "
+            << std::chrono::duration<float>(end - begin).count()
+            << " s: " << scheduler.gpu_tiles() << " on the GPU, "
+            << scheduler.cpu_tiles() << " on " << pool.size()
+            << " CPU threads" << std::endl;
+}
@@ -0,0 +1,166 @@
+#include "image_io.hh"
+
+#include "utils.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// PFM stores the rows from the bottom up, and the sign of the scale gives
+// the byte order: negative is little endian.
+
+namespace {
+std::uint32_t byte_swap(std::uint32_t value) {
+  return (value >> 24) | ((value >> 8) & 0xFF00u) | ((value << 8) & 0xFF0000u) |
+         (value << 24);
+}
+} // namespace
+
+void write_pfm(const std::string &filename, const Image &image) {
+  std::ofstream out(filename, std::ios::binary);
+  if (!out.is_open())
+    throw std::runtime_error("Failed to open: " + filename);
+  out << "PF\n"
+      << image.width << " " << image.height << "\n"
+      << (std::endian::native == std::endian::little ? "-1.0" : "1.0")
+      << "\n";
+  for (std::uint32_t y = image.height; y-- > 0;)
+    out.write(reinterpret_cast<const char *>(
+                  &image.pixels[static_cast<std::size_t>(y) * image.width]),
+              static_cast<std::streamsize>(image.width * sizeof(glm::vec3)));
+}
+
+Image read_pfm(const std::string &filename) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in.is_open())
+    throw std::runtime_error("Failed to open: " + filename);
+
+  std::string magic;
+  Image image = {};
+  float scale = 0;
+  in >> magic >> image.width >> image.height >> scale;
+  in.get();
+  if (!in || magic != "PF")
+    throw std::runtime_error("Not an RGB PFM file: " + filename);
+
+  image.pixels.resize(static_cast<std::size_t>(image.width) * image.height);
+  for (std::uint32_t y = image.height; y-- > 0;)
+    in.read(reinterpret_cast<char *>(
+                &image.pixels[static_cast<std::size_t>(y) * image.width]),
+            static_cast<std::streamsize>(image.width * sizeof(glm::vec3)));
+  if (!in)
+    throw std::runtime_error("Truncated PFM file: " + filename);
+
+  const auto little_endian = scale < 0;
+  if (little_endian != (std::endian::native == std::endian::little))
+    for (auto &pixel : image.pixels)
+      for (int channel = 0; channel < 3; channel++)
+        pixel[channel] = std::bit_cast<float>(
+            byte_swap(std::bit_cast<std::uint32_t>(pixel[channel])));
+  return image;
+}
+
+Image read_hdr(const std::string &filename) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in.is_open())
+    throw std::runtime_error("Failed to open: " + filename);
+
+  std::string line;
+  std::getline(in, line);
+  if (line.rfind("#?", 0) != 0)
+    throw std::runtime_error("Not a Radiance HDR file: " + filename);
+  // The header ends with an empty line, the resolution follows it.
+  while (std::getline(in, line) && !line.empty())
+    if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+      throw std::runtime_error("Unsupported HDR format: " + filename);
+  std::getline(in, line);
+  std::istringstream resolution(line);
+  std::string y_axis, x_axis;
+  Image image = {};
+  resolution >> y_axis >> image.height >> x_axis >> image.width;
+  if (!resolution || y_axis != "-Y" || x_axis != "+X")
+    throw std::runtime_error("Unsupported HDR orientation: " + filename);
+
+  image.pixels.resize(static_cast<std::size_t>(image.width) * image.height);
+  std::vector<std::uint8_t> scanline(image.width * 4u);
+  for (std::uint32_t y = 0; y < image.height; y++) {
+    std::uint8_t start[4];
+    in.read(reinterpret_cast<char *>(start), 4);
+    const auto encoded_width =
+        static_cast<std::uint32_t>(start[2] << 8 | start[3]);
+    const auto run_length_encoded = image.width >= 8 && image.width < 32768 &&
+                                    start[0] == 2 && start[1] == 2 &&
+                                    encoded_width == image.width;
+    if (!run_length_encoded) {
+      std::copy(start, start + 4, scanline.begin());
+      in.read(reinterpret_cast<char *>(scanline.data() + 4),
+              static_cast<std::streamsize>(scanline.size() - 4));
+    } else {
+      // Every channel of the scanline is encoded on its own, in runs of one
+      // repeated byte (count > 128) or of count literal bytes.
+      for (std::uint32_t channel = 0; channel < 4; channel++)
+        for (std::uint32_t x = 0; x < image.width && in;) {
+          const auto count = in.get();
+          if (count > 128) {
+            const auto value = static_cast<std::uint8_t>(in.get());
+            for (int i = 0; i < count - 128 && x < image.width; i++)
+              scanline[4 * x++ + channel] = value;
+          } else {
+            for (int i = 0; i < count && x < image.width; i++)
+              scanline[4 * x++ + channel] = static_cast<std::uint8_t>(in.get());
+          }
+        }
+    }
+    if (!in)
+      throw std::runtime_error("Truncated HDR file: " + filename);
+
+    for (std::uint32_t x = 0; x < image.width; x++) {
+      const auto *rgbe = &scanline[4 * x];
+      auto &pixel = image.pixels[static_cast<std::size_t>(y) * image.width + x];
+      pixel = rgbe[3] == 0
+                  ? glm::vec3(0)
+                  : glm::vec3(rgbe[0], rgbe[1], rgbe[2]) *
+                        std::ldexp(1.0f, static_cast<int>(rgbe[3]) - 136);
+    }
+  }
+  return image;
+}
+
+void write_ppm(const std::string &filename, const Image &image,
+               const std::vector<std::string> &comments) {
+  std::ofstream out(filename);
+  if (!out.is_open())
+    throw std::runtime_error("Failed to open: " + filename);
+  out << "P3\n";
+  for (const auto &comment : comments)
+    out << "# " << comment << "\n";
+  out << image.width << " " << image.height << "\n255\n";
+  for (const auto &pixel : image.pixels)
+    for (int channel = 0; channel < 3; channel++)
+      out << static_cast<int>(
+                 256 * std::clamp(linear_to_gamma(pixel[channel]), 0.0f,
+                                  0.999f))
+          << (channel < 2 ? " " : "\n");
+}
+
+std::filesystem::path make_scratch_directory() {
+  std::random_device device;
+  std::filesystem::path directory;
+  do {
+    std::ostringstream name;
+    name << "tracer-" << std::hex << device() << device();
+    directory = std::filesystem::temp_directory_path() / name.str();
+  } while (!std::filesystem::create_directory(directory));
+  return directory;
+}
@@ -0,0 +1,67 @@
+#include "checkpoint.hh"
+#include "image_io.hh"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <glm/glm.hpp>
+
+// Writes what a cpu_tracer render with --live or --checkpoint has rendered
+// so far, read straight from the mapped file while the render goes on.
+
+namespace {
+bool has_extension(const std::string &filename, const std::string &extension) {
+  return filename.size() >= extension.size() &&
+         filename.compare(filename.size() - extension.size(),
+                          extension.size(), extension) == 0;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string input, output = "snapshot.ppm";
+  float exposure = 0;
+  auto valid = true;
+  for (int arg = 1; arg < argc && valid; arg++) {
+    const std::string option = argv[arg];
+    if (option == "--output" && arg + 1 < argc)
+      output = argv[++arg];
+    else if (option == "--exposure" && arg + 1 < argc)
+      exposure = std::stof(argv[++arg]);
+    else if (input.empty() && !option.starts_with("--"))
+      input = option;
+    else
+      valid = false;
+  }
+  if (!valid || input.empty()) {
+    std::cerr << "Usage: " << argv[0]
+              << " <file> [--output <file.ppm|file.pfm>] [--exposure <stops>]"
+              << std::endl;
+    return 1;
+  }
+
+  const Checkpoint checkpoint(input);
+  const auto settings = checkpoint.settings();
+  const auto generation = checkpoint.generation();
+  const auto samples = checkpoint.samples();
+
+  // Pixels without a sample yet stay black.
+  const auto scale = std::exp2(exposure);
+  Image image = {.width = settings.width, .height = settings.height,
+                 .pixels = {}};
+  image.pixels.resize(static_cast<std::size_t>(image.width) * image.height);
+  for (std::size_t i = 0; i < image.pixels.size(); i++) {
+    const auto pixel = checkpoint.load_pixel(i);
+    if (pixel.w > 0)
+      image.pixels[i] = glm::vec3(pixel) * (scale / pixel.w);
+  }
+  if (has_extension(output, ".pfm"))
+    write_pfm(output, image);
+  else
+    write_ppm(output, image);
+
+  std::clog << settings.width << "x" << settings.height << ", " << samples
+            << " samples per pixel, generation " << generation << std::endl;
+}
@@ -10,30 +10,61 @@
 #include <optional>
 #include <utility>
 
+#include <glm/ext/scalar_constants.hpp>
 #include <glm/glm.hpp>
 
 std::optional<std::pair<Ray, glm::vec3>>
-Material::scatter(const Ray &ray_in, const HitRecord &record) const {
+Material::scatter(const Ray &ray_in, const HitRecord &record,
+                  const glm::vec2 &u) const {
   return std::nullopt;
 }
 
+glm::vec3 Material::emitted(const Ray &ray_in, const HitRecord &record) const {
+  return {0, 0, 0};
+}
+
+float Material::scattering_pdf(const Ray &ray_in, const HitRecord &record,
+                               const Ray &scattered) const {
+  return 0;
+}
+
+glm::vec3 Material::albedo() const { return {1, 1, 1}; }
+
+bool Material::is_portal() const { return false; }
+
+bool Material::is_emissive() const { return false; }
+
 Lambertian::Lambertian(const glm::vec3 &albedo) : _albedo(albedo) {}
 
 std::optional<std::pair<Ray, glm::vec3>>
-Lambertian::scatter(const Ray &ray_in, const HitRecord &record) const {
-  const auto scatter_direction = record.normal + random_unit_vector();
+Lambertian::scatter(const Ray &ray_in, const HitRecord &record,
+                    const glm::vec2 &u) const {
+  const auto scatter_direction = record.normal + unit_vector(u);
   const auto scattered = Ray(record.point, scatter_direction);
   return std::make_pair(scattered, _albedo);
 }
 
+// scatter draws cosine weighted directions.
+float Lambertian::scattering_pdf(const Ray &ray_in, const HitRecord &record,
+                                 const Ray &scattered) const {
+  const auto cosine =
+      glm::dot(record.normal, glm::normalize(scattered.direction()));
+  return std::max(cosine, 0.0f) / glm::pi<float>();
+}
+
+glm::vec3 Lambertian::albedo() const { return _albedo; }
+
 Metal::Metal(const glm::vec3 &albedo, float fuzz)
     : _albedo(albedo), _fuzz(fuzz) {}
 
+glm::vec3 Metal::albedo() const { return _albedo; }
+
 std::optional<std::pair<Ray, glm::vec3>>
-Metal::scatter(const Ray &ray_in, const HitRecord &record) const {
+Metal::scatter(const Ray &ray_in, const HitRecord &record,
+               const glm::vec2 &u) const {
   const auto reflected =
       glm::normalize(glm::reflect(ray_in.direction(), record.normal)) +
-      (_fuzz * random_unit_vector());
+      (_fuzz * unit_vector(u));
   const auto scattered = Ray(record.point, reflected);
   if (glm::dot(scattered.direction(), record.normal) > 0)
     return std::make_pair(scattered, _albedo);
@@ -51,7 +82,8 @@ Dielectric::Dielectric(float refraction_index)
     : _refraction_index(refraction_index) {}
 
 std::optional<std::pair<Ray, glm::vec3>>
-Dielectric::scatter(const Ray &ray_in, const HitRecord &record) const {
+Dielectric::scatter(const Ray &ray_in, const HitRecord &record,
+                    const glm::vec2 &u) const {
   const auto ri =
       record.front_face ? 1.0f / _refraction_index : _refraction_index;
   const auto unit_direction = glm::normalize(ray_in.direction());
@@ -61,7 +93,7 @@ Dielectric::scatter(const Ray &ray_in, const HitRecord &record) const {
              sin_theta = std::sqrt(1.0f - cos_theta * cos_theta);
 
   glm::vec3 direction;
-  if (ri * sin_theta > 1.0f || _reflectance(cos_theta, ri) > random_float())
+  if (ri * sin_theta > 1.0f || _reflectance(cos_theta, ri) > u.x)
     direction = glm::reflect(unit_direction, record.normal);
   else {
     const auto r_out_perp = ri * (unit_direction + cos_theta * record.normal),
@@ -74,3 +106,11 @@ Dielectric::scatter(const Ray &ray_in, const HitRecord &record) const {
   const auto scattered = Ray(record.point, direction);
   return std::make_pair(scattered, glm::vec3(1, 1, 1));
 }
+
+Emissive::Emissive(const glm::vec3 &emission) : _emission(emission) {}
+
+glm::vec3 Emissive::emitted(const Ray &ray_in, const HitRecord &record) const {
+  return _emission;
+}
+
+bool Emissive::is_emissive() const { return true; }
@@ -0,0 +1,164 @@
+#include "memory_allocator.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+
+namespace {
+vk::DeviceSize align_up(vk::DeviceSize value, vk::DeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+} // namespace
+
+MemoryAllocator::MemoryAllocator(const vk::PhysicalDevice &physical_device,
+                                 const vk::Device &device,
+                                 vk::DeviceSize block_size)
+    : _physical_device(physical_device), _device(device),
+      _block_size(block_size),
+      _granularity(
+          physical_device.getProperties().limits.bufferImageGranularity),
+      _memory_properties(physical_device.getMemoryProperties()) {}
+
+MemoryAllocator::~MemoryAllocator() {
+  for (const auto &block : _blocks) {
+    if (block.mapped != nullptr)
+      _device.unmapMemory(block.memory);
+    _device.freeMemory(block.memory);
+  }
+}
+
+std::uint32_t MemoryAllocator::_find_memory_type_index(
+    std::uint32_t memory_type_bits,
+    const vk::MemoryPropertyFlags &properties) const {
+  for (uint32_t i = 0; i < _memory_properties.memoryTypeCount; i++) {
+    if ((memory_type_bits & (1 << i)) &&
+        (_memory_properties.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+      return i;
+    }
+  }
+
+  throw std::runtime_error("Unable to find suitable memory type!");
+}
+
+// First fit. The padding in front of an aligned range stays free.
+std::optional<vk::DeviceSize>
+MemoryAllocator::_take_range(Block &block, vk::DeviceSize size,
+                             vk::DeviceSize alignment) {
+  for (auto it = block.free_ranges.begin(); it != block.free_ranges.end();
+       it++) {
+    const auto [range_offset, range_size] = *it;
+    const auto offset = align_up(range_offset, alignment);
+    if (offset + size > range_offset + range_size)
+      continue;
+
+    block.free_ranges.erase(it);
+    if (offset > range_offset)
+      block.free_ranges[range_offset] = offset - range_offset;
+    if (offset + size < range_offset + range_size)
+      block.free_ranges[offset + size] =
+          range_offset + range_size - (offset + size);
+    return offset;
+  }
+  return std::nullopt;
+}
+
+Allocation
+MemoryAllocator::allocate(const vk::MemoryRequirements &requirements,
+                          const vk::MemoryPropertyFlags &properties) {
+  const auto memory_type_index =
+      _find_memory_type_index(requirements.memoryTypeBits, properties);
+  // Aligning everything to the granularity keeps buffers and images from
+  // sharing a page without tracking which kind each range holds.
+  const auto alignment = std::max(requirements.alignment, _granularity);
+  const auto size = align_up(requirements.size, alignment);
+
+  const auto make_allocation = [&](std::uint32_t block_index,
+                                   vk::DeviceSize offset) -> Allocation {
+    auto &block = _blocks[block_index];
+    block.allocation_count++;
+    return {
+        .memory = block.memory,
+        .offset = offset,
+        .size = size,
+        .mapped = block.mapped == nullptr
+                      ? nullptr
+                      : static_cast<char *>(block.mapped) + offset,
+        .block_index = block_index,
+    };
+  };
+
+  for (std::uint32_t i = 0; i < _blocks.size(); i++) {
+    if (_blocks[i].memory_type_index != memory_type_index)
+      continue;
+    if (const auto offset = _take_range(_blocks[i], size, alignment))
+      return make_allocation(i, *offset);
+  }
+
+  // Resources larger than a block get a block of their own.
+  Block block = {
+      .memory = nullptr,
+      .size = std::max(_block_size, size),
+      .memory_type_index = memory_type_index,
+      .mapped = nullptr,
+      .free_ranges = {},
+      .allocation_count = 0,
+  };
+  block.memory = _device.allocateMemory({
+      .allocationSize = block.size,
+      .memoryTypeIndex = memory_type_index,
+  });
+  // Blocks are shared by everything of their memory type, which on unified
+  // memory devices includes device local resources that were asked for first,
+  // so whether to map depends on the type rather than the request.
+  if (_memory_properties.memoryTypes[memory_type_index].propertyFlags &
+      vk::MemoryPropertyFlagBits::eHostVisible)
+    block.mapped = _device.mapMemory(block.memory, 0, VK_WHOLE_SIZE);
+  block.free_ranges[0] = block.size;
+  _blocks.push_back(std::move(block));
+
+  const auto block_index = static_cast<std::uint32_t>(_blocks.size() - 1);
+  const auto offset = _take_range(_blocks.back(), size, alignment);
+  return make_allocation(block_index, *offset);
+}
+
+void MemoryAllocator::free(const Allocation &allocation) {
+  auto &block = _blocks[allocation.block_index];
+  block.allocation_count--;
+
+  auto [it, inserted] =
+      block.free_ranges.emplace(allocation.offset, allocation.size);
+  if (it != block.free_ranges.begin()) {
+    const auto previous = std::prev(it);
+    if (previous->first + previous->second == it->first) {
+      previous->second += it->second;
+      block.free_ranges.erase(it);
+      it = previous;
+    }
+  }
+  const auto next = std::next(it);
+  if (next != block.free_ranges.end() &&
+      it->first + it->second == next->first) {
+    it->second += next->second;
+    block.free_ranges.erase(next);
+  }
+}
+
+MemoryStatistics MemoryAllocator::statistics() const {
+  MemoryStatistics statistics = {};
+  for (const auto &block : _blocks) {
+    vk::DeviceSize free_bytes = 0;
+    for (const auto &[offset, size] : block.free_ranges)
+      free_bytes += size;
+
+    statistics.block_count++;
+    statistics.allocation_count += block.allocation_count;
+    statistics.reserved_bytes += block.size;
+    statistics.used_bytes += block.size - free_bytes;
+    if (block.mapped != nullptr)
+      statistics.host_visible_bytes += block.size;
+  }
+  return statistics;
+}
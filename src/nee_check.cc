@@ -0,0 +1,166 @@
+#include "camera.hh"
+#include "demo_scene.hh"
+#include "environment.hh"
+#include "hittable_list.hh"
+#include "scene.hh"
+#include "thread_pool.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Renders the demo scene on the CPU for the same wall clock time with and
+// without next-event estimation and compares both against a converged
+// reference, so a change to light sampling is judged by the error it leaves
+// per second instead of per sample.
+
+namespace {
+constexpr std::uint32_t image_width = 200, image_height = 112, max_depth = 50;
+constexpr int max_portal_hops = 16;
+// The reference's samples are numbered from here, far past any that the
+// timed renders reach, so that its error is independent of theirs.
+constexpr std::uint32_t reference_first_sample = 1u << 31;
+
+struct Result {
+  std::uint32_t samples;
+  double rmse;
+};
+
+float display_value(float linear) {
+  return std::clamp(linear_to_gamma(linear), 0.0f, 1.0f);
+}
+
+double rmse(const std::vector<glm::vec4> &sums,
+            const std::vector<glm::vec4> &reference) {
+  double sum = 0;
+  for (std::size_t i = 0; i < sums.size(); i++)
+    for (int channel = 0; channel < 3; channel++) {
+      const double difference =
+          display_value(sums[i][channel] / sums[i].w) -
+          display_value(reference[i][channel] / reference[i].w);
+      sum += difference * difference;
+    }
+  return std::sqrt(sum / (3.0 * sums.size()));
+}
+
+double psnr(double rmse) {
+  return rmse > 0 ? -20 * std::log10(rmse)
+                  : std::numeric_limits<double>::infinity();
+}
+
+Camera make_camera(const gpu::Camera &camera, std::uint32_t samples,
+                   bool bsdf_sampling_only,
+                   const std::shared_ptr<const Environment> &environment) {
+  auto config = scene_camera_config(camera, image_width, image_height,
+                                    static_cast<int>(samples), max_depth,
+                                    max_portal_hops);
+  config.bsdf_sampling_only = bsdf_sampling_only;
+  Camera cpu_camera(config, static_cast<int>(image_height));
+  cpu_camera.set_environment(environment);
+  return cpu_camera;
+}
+
+// Adds samples samples, starting at number first_sample, to every pixel of
+// sums. samples has to match the camera's samples_per_pixel.
+void render_pass(const Camera &camera, std::uint32_t samples,
+                 std::uint32_t first_sample, const HittableList &world,
+                 const HittableList &lights, ThreadPool &pool,
+                 std::vector<glm::vec4> &sums) {
+  pool.parallel_for(image_height, [&](std::size_t y) {
+    TraceCounters counters = {.rays = 0, .portal_traversals = 0};
+    for (std::uint32_t x = 0; x < image_width; x++)
+      sums[y * image_width + x] +=
+          glm::vec4(camera.trace_pixel(static_cast<int>(y),
+                                       static_cast<int>(x), world, lights,
+                                       counters, first_sample),
+                    static_cast<float>(samples));
+  });
+}
+
+Result render_for(double seconds, bool bsdf_sampling_only,
+                  const gpu::Scene &scene, const HittableList &world,
+                  const HittableList &lights,
+                  const std::shared_ptr<const Environment> &environment,
+                  ThreadPool &pool, const std::vector<glm::vec4> &reference) {
+  const auto camera =
+      make_camera(scene.camera, 1, bsdf_sampling_only, environment);
+  std::vector<glm::vec4> sums(reference.size(), glm::vec4(0));
+  std::uint32_t samples = 0;
+  const auto begin = std::chrono::steady_clock::now();
+  do {
+    render_pass(camera, 1, samples, world, lights, pool, sums);
+    samples++;
+  } while (std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         begin)
+               .count() < seconds);
+  return {.samples = samples, .rmse = rmse(sums, reference)};
+}
+
+void print_result(const std::string &name, const Result &result) {
+  std::cout << std::left << std::setw(12) << name << std::right
+            << std::setw(8) << result.samples << " spp  RMSE "
+            << std::fixed << std::setprecision(5) << result.rmse << "  PSNR "
+            << std::setprecision(2) << psnr(result.rmse) << " dB"
+            << std::endl;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  double seconds = 5;
+  std::uint32_t reference_samples = 1024;
+  std::size_t threads = std::thread::hardware_concurrency();
+  std::shared_ptr<const Environment> environment;
+  for (int arg = 1; arg < argc; arg++) {
+    const std::string option = argv[arg];
+    if (option == "--seconds" && arg + 1 < argc)
+      seconds = std::stod(argv[++arg]);
+    else if (option == "--reference-samples" && arg + 1 < argc)
+      reference_samples = std::stoul(argv[++arg]);
+    else if (option == "--threads" && arg + 1 < argc)
+      threads = std::stoul(argv[++arg]);
+    else if (option == "--environment" && arg + 1 < argc)
+      environment = std::make_shared<const Environment>(
+          Environment::load(argv[++arg]));
+    else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--seconds <s>] [--reference-samples <n>]"
+                   " [--threads <n>] [--environment <file.pfm|file.hdr>]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  const auto scene = make_demo_scene();
+  const auto world = HittableList::from_scene(scene);
+  const auto lights = world.lights();
+  ThreadPool pool(std::max<std::size_t>(threads, 1));
+
+  std::vector<glm::vec4> reference(
+      static_cast<std::size_t>(image_width) * image_height, glm::vec4(0));
+  render_pass(
+      make_camera(scene.camera, reference_samples, false, environment),
+      reference_samples, reference_first_sample, world, lights, pool,
+      reference);
+
+  const auto bsdf = render_for(seconds, true, scene, world, lights,
+                               environment, pool, reference);
+  const auto nee = render_for(seconds, false, scene, world, lights,
+                              environment, pool, reference);
+  print_result("bsdf only", bsdf);
+  print_result("nee + mis", nee);
+  std::cout << "Error ratio at " << std::setprecision(1) << seconds
+            << " s: " << std::setprecision(2) << bsdf.rmse / nee.rmse
+            << std::endl;
+}
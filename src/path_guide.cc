@@ -0,0 +1,147 @@
+#include "path_guide.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/glm.hpp>
+
+PathGuide::PathGuide(const glm::vec3 &min, const glm::vec3 &max)
+    : _min(min), _max(max), _nodes{{.children = 0, .leaf = 0, .depth = 0}},
+      _pdf(BINS, 1 / (4 * glm::pi<float>())), _cdf(BINS), _learned(BINS),
+      _samples(1) {
+  for (std::uint32_t bin = 0; bin < BINS; bin++)
+    _cdf[bin] = static_cast<float>(bin + 1) / BINS;
+}
+
+// Bins are equal steps of z, which is uniform over the sphere, and of the
+// angle around the z axis.
+std::uint32_t PathGuide::_bin(const glm::vec3 &direction) {
+  const auto unit_direction = glm::normalize(direction);
+  auto phi = std::atan2(unit_direction.y, unit_direction.x);
+  if (phi < 0)
+    phi += 2 * glm::pi<float>();
+  const auto x = std::min(static_cast<std::uint32_t>(
+                              phi / (2 * glm::pi<float>()) * BINS_PER_AXIS),
+                          BINS_PER_AXIS - 1),
+             y = std::min(static_cast<std::uint32_t>(std::max(
+                              (unit_direction.z + 1) / 2 * BINS_PER_AXIS,
+                              0.0f)),
+                          BINS_PER_AXIS - 1);
+  return y * BINS_PER_AXIS + x;
+}
+
+std::uint32_t PathGuide::leaf(const glm::vec3 &point) const {
+  auto lo = _min, hi = _max;
+  const auto p = glm::clamp(point, _min, _max);
+  auto node = _nodes[0];
+  while (node.children != 0) {
+    const auto middle = (lo + hi) * 0.5f;
+    std::uint32_t child = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      if (p[axis] >= middle[axis]) {
+        child |= 1u << axis;
+        lo[axis] = middle[axis];
+      } else {
+        hi[axis] = middle[axis];
+      }
+    }
+    node = _nodes[node.children + child];
+  }
+  return node.leaf;
+}
+
+std::size_t PathGuide::leaf_count() const { return _samples.size(); }
+
+bool PathGuide::trained() const { return _trained; }
+
+// u.x picks the bin, and what is left of it after rescaling to the bin's
+// probability places the direction around the z axis. u.y places it along z.
+glm::vec3 PathGuide::sample(std::uint32_t leaf, const glm::vec2 &u) const {
+  const auto *cdf = &_cdf[static_cast<std::size_t>(leaf) * BINS];
+  const auto bin = static_cast<std::uint32_t>(
+      std::min<std::ptrdiff_t>(std::upper_bound(cdf, cdf + BINS, u.x) - cdf,
+                               BINS - 1));
+  const auto lower = bin > 0 ? cdf[bin - 1] : 0.0f,
+             width = cdf[bin] - lower;
+  const auto jitter =
+      width > 0 ? std::clamp((u.x - lower) / width, 0.0f, 0.99999994f) : 0.5f;
+
+  const auto x = bin % BINS_PER_AXIS, y = bin / BINS_PER_AXIS;
+  const auto z = -1 + 2 * (static_cast<float>(y) + u.y) / BINS_PER_AXIS,
+             phi = 2 * glm::pi<float>() * (static_cast<float>(x) + jitter) /
+                   BINS_PER_AXIS,
+             r = std::sqrt(std::max(1 - z * z, 0.0f));
+  return {r * std::cos(phi), r * std::sin(phi), z};
+}
+
+float PathGuide::pdf(std::uint32_t leaf, const glm::vec3 &direction) const {
+  return _pdf[static_cast<std::size_t>(leaf) * BINS + _bin(direction)];
+}
+
+void PathGuide::record(std::uint32_t leaf, const glm::vec3 &direction,
+                       float value) {
+  _samples[leaf].fetch_add(1, std::memory_order_relaxed);
+  if (!(value > 0) || !std::isfinite(value))
+    return;
+  _learned[static_cast<std::size_t>(leaf) * BINS + _bin(direction)].fetch_add(
+      value, std::memory_order_relaxed);
+}
+
+void PathGuide::update() {
+  // Leaves that recorded no light keep sampling what they learned before.
+  for (std::size_t leaf = 0; leaf < _samples.size(); leaf++) {
+    double total = 0;
+    for (std::uint32_t bin = 0; bin < BINS; bin++)
+      total += _learned[leaf * BINS + bin].load(std::memory_order_relaxed);
+    if (total <= 0)
+      continue;
+
+    _trained = true;
+    double cumulative = 0;
+    for (std::uint32_t bin = 0; bin < BINS; bin++) {
+      const auto probability =
+          _learned[leaf * BINS + bin].load(std::memory_order_relaxed) / total;
+      cumulative += probability;
+      _pdf[leaf * BINS + bin] =
+          static_cast<float>(probability * BINS / (4 * glm::pi<double>()));
+      _cdf[leaf * BINS + bin] = static_cast<float>(cumulative);
+    }
+    _cdf[leaf * BINS + BINS - 1] = 1;
+  }
+
+  // Children start out with the histograms of their parent. Only the leaves
+  // that existed before are split, so the tree grows a level per pass.
+  const auto node_count = _nodes.size();
+  for (std::size_t node = 0; node < node_count; node++) {
+    const auto current = _nodes[node];
+    if (current.children != 0 || current.depth >= MAX_TREE_DEPTH ||
+        _samples[current.leaf].load(std::memory_order_relaxed) < SPLIT_SAMPLES)
+      continue;
+    _nodes[node].children = static_cast<std::uint32_t>(_nodes.size());
+    for (int child = 0; child < 8; child++)
+      _nodes.push_back({.children = 0,
+                        .leaf = current.leaf,
+                        .depth = current.depth + 1});
+  }
+
+  std::vector<float> pdf, cdf;
+  std::uint32_t leaves = 0;
+  for (auto &node : _nodes) {
+    if (node.children != 0)
+      continue;
+    const auto first = static_cast<std::ptrdiff_t>(node.leaf) * BINS;
+    pdf.insert(pdf.end(), _pdf.begin() + first, _pdf.begin() + first + BINS);
+    cdf.insert(cdf.end(), _cdf.begin() + first, _cdf.begin() + first + BINS);
+    node.leaf = leaves++;
+  }
+  _pdf = std::move(pdf);
+  _cdf = std::move(cdf);
+  _learned = std::vector<std::atomic<float>>(leaves * BINS);
+  _samples = std::vector<std::atomic<std::uint32_t>>(leaves);
+}
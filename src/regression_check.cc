@@ -0,0 +1,513 @@
+#include "camera.hh"
+#include "demo_scene.hh"
+#include "hittable_list.hh"
+#include "image_io.hh"
+#include "scene.hh"
+#include "thread_pool.hh"
+#include "utils.hh"
+#include "vulkan_engine.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Renders a set of scenes with both tracers, checks that they agree with each
+// other and with stored references, and that neither got slower than the
+// throughput recorded on this machine. The references are the same on every
+// machine, the throughput baseline is kept apart from them for each machine.
+//
+// Every render is split into two halves with independent samples. The
+// difference between the halves measures the Monte Carlo noise of the
+// render, so images only fail a comparison if they differ by more than
+// their noise explains. Images are compared after the same gamma and clamp
+// as the PPM output.
+
+namespace {
+constexpr std::uint32_t image_width = 320, image_height = 180, max_depth = 50;
+constexpr int max_portal_hops = 16;
+
+struct TestScene {
+  std::string name;
+  gpu::Scene scene;
+};
+
+struct Render {
+  Image image;
+  // Mean squared error between the two halves of the render.
+  double half_mse;
+  // Per thread for the CPU tracer, so that it does not depend on how many
+  // threads the machine runs.
+  double mrays_per_second;
+};
+
+gpu::Hittable sphere(const glm::vec3 &center, float radius) {
+  return {.kind = gpu::HittableKind::SPHERE,
+          .center = center,
+          .normal = {0, 0, 0},
+          .radius = radius,
+          .material_index = 0};
+}
+
+gpu::Hittable disk(const glm::vec3 &center, const glm::vec3 &normal,
+                   float radius) {
+  return {.kind = gpu::HittableKind::DISK,
+          .center = center,
+          .normal = normal,
+          .radius = radius,
+          .material_index = 0};
+}
+
+gpu::Material material(gpu::MaterialKind kind, const glm::vec3 &color,
+                       float parameter = 0) {
+  return {.kind = kind, .color = color, .parameter = parameter};
+}
+
+// Gives every hittable a material of its own.
+void add(gpu::Scene &scene, gpu::Hittable hittable,
+         const gpu::Material &material) {
+  hittable.material_index = scene.hittables_count;
+  scene.materials[scene.hittables_count] = material;
+  scene.hittables[scene.hittables_count++] = hittable;
+}
+
+void add_portal_pair(gpu::Scene &scene, const glm::vec3 &a_center,
+                     const glm::vec3 &a_normal, const glm::vec3 &b_center,
+                     const glm::vec3 &b_normal, float radius) {
+  add(scene, disk(a_center, a_normal, radius),
+      gpu::Material::from_disk_pair(a_center, a_normal, b_center, b_normal));
+  add(scene, disk(b_center, b_normal, radius),
+      gpu::Material::from_disk_pair(b_center, b_normal, a_center, a_normal));
+}
+
+// A corridor of three walls, floor and ceiling lit by a disk light in the
+// ceiling, so almost all light arrives through light sampling and several
+// diffuse bounces. The walls are spheres so large that they are flat across
+// the view.
+gpu::Scene cornell_scene() {
+  gpu::Scene scene = {};
+  constexpr float wall = 1000;
+  const auto white = material(gpu::LAMBERTIAN, {0.73f, 0.73f, 0.73f});
+  add(scene, sphere({0, -wall, 0}, wall), white);
+  add(scene, sphere({0, 4 + wall, 0}, wall), white);
+  add(scene, sphere({0, 2, -2 - wall}, wall), white);
+  add(scene, sphere({-2 - wall, 2, 0}, wall),
+      material(gpu::LAMBERTIAN, {0.65f, 0.05f, 0.05f}));
+  add(scene, sphere({2 + wall, 2, 0}, wall),
+      material(gpu::LAMBERTIAN, {0.12f, 0.45f, 0.15f}));
+  add(scene, disk({0, 3.99f, 0}, {0, -1, 0}, 0.7f),
+      material(gpu::EMISSIVE, {15, 15, 15}));
+  add(scene, sphere({-0.8f, 0.7f, -0.6f}, 0.7f),
+      material(gpu::DIELECTRIC, {1, 1, 1}, 1.5f));
+  add(scene, sphere({0.9f, 0.6f, 0.5f}, 0.6f),
+      material(gpu::METAL, {0.8f, 0.8f, 0.8f}, 0.1f));
+  scene.camera = {.eye = {0, 2, 9},
+                  .center = {0, 2, 0},
+                  .up = {0, 1, 0},
+                  .vfov = 40,
+                  .defocus_angle = 0,
+                  .focus_dist = 9};
+  return scene;
+}
+
+// One sphere of every material under the sky and a small emitter.
+gpu::Scene materials_scene() {
+  gpu::Scene scene = {};
+  add(scene, sphere({0, -1000, 0}, 1000),
+      material(gpu::LAMBERTIAN, {0.5f, 0.5f, 0.5f}));
+  add(scene, sphere({-2.4f, 0.5f, 0}, 0.5f),
+      material(gpu::LAMBERTIAN, {0.1f, 0.2f, 0.5f}));
+  add(scene, sphere({-1.2f, 0.5f, 0}, 0.5f),
+      material(gpu::METAL, {0.8f, 0.6f, 0.2f}, 0));
+  add(scene, sphere({0, 0.5f, 0}, 0.5f),
+      material(gpu::METAL, {0.8f, 0.8f, 0.8f}, 0.4f));
+  add(scene, sphere({1.2f, 0.5f, 0}, 0.5f),
+      material(gpu::DIELECTRIC, {1, 1, 1}, 1.5f));
+  add(scene, sphere({2.4f, 0.5f, 0}, 0.5f),
+      material(gpu::DIELECTRIC, {1, 1, 1}, 1.33f));
+  add(scene, sphere({0, 2.5f, 1.5f}, 0.3f),
+      material(gpu::EMISSIVE, {12, 10, 8}));
+  scene.camera = {.eye = {0, 1.5f, 7},
+                  .center = {0, 0.5f, 0},
+                  .up = {0, 1, 0},
+                  .vfov = 30,
+                  .defocus_angle = 0,
+                  .focus_dist = 7};
+  return scene;
+}
+
+// A tilted portal pair and a pair that faces itself, so that paths between
+// the latter repeat until their portal hops end them.
+gpu::Scene portals_scene() {
+  gpu::Scene scene = {};
+  add(scene, sphere({0, -1000, 0}, 1000),
+      material(gpu::LAMBERTIAN, {0.4f, 0.5f, 0.4f}));
+  add_portal_pair(scene, {-2, 1, 0}, {0, 0, 1}, {2, 1, -1}, {-1, 0, 0}, 0.9f);
+  add_portal_pair(scene, {0, 1, -4}, {0, 0, 1}, {0, 1, 4}, {0, 0, 1}, 0.8f);
+  add(scene, sphere({0, 0.6f, -1}, 0.6f),
+      material(gpu::METAL, {0.7f, 0.7f, 0.9f}, 0.05f));
+  add(scene, sphere({3, 0.5f, 1}, 0.5f),
+      material(gpu::LAMBERTIAN, {0.8f, 0.3f, 0.1f}));
+  add(scene, sphere({-3, 0.5f, -2}, 0.5f),
+      material(gpu::LAMBERTIAN, {0.1f, 0.3f, 0.8f}));
+  add(scene, sphere({1, 3, 2}, 0.3f), material(gpu::EMISSIVE, {10, 10, 10}));
+  scene.camera = {.eye = {4, 2.5f, 9},
+                  .center = {0, 1, 0},
+                  .up = {0, 1, 0},
+                  .vfov = 35,
+                  .defocus_angle = 0,
+                  .focus_dist = 10};
+  return scene;
+}
+
+std::vector<TestScene> test_scenes() {
+  const auto demo = make_demo_scene();
+  auto demo_portal = demo;
+  // Looks into the destination portal, so most paths pass through both.
+  demo_portal.camera = {.eye = {0, 1.5f, -6},
+                        .center = {0, 1, 2},
+                        .up = {0, 1, 0},
+                        .vfov = 40,
+                        .defocus_angle = 0.0f,
+                        .focus_dist = 8.0f};
+  return {{"demo", demo},
+          {"demo_portal", demo_portal},
+          {"cornell", cornell_scene()},
+          {"materials", materials_scene()},
+          {"portals", portals_scene()}};
+}
+
+float display_value(float linear) {
+  return std::clamp(linear_to_gamma(linear), 0.0f, 1.0f);
+}
+
+double mse(const Image &a, const Image &b) {
+  double sum = 0;
+  for (std::size_t i = 0; i < a.pixels.size(); i++)
+    for (int channel = 0; channel < 3; channel++) {
+      const double difference = display_value(a.pixels[i][channel]) -
+                                display_value(b.pixels[i][channel]);
+      sum += difference * difference;
+    }
+  return sum / (3.0 * a.pixels.size());
+}
+
+double psnr(double mse) {
+  return mse > 0 ? 10 * std::log10(1 / mse)
+                 : std::numeric_limits<double>::infinity();
+}
+
+// Averages the halves and measures the noise between them.
+Render from_halves(const Image &first, const Image &second,
+                   double mrays_per_second) {
+  Render render = {.image = first,
+                   .half_mse = mse(first, second),
+                   .mrays_per_second = mrays_per_second};
+  for (std::size_t i = 0; i < render.image.pixels.size(); i++)
+    render.image.pixels[i] = (first.pixels[i] + second.pixels[i]) * 0.5f;
+  return render;
+}
+
+Render render_cpu(const HittableList &world, const HittableList &lights,
+                  const gpu::Camera &camera, std::uint32_t samples,
+                  ThreadPool &pool) {
+  const auto config =
+      scene_camera_config(camera, image_width, image_height,
+                          static_cast<int>(samples / 2), max_depth,
+                          max_portal_hops);
+  const Camera cpu_camera(config, static_cast<int>(image_height));
+
+  Image halves[2];
+  for (auto &half : halves)
+    half = {.width = image_width,
+            .height = image_height,
+            .pixels = std::vector<glm::vec3>(
+                static_cast<std::size_t>(image_width) * image_height)};
+  std::atomic<std::uint64_t> rays = 0;
+  const auto begin = std::chrono::steady_clock::now();
+  // The second half continues the sample sequences of the first, so the
+  // halves are independent.
+  const auto half_samples =
+      static_cast<std::uint32_t>(config.samples_per_pixel);
+  pool.parallel_for(image_height, [&](std::size_t y) {
+    TraceCounters row_counters = {.rays = 0, .portal_traversals = 0};
+    for (std::uint32_t x = 0; x < image_width; x++)
+      for (std::uint32_t half = 0; half < 2; half++)
+        halves[half].pixels[y * image_width + x] =
+            cpu_camera.trace_pixel(static_cast<int>(y), static_cast<int>(x),
+                                   world, lights, row_counters,
+                                   half * half_samples) /
+            static_cast<float>(half_samples);
+    rays += row_counters.rays;
+  });
+  const auto seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - begin)
+                           .count();
+  return from_halves(halves[0], halves[1],
+                     rays / seconds / 1e6 / static_cast<double>(pool.size()));
+}
+
+// The engine traces samples / 2 samples per render call.
+Render render_gpu(VulkanEngine &engine, const gpu::Scene &scene,
+                  std::uint32_t samples, std::uint32_t &render_call) {
+  const auto render = [&](std::uint32_t read_only, std::uint32_t clear) {
+    engine.render({.read_only = read_only,
+                   .clear = clear,
+                   .number = render_call++,
+                   .total_render_calls = 2,
+                   .total_samples = samples},
+                  scene);
+  };
+  render(1, 1);
+
+  std::vector<glm::vec4> sums[2];
+  double rays = 0, seconds = 0;
+  for (auto &sum : sums) {
+    render(0, 0);
+    // The statistics of a frame are read when the next one starts.
+    render(1, 0);
+    rays += engine.frame_stats().rays;
+    seconds += engine.frame_stats().dispatch_ms * 1e-3;
+    sum = engine.read_summed_image();
+  }
+
+  Image halves[2];
+  for (auto &half : halves)
+    half = {.width = image_width, .height = image_height, .pixels = {}};
+  for (std::size_t i = 0; i < sums[0].size(); i++) {
+    const auto second = sums[1][i] - sums[0][i];
+    halves[0].pixels.push_back(glm::vec3(sums[0][i]) / sums[0][i].w);
+    halves[1].pixels.push_back(glm::vec3(second) / second.w);
+  }
+  return from_halves(halves[0], halves[1],
+                     seconds > 0 ? rays / seconds / 1e6 : 0);
+}
+
+// CSV files of a header line and one key and value per line, empty if
+// filename does not exist.
+std::map<std::string, double> read_values(const std::string &filename) {
+  std::map<std::string, double> values;
+  std::ifstream in(filename);
+  std::string line;
+  std::getline(in, line);
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string key, value;
+    std::getline(fields, key, ',');
+    std::getline(fields, value, ',');
+    values[key] = std::stod(value);
+  }
+  return values;
+}
+
+void write_values(const std::string &filename, const std::string &header,
+                  const std::map<std::string, double> &values) {
+  std::ofstream out(filename);
+  out << header << std::endl;
+  out << std::setprecision(9);
+  for (const auto &[key, value] : values)
+    out << key << "," << value << std::endl;
+}
+
+class Checker {
+public:
+  bool passed = true;
+
+  // Two independent renders with half-render noise h1 and h2 differ by
+  // (h1 + h2) / 4 on average, the noise floor of their PSNR.
+  void compare(const std::string &label, const Image &a, double a_half_mse,
+               const Image &b, double b_half_mse, double max_psnr_drop) {
+    if (a.width != b.width || a.height != b.height) {
+      report(label, "size mismatch", false);
+      return;
+    }
+    const auto value = psnr(mse(a, b)),
+               noise_floor = psnr((a_half_mse + b_half_mse) / 4);
+    std::ostringstream detail;
+    detail << std::fixed << std::setprecision(2) << "PSNR " << value
+           << " dB, noise floor " << noise_floor << " dB";
+    report(label, detail.str(), value >= noise_floor - max_psnr_drop);
+  }
+
+  void compare_throughput(const std::string &label, double mrays_per_second,
+                          double baseline, const std::string &unit,
+                          double max_slowdown) {
+    std::ostringstream detail;
+    detail << std::fixed << std::setprecision(2) << mrays_per_second << " "
+           << unit << ", baseline " << baseline;
+    report(label, detail.str(),
+           mrays_per_second >= baseline * (1 - max_slowdown));
+  }
+
+  void report(const std::string &label, const std::string &detail, bool ok) {
+    passed = passed && ok;
+    print(label, detail, ok ? "ok" : "FAIL");
+  }
+
+  // For checks that cannot run here, which do not fail the run.
+  void skip(const std::string &label, const std::string &detail) {
+    print(label, detail, "skipped");
+  }
+
+private:
+  static void print(const std::string &label, const std::string &detail,
+                    const std::string &result) {
+    std::cout << std::left << std::setw(28) << label << std::setw(48)
+              << detail << result << std::endl;
+  }
+};
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string references = REGRESSION_REFERENCE_DIR, device_name,
+              baseline_file = "regression_baseline.csv";
+  bool update_references = false, update_baseline = false, cpu_only = false;
+  std::uint32_t samples = 64;
+  double max_psnr_drop = 1.0, max_slowdown = 0.25;
+  std::size_t threads = std::thread::hardware_concurrency();
+  for (int arg = 1; arg < argc; arg++) {
+    const std::string option = argv[arg];
+    if (option == "--references" && arg + 1 < argc)
+      references = argv[++arg];
+    else if (option == "--update-references")
+      update_references = true;
+    else if (option == "--baseline" && arg + 1 < argc)
+      baseline_file = argv[++arg];
+    else if (option == "--update-baseline")
+      update_baseline = true;
+    else if (option == "--cpu-only")
+      cpu_only = true;
+    else if (option == "--device" && arg + 1 < argc)
+      device_name = argv[++arg];
+    else if (option == "--samples" && arg + 1 < argc)
+      samples = std::max(std::stoul(argv[++arg]), 2ul);
+    else if (option == "--max-psnr-drop" && arg + 1 < argc)
+      max_psnr_drop = std::stod(argv[++arg]);
+    else if (option == "--max-slowdown" && arg + 1 < argc)
+      max_slowdown = std::stod(argv[++arg]);
+    else if (option == "--threads" && arg + 1 < argc)
+      threads = std::stoul(argv[++arg]);
+    else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--references <dir>] [--update-references]"
+                   " [--baseline <file>] [--update-baseline] [--cpu-only]"
+                   " [--device <name>]"
+                   " [--samples <n>] [--max-psnr-drop <dB>]"
+                   " [--max-slowdown <fraction>] [--threads <n>]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  // Before anything else draws from random_float on this thread, so that the
+  // demo scene is the one the references were rendered from.
+  const auto scenes = test_scenes();
+  ThreadPool pool(threads);
+
+  Settings settings{.window_height = image_height,
+                    .window_width = image_width,
+                    .shader_file = "shader.comp.spv",
+                    .group_size_x = 16,
+                    .group_size_y = 8,
+                    .max_depth = max_depth,
+                    .max_portal_hops = max_portal_hops,
+                    .samples_per_pass = samples / 2,
+                    .auto_tune_group_size = false,
+                    .profile_csv_file = "",
+                    .wavefront_shader_file = "wavefront.comp.spv",
+                    .persistent_shader_file = "persistent.comp.spv",
+                    .persistent_group_count = 0,
+                    .integrator = Integrator::MEGAKERNEL,
+                    .pipeline_cache_file = "regression_check.pipeline_cache",
+                    .resolve_shader_file = "resolve.comp.spv",
+                    .reproject_shader_file = "reproject.comp.spv",
+                    .temporal_reprojection = false,
+                    .reprojection_history_samples = 32,
+                    .preview_frame_ms = 0.0f,
+                    .headless = true,
+                    .device_name = device_name};
+  std::optional<VulkanEngine> engine;
+  if (!cpu_only)
+    engine.emplace(settings);
+  std::uint32_t render_call = 0;
+
+  std::filesystem::create_directories(references);
+  // Noise between the halves of every reference.
+  const auto reference_noise_file = references + "/references.csv";
+  auto reference_noise = read_values(reference_noise_file);
+  // Mrays/s, per thread for the CPU tracer.
+  auto baselines = read_values(baseline_file);
+
+  Checker checker;
+  for (const auto &[name, scene] : scenes) {
+    const auto world = HittableList::from_scene(scene);
+    const auto lights = world.lights();
+    std::map<std::string, Render> renders;
+    renders.emplace("cpu",
+                    render_cpu(world, lights, scene.camera, samples, pool));
+    if (engine) {
+      renders.emplace("gpu", render_gpu(*engine, scene, samples, render_call));
+      checker.compare(name + " cpu/gpu", renders.at("cpu").image,
+                      renders.at("cpu").half_mse, renders.at("gpu").image,
+                      renders.at("gpu").half_mse, max_psnr_drop);
+    }
+
+    // Both tracers are compared against the CPU render.
+    const auto reference_file = references + "/" + name + ".pfm";
+    if (update_references) {
+      write_pfm(reference_file, renders.at("cpu").image);
+      reference_noise[name] = renders.at("cpu").half_mse;
+      checker.report(name, "reference updated", true);
+    }
+    for (const auto &[backend, render] : renders) {
+      const auto key = name + "." + backend;
+      if (update_baseline) {
+        baselines[key] = render.mrays_per_second;
+        checker.report(key, "baseline updated", true);
+      }
+      if (update_references || update_baseline)
+        continue;
+
+      const auto noise = reference_noise.find(name);
+      if (noise == reference_noise.end() ||
+          !std::filesystem::exists(reference_file))
+        checker.report(key, "no reference, run with --update-references",
+                       false);
+      else
+        checker.compare(key + " quality", render.image, render.half_mse,
+                        read_pfm(reference_file), noise->second,
+                        max_psnr_drop);
+      const auto baseline = baselines.find(key);
+      if (baseline == baselines.end())
+        checker.skip(key + " throughput",
+                     "no baseline here, run with --update-baseline");
+      else
+        checker.compare_throughput(
+            key + " throughput", render.mrays_per_second, baseline->second,
+            backend == "cpu" ? "Mrays/s per thread" : "Mrays/s", max_slowdown);
+    }
+  }
+
+  if (update_references)
+    write_values(reference_noise_file, "scene,half_mse", reference_noise);
+  if (update_baseline)
+    write_values(baseline_file, "render,mrays_per_second", baselines);
+  std::cout << (checker.passed ? "All checks passed" : "Some checks failed")
+            << std::endl;
+  return checker.passed ? 0 : 1;
+}
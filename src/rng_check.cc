@@ -0,0 +1,246 @@
+#include "pcg.hh"
+
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/ext/scalar_constants.hpp>
+#include <glm/glm.hpp>
+
+// Statistical checks for the GPU random number generator, run against its
+// host copy in pcg.hh. Every check reduces to a z-score that should stay
+// within a few units for a good generator. The hash-based generator the
+// shaders used before is checked and timed as a reference.
+
+namespace {
+constexpr double max_abs_z = 4.0;
+
+// Former shader/common.glsl generator: five hash rounds over the bits of
+// (pixel, render call, offset) for every number.
+std::uint32_t legacy_hash(std::uint32_t x) {
+  x += (x << 10u);
+  x ^= (x >> 6u);
+  x += (x << 3u);
+  x ^= (x >> 11u);
+  x += (x << 15u);
+  return x;
+}
+
+struct LegacyGenerator {
+  std::uint32_t pixel_x, pixel_y, render_call, offset;
+
+  float next_float() {
+    offset++;
+    const auto bits = [](std::uint32_t value) {
+      return std::bit_cast<std::uint32_t>(static_cast<float>(value));
+    };
+    std::uint32_t m =
+        legacy_hash(bits(pixel_x) ^ legacy_hash(bits(pixel_y)) ^
+                    legacy_hash(bits(render_call)) ^ legacy_hash(bits(offset)));
+    m &= 0x007FFFFFu;
+    m |= 0x3F800000u;
+    return std::bit_cast<float>(m) - 1.0f;
+  }
+};
+
+// Creates the stream of a pixel, render call and stream index.
+using StreamFactory = std::function<std::function<float()>(
+    std::uint32_t, std::uint32_t, std::uint32_t, std::uint32_t)>;
+
+double chi_square_z(const std::vector<std::uint64_t> &bins,
+                    std::uint64_t samples) {
+  const double expected = static_cast<double>(samples) / bins.size();
+  double chi_square = 0;
+  for (const auto count : bins)
+    chi_square += (count - expected) * (count - expected) / expected;
+  const double dof = static_cast<double>(bins.size() - 1);
+  return (chi_square - dof) / std::sqrt(2 * dof);
+}
+
+std::size_t bin_of(double value, std::size_t bin_count) {
+  const auto bin = static_cast<std::size_t>(value * bin_count);
+  return bin < bin_count ? bin : bin_count - 1;
+}
+
+double correlation_z(const std::vector<float> &a, const std::vector<float> &b) {
+  double mean_a = 0, mean_b = 0;
+  for (std::size_t i = 0; i < a.size(); i++) {
+    mean_a += a[i];
+    mean_b += b[i];
+  }
+  mean_a /= a.size();
+  mean_b /= b.size();
+
+  double covariance = 0, variance_a = 0, variance_b = 0;
+  for (std::size_t i = 0; i < a.size(); i++) {
+    covariance += (a[i] - mean_a) * (b[i] - mean_b);
+    variance_a += (a[i] - mean_a) * (a[i] - mean_a);
+    variance_b += (b[i] - mean_b) * (b[i] - mean_b);
+  }
+  const double r = covariance / std::sqrt(variance_a * variance_b);
+  return r * std::sqrt(static_cast<double>(a.size()));
+}
+
+class Checker {
+public:
+  bool passed = true;
+
+  void report(const std::string &generator, const std::string &check,
+              double z) {
+    const bool ok = std::abs(z) <= max_abs_z;
+    passed = passed && ok;
+    std::cout << std::left << std::setw(8) << generator << std::setw(34)
+              << check << std::right << std::setw(10) << std::fixed
+              << std::setprecision(2) << z << (ok ? "  ok" : "  FAIL")
+              << std::endl;
+  }
+};
+
+// Uniformity of one long stream, of consecutive pairs and lag-1 correlation.
+void check_stream(Checker &checker, const std::string &name,
+                  const StreamFactory &make_stream) {
+  constexpr std::uint64_t samples = 1 << 24;
+  auto stream = make_stream(0, 0, 0, 0);
+
+  std::vector<std::uint64_t> bins(1024), pair_bins(64 * 64);
+  std::vector<float> current(samples / 2), next(samples / 2);
+  for (std::uint64_t i = 0; i < samples / 2; i++) {
+    current[i] = stream();
+    next[i] = stream();
+    bins[bin_of(current[i], bins.size())]++;
+    bins[bin_of(next[i], bins.size())]++;
+    pair_bins[bin_of(current[i], 64) * 64 + bin_of(next[i], 64)]++;
+  }
+  checker.report(name, "uniformity (1024 bins)", chi_square_z(bins, samples));
+  checker.report(name, "consecutive pairs (64x64 bins)",
+                 chi_square_z(pair_bins, samples / 2));
+  checker.report(name, "lag-1 correlation", correlation_z(current, next));
+}
+
+// The first numbers of neighbouring pixels and of consecutive render calls
+// must not be related, since every sample starts a fresh stream.
+void check_seeding(Checker &checker, const std::string &name,
+                   const StreamFactory &make_stream) {
+  constexpr std::uint32_t width = 1024, height = 1024;
+  std::vector<float> first(width * height), right(width * height),
+      next_call(width * height), next_stream(width * height);
+  std::vector<std::uint64_t> bins(1024);
+  for (std::uint32_t y = 0; y < height; y++)
+    for (std::uint32_t x = 0; x < width; x++) {
+      const auto index = y * width + x;
+      first[index] = make_stream(x, y, 0, 0)();
+      right[index] = make_stream(x + 1, y, 0, 0)();
+      next_call[index] = make_stream(x, y, 1, 0)();
+      next_stream[index] = make_stream(x, y, 0, 1)();
+      bins[bin_of(first[index], bins.size())]++;
+    }
+  checker.report(name, "first number across pixels",
+                 chi_square_z(bins, first.size()));
+  checker.report(name, "neighbouring pixels", correlation_z(first, right));
+  checker.report(name, "consecutive render calls",
+                 correlation_z(first, next_call));
+  checker.report(name, "consecutive streams",
+                 correlation_z(first, next_stream));
+}
+
+// The rejection-free samplers: z and the azimuth of unit vectors, and the
+// squared radius and angle of disk points must all be uniform.
+void check_samplers(Checker &checker) {
+  constexpr std::uint64_t samples = 1 << 22;
+  auto generator = pcg::Generator::seed(0, 0, 0, 0);
+  const auto angle_of = [](const glm::vec3 &v) {
+    return (std::atan2(v.y, v.x) + glm::pi<float>()) /
+           (2.0f * glm::pi<float>());
+  };
+
+  std::vector<std::uint64_t> z_bins(256), azimuth_bins(256);
+  double max_length_error = 0;
+  for (std::uint64_t i = 0; i < samples; i++) {
+    const auto v = generator.unit_vector();
+    z_bins[bin_of((v.z + 1.0f) / 2.0f, z_bins.size())]++;
+    azimuth_bins[bin_of(angle_of(v), azimuth_bins.size())]++;
+    max_length_error =
+        std::max(max_length_error, std::abs(glm::length(v) - 1.0));
+  }
+  checker.report("pcg", "unit vector z", chi_square_z(z_bins, samples));
+  checker.report("pcg", "unit vector azimuth",
+                 chi_square_z(azimuth_bins, samples));
+  checker.report("pcg", "unit vector length error (x1e5)",
+                 max_length_error * 1e5);
+
+  std::vector<std::uint64_t> radius_bins(256), angle_bins(256);
+  for (std::uint64_t i = 0; i < samples; i++) {
+    const auto p = generator.in_unit_disk();
+    radius_bins[bin_of(glm::dot(p, p), radius_bins.size())]++;
+    angle_bins[bin_of(angle_of(p), angle_bins.size())]++;
+  }
+  checker.report("pcg", "disk squared radius",
+                 chi_square_z(radius_bins, samples));
+  checker.report("pcg", "disk angle", chi_square_z(angle_bins, samples));
+}
+
+template <typename Generator>
+double nanoseconds_per_number(Generator generator) {
+  constexpr std::uint64_t samples = 1 << 26;
+  float sum = 0;
+  const auto begin = std::chrono::steady_clock::now();
+  for (std::uint64_t i = 0; i < samples; i++)
+    sum += generator.next_float();
+  const auto end = std::chrono::steady_clock::now();
+  // Keeps the loop from being optimized away.
+  if (sum < 0)
+    std::cout << sum;
+  return std::chrono::duration<double, std::nano>(end - begin).count() /
+         samples;
+}
+} // namespace
+
+int main() {
+  const StreamFactory pcg_streams = [](std::uint32_t x, std::uint32_t y,
+                                       std::uint32_t render_call,
+                                       std::uint32_t stream) {
+    return std::function<float()>(
+        [generator = pcg::Generator::seed(x, y, render_call,
+                                          stream)]() mutable {
+          return generator.next_float();
+        });
+  };
+  // The legacy generator had no streams, only offsets into one sequence.
+  const StreamFactory legacy_streams = [](std::uint32_t x, std::uint32_t y,
+                                          std::uint32_t render_call,
+                                          std::uint32_t stream) {
+    return std::function<float()>(
+        [generator = LegacyGenerator{x, y, render_call,
+                                     stream * 256}]() mutable {
+          return generator.next_float();
+        });
+  };
+
+  Checker checker;
+  std::cout << "Generator check                                  z"
+            << std::endl;
+  check_stream(checker, "pcg", pcg_streams);
+  check_seeding(checker, "pcg", pcg_streams);
+  check_samplers(checker);
+
+  // The legacy results are informative only and do not fail the check.
+  Checker legacy_checker;
+  check_stream(legacy_checker, "legacy", legacy_streams);
+  check_seeding(legacy_checker, "legacy", legacy_streams);
+
+  std::cout << std::setprecision(3) << "pcg: "
+            << nanoseconds_per_number(pcg::Generator::seed(0, 0, 0, 0))
+            << " ns/number, legacy: "
+            << nanoseconds_per_number(LegacyGenerator{0, 0, 0, 0})
+            << " ns/number" << std::endl;
+
+  std::cout << (checker.passed ? "All checks passed" : "Some checks failed")
+            << std::endl;
+  return checker.passed ? 0 : 1;
+}
@@ -0,0 +1,176 @@
+#include "sampler.hh"
+
+#include "pcg.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <glm/glm.hpp>
+
+namespace {
+float to_float(std::uint32_t bits) {
+  return static_cast<float>(bits >> 8u) * (1.0f / 16777216.0f);
+}
+
+std::uint32_t reverse_bits(std::uint32_t x) {
+  x = ((x >> 1u) & 0x55555555u) | ((x & 0x55555555u) << 1u);
+  x = ((x >> 2u) & 0x33333333u) | ((x & 0x33333333u) << 2u);
+  x = ((x >> 4u) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4u);
+  x = ((x >> 8u) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8u);
+  return (x >> 16u) | (x << 16u);
+}
+
+// Flips every bit depending only on the bits below it, which after reversing
+// the bits is an Owen scramble: every bit depends on the bits above it.
+std::uint32_t laine_karras_permutation(std::uint32_t x, std::uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+std::uint32_t nested_uniform_scramble(std::uint32_t x, std::uint32_t seed) {
+  return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+glm::uvec2 sobol(std::uint32_t index) {
+  const auto first = reverse_bits(index);
+  std::uint32_t second = 0;
+  for (std::uint32_t v = 1u << 31u; index != 0; index >>= 1u, v ^= v >> 1u)
+    if (index & 1u)
+      second ^= v;
+  return {first, second};
+}
+
+// Random permutation of [0, length) picked by seed (Kensler 2013).
+std::uint32_t permute(std::uint32_t i, std::uint32_t length,
+                      std::uint32_t seed) {
+  std::uint32_t w = length - 1;
+  w |= w >> 1u;
+  w |= w >> 2u;
+  w |= w >> 4u;
+  w |= w >> 8u;
+  w |= w >> 16u;
+  do {
+    i ^= seed;
+    i *= 0xe170893du;
+    i ^= seed >> 16u;
+    i ^= (i & w) >> 4u;
+    i ^= seed >> 8u;
+    i *= 0x0929eb3fu;
+    i ^= seed >> 23u;
+    i ^= (i & w) >> 1u;
+    i *= 1u | seed >> 27u;
+    i *= 0x6935fa69u;
+    i ^= (i & w) >> 11u;
+    i *= 0x74dcb303u;
+    i ^= (i & w) >> 2u;
+    i *= 0x9e501cc3u;
+    i ^= (i & w) >> 2u;
+    i *= 0xc860a3dfu;
+    i &= w;
+    i ^= i >> 5u;
+  } while (i >= length);
+  return (i + seed) % length;
+}
+
+std::uint32_t morton(glm::uvec2 pixel) {
+  std::uint32_t index = 0;
+  for (std::uint32_t bit = 0; bit < 16; bit++)
+    index |= ((pixel.x >> bit) & 1u) << (2 * bit) |
+             ((pixel.y >> bit) & 1u) << (2 * bit + 1);
+  return index;
+}
+
+std::uint32_t dimension_seed(glm::uvec2 pixel, std::uint32_t dimension) {
+  return pcg::hash(pixel.x ^ pcg::hash(pixel.y ^ pcg::hash(dimension)));
+}
+} // namespace
+
+SamplerKind sampler_kind_from_name(const std::string &name) {
+  if (name == "independent")
+    return SamplerKind::INDEPENDENT;
+  if (name == "stratified")
+    return SamplerKind::STRATIFIED;
+  if (name == "sobol")
+    return SamplerKind::SOBOL;
+  if (name == "blue-noise")
+    return SamplerKind::BLUE_NOISE;
+  throw std::runtime_error("Unknown sampler: " + name);
+}
+
+Sampler::Sampler(std::uint32_t samples_per_pixel)
+    : _samples_per_pixel(std::max(samples_per_pixel, 1u)) {}
+
+std::unique_ptr<Sampler> Sampler::create(SamplerKind kind,
+                                         std::uint32_t samples_per_pixel) {
+  switch (kind) {
+  case SamplerKind::INDEPENDENT:
+    return std::make_unique<IndependentSampler>(samples_per_pixel);
+  case SamplerKind::STRATIFIED:
+    return std::make_unique<StratifiedSampler>(samples_per_pixel);
+  case SamplerKind::SOBOL:
+    return std::make_unique<SobolSampler>(samples_per_pixel);
+  case SamplerKind::BLUE_NOISE:
+    return std::make_unique<BlueNoiseSampler>(samples_per_pixel);
+  }
+  throw std::runtime_error("Unknown sampler kind");
+}
+
+void Sampler::start_sample(std::uint32_t x, std::uint32_t y,
+                           std::uint32_t sample_index) {
+  _pixel = {x, y};
+  _sample_index = sample_index;
+}
+
+glm::vec2 Sampler::get_bounce_2d(int depth, std::uint32_t dimension) {
+  return get_2d(FIRST_BOUNCE_DIMENSION +
+                DIMENSIONS_PER_BOUNCE * static_cast<std::uint32_t>(depth) +
+                dimension);
+}
+
+glm::vec2 IndependentSampler::get_2d(std::uint32_t dimension) {
+  const auto bits =
+      pcg::hash(dimension_seed(_pixel, dimension) ^ pcg::hash(_sample_index));
+  return {to_float(bits), to_float(pcg::hash(bits))};
+}
+
+// Uses the largest grid with at most samples_per_pixel cells. Samples past
+// the number of cells visit them again in the same order.
+glm::vec2 StratifiedSampler::get_2d(std::uint32_t dimension) {
+  const auto columns = static_cast<std::uint32_t>(
+                 std::sqrt(static_cast<float>(_samples_per_pixel))),
+             rows = _samples_per_pixel / columns, cells = columns * rows;
+  const auto seed = dimension_seed(_pixel, dimension);
+  const auto stratum = permute(_sample_index % cells, cells, seed);
+  const auto jitter = pcg::hash(seed ^ pcg::hash(_sample_index));
+  return {(static_cast<float>(stratum % columns) + to_float(jitter)) /
+              static_cast<float>(columns),
+          (static_cast<float>(stratum / columns) +
+           to_float(pcg::hash(jitter))) /
+              static_cast<float>(rows)};
+}
+
+glm::vec2 SobolSampler::_owen_sobol(std::uint32_t index, std::uint32_t seed) {
+  const auto point = sobol(nested_uniform_scramble(index, seed));
+  return {to_float(nested_uniform_scramble(point.x, pcg::hash(seed ^ 1u))),
+          to_float(nested_uniform_scramble(point.y, pcg::hash(seed ^ 2u)))};
+}
+
+glm::vec2 SobolSampler::get_2d(std::uint32_t dimension) {
+  return _owen_sobol(_sample_index, dimension_seed(_pixel, dimension));
+}
+
+glm::vec2 BlueNoiseSampler::get_2d(std::uint32_t dimension) {
+  const auto sample_bits =
+      static_cast<std::uint32_t>(std::bit_width(_samples_per_pixel - 1));
+  return _owen_sobol((morton(_pixel) << sample_bits) + _sample_index,
+                     pcg::hash(dimension));
+}
@@ -0,0 +1,168 @@
+#include "camera.hh"
+#include "demo_scene.hh"
+#include "hittable_list.hh"
+#include "sampler.hh"
+#include "scene.hh"
+#include "thread_pool.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Renders the demo scene on the CPU with every sampler at 1, 2, 4, ... samples
+// per pixel and prints the error against a reference as CSV, one convergence
+// curve per sampler, followed by the slope of each curve on a log-log scale.
+// Independent samples converge with a slope of -0.5.
+//
+// Besides the RMSE it prints the RMSE of the error after a 3x3 box blur,
+// which is what remains of the error at viewing distance: error spread as
+// blue noise mostly cancels out in the blur.
+
+namespace {
+constexpr std::uint32_t image_width = 200, image_height = 112, max_depth = 50;
+constexpr int max_portal_hops = 16;
+// The reference's samples are numbered from here, far past any that the
+// samplers under test use.
+constexpr std::uint32_t reference_first_sample = 1u << 31;
+
+struct Error {
+  double rmse;
+  double blurred_rmse;
+};
+
+float display_value(float linear) {
+  return std::clamp(linear_to_gamma(linear), 0.0f, 1.0f);
+}
+
+// Samples number first_sample and on of every pixel.
+std::vector<glm::vec3> render(const gpu::Camera &camera, SamplerKind sampler,
+                              std::uint32_t samples,
+                              std::uint32_t first_sample,
+                              const HittableList &world,
+                              const HittableList &lights, ThreadPool &pool) {
+  auto config = scene_camera_config(camera, image_width, image_height,
+                                    static_cast<int>(samples), max_depth,
+                                    max_portal_hops);
+  config.sampler = sampler;
+  const Camera cpu_camera(config, static_cast<int>(image_height));
+
+  std::vector<glm::vec3> image(static_cast<std::size_t>(image_width) *
+                               image_height);
+  pool.parallel_for(image_height, [&](std::size_t y) {
+    TraceCounters counters = {.rays = 0, .portal_traversals = 0};
+    for (std::uint32_t x = 0; x < image_width; x++) {
+      const auto color =
+          cpu_camera.trace_pixel(static_cast<int>(y), static_cast<int>(x),
+                                 world, lights, counters, first_sample) /
+          static_cast<float>(samples);
+      for (int channel = 0; channel < 3; channel++)
+        image[y * image_width + x][channel] = display_value(color[channel]);
+    }
+  });
+  return image;
+}
+
+Error error(const std::vector<glm::vec3> &image,
+            const std::vector<glm::vec3> &reference) {
+  std::vector<glm::vec3> difference(image.size());
+  for (std::size_t i = 0; i < image.size(); i++)
+    difference[i] = image[i] - reference[i];
+
+  double sum = 0, blurred_sum = 0;
+  for (std::uint32_t y = 0; y < image_height; y++)
+    for (std::uint32_t x = 0; x < image_width; x++) {
+      const auto &pixel = difference[y * image_width + x];
+      sum += glm::dot(pixel, pixel);
+
+      auto blurred = glm::vec3(0);
+      float count = 0;
+      for (std::uint32_t ny = std::max(y, 1u) - 1;
+           ny <= std::min(y + 1, image_height - 1); ny++)
+        for (std::uint32_t nx = std::max(x, 1u) - 1;
+             nx <= std::min(x + 1, image_width - 1); nx++) {
+          blurred += difference[ny * image_width + nx];
+          count++;
+        }
+      blurred /= count;
+      blurred_sum += glm::dot(blurred, blurred);
+    }
+  const auto values = 3.0 * image.size();
+  return {.rmse = std::sqrt(sum / values),
+          .blurred_rmse = std::sqrt(blurred_sum / values)};
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  std::uint32_t max_samples = 64, reference_samples = 4096;
+  std::size_t threads = std::thread::hardware_concurrency();
+  for (int arg = 1; arg < argc; arg++) {
+    const std::string option = argv[arg];
+    if (option == "--max-samples" && arg + 1 < argc)
+      max_samples = std::stoul(argv[++arg]);
+    else if (option == "--reference-samples" && arg + 1 < argc)
+      reference_samples = std::stoul(argv[++arg]);
+    else if (option == "--threads" && arg + 1 < argc)
+      threads = std::stoul(argv[++arg]);
+    else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--max-samples <n>] [--reference-samples <n>]"
+                   " [--threads <n>]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  const auto scene = make_demo_scene();
+  const auto world = HittableList::from_scene(scene);
+  const auto lights = world.lights();
+  ThreadPool pool(std::max<std::size_t>(threads, 1));
+
+  // Independent samples from past the ones under test. Starting at 0, the
+  // independent sampler would repeat the reference's first samples.
+  const auto reference =
+      render(scene.camera, SamplerKind::INDEPENDENT, reference_samples,
+             reference_first_sample, world, lights, pool);
+
+  const std::pair<std::string, SamplerKind> samplers[] = {
+      {"independent", SamplerKind::INDEPENDENT},
+      {"stratified", SamplerKind::STRATIFIED},
+      {"sobol", SamplerKind::SOBOL},
+      {"blue_noise", SamplerKind::BLUE_NOISE},
+  };
+  std::vector<std::pair<std::string, double>> slopes;
+  std::cout << "sampler,spp,rmse,blurred_rmse" << std::endl;
+  for (const auto &[name, kind] : samplers) {
+    // Least squares fit of log(rmse) over log(spp).
+    double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+    int points = 0;
+    for (std::uint32_t samples = 1; samples <= max_samples; samples *= 2) {
+      const auto result = error(
+          render(scene.camera, kind, samples, 0, world, lights, pool),
+          reference);
+      std::cout << name << "," << samples << "," << result.rmse << ","
+                << result.blurred_rmse << std::endl;
+      const auto x = std::log(static_cast<double>(samples)),
+                 y = std::log(result.rmse);
+      sum_x += x;
+      sum_y += y;
+      sum_xx += x * x;
+      sum_xy += x * y;
+      points++;
+    }
+    slopes.emplace_back(name, (points * sum_xy - sum_x * sum_y) /
+                                  (points * sum_xx - sum_x * sum_x));
+  }
+
+  std::cout << std::endl << "sampler,slope" << std::endl;
+  for (const auto &[name, slope] : slopes)
+    std::cout << name << "," << slope << std::endl;
+}
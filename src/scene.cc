@@ -1,5 +1,6 @@
 #include "scene.hh"
 
+#include <cstdint>
 #include <stdexcept>
 
 #include <glm/glm.hpp>
@@ -9,13 +10,8 @@
 gpu::Material gpu::Material::from_disk_pair(
     const glm::vec3 &source_origin, const glm::vec3 &source_normal,
     const glm::vec3 &destination_origin, const glm::vec3 &destination_normal) {
-  const auto translate_mat_before =
-      glm::translate(glm::mat4(1), -source_origin);
-  const auto translate_mat_after =
-      glm::translate(glm::mat4(1), destination_origin);
-  const auto displacement = destination_origin - source_origin,
-             axis =
-                 glm::normalize(glm::cross(source_normal, destination_normal));
+  const auto axis =
+      glm::normalize(glm::cross(source_normal, destination_normal));
   const auto angle = std::acos(glm::dot(glm::normalize(source_normal),
                                         glm::normalize(destination_normal)));
   auto rotation_mat = glm::rotate(glm::mat4(1), angle, axis);
@@ -31,8 +27,25 @@ gpu::Material gpu::Material::from_disk_pair(
       throw std::invalid_argument("invalid angle");
   }
 
+  // Same as translating by -source_origin, rotating and translating by
+  // destination_origin.
+  const glm::mat3 rotation(rotation_mat);
   return {.kind = gpu::MaterialKind::PORTAL,
-          .translation_mat1 = translate_mat_before,
-          .translation_mat2 = translate_mat_after,
-          .rotation_mat = rotation_mat};
+          .rotation = glm::mat3x4(rotation),
+          .translation = destination_origin - rotation * source_origin};
+}
+
+std::uint32_t gpu::Scene::material_kinds() const {
+  std::uint32_t kinds = 0;
+  for (std::uint32_t i = 0; i < hittables_count; i++)
+    kinds |= 1u << materials[hittables[i].material_index].kind;
+  return kinds;
+}
+
+gpu::LightList gpu::Scene::lights() const {
+  LightList lights = {};
+  for (std::uint32_t i = 0; i < hittables_count; i++)
+    if (materials[hittables[i].material_index].kind == MaterialKind::EMISSIVE)
+      lights.indices[lights.count++] = i;
+  return lights;
 }
@@ -1,14 +1,18 @@
 #include "sphere.hh"
 
+#include "aabb.hh"
 #include "hittable.hh"
 #include "interval.hh"
 #include "material.hh"
 #include "ray.hh"
+#include "utils.hh"
 
+#include <algorithm>
 #include <cmath>
 #include <memory>
 #include <optional>
 
+#include <glm/ext/scalar_constants.hpp>
 #include <glm/glm.hpp>
 
 Sphere::Sphere(const glm::vec3 &center, float radius,
@@ -37,3 +41,39 @@ std::optional<HitRecord> Sphere::hit(const Ray &ray, Interval ray_t) const {
   const auto outward_normal = (point - center) / radius;
   return HitRecord(ray, outward_normal, root, material);
 }
+
+namespace {
+// 1 - cos of the half angle of the cone that a sphere of radius subtends
+// from to_center away. 1 - sqrt(1 - s) cancels to 0 for small or distant
+// spheres, s / (1 + sqrt(1 - s)) does not.
+float cone_height(float radius, const glm::vec3 &to_center) {
+  const auto s = std::min(radius * radius / glm::dot(to_center, to_center),
+                          1.0f);
+  return s / (1 + std::sqrt(1 - s));
+}
+} // namespace
+
+// Directions are drawn uniformly from the cone the sphere subtends.
+float Sphere::pdf_value(const glm::vec3 &origin,
+                        const glm::vec3 &direction) const {
+  if (!hit(Ray(origin, direction), Interval(0.001f, INFINITY)).has_value())
+    return 0;
+
+  return 1 / (2 * glm::pi<float>() * cone_height(radius, center - origin));
+}
+
+glm::vec3 Sphere::random(const glm::vec3 &origin, const glm::vec2 &u) const {
+  const auto to_center = center - origin;
+  const auto height = u.x * cone_height(radius, to_center), z = 1 - height,
+             phi = 2 * glm::pi<float>() * u.y,
+             r = std::sqrt(std::max(height * (2 - height), 0.0f));
+  const auto w = glm::normalize(to_center);
+  const auto [tangent, bitangent] = orthonormal_basis(w);
+  return r * std::cos(phi) * tangent + r * std::sin(phi) * bitangent + z * w;
+}
+
+bool Sphere::is_emissive() const { return material->is_emissive(); }
+
+Aabb Sphere::bounding_box() const {
+  return {center - glm::vec3(radius), center + glm::vec3(radius)};
+}
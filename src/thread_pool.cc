@@ -0,0 +1,63 @@
+#include "thread_pool.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+ThreadPool::ThreadPool(std::size_t thread_count) {
+  for (std::size_t i = 0; i < std::max<std::size_t>(thread_count, 1); i++)
+    _workers.emplace_back(&ThreadPool::_work, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(_mutex);
+    _stopping = true;
+  }
+  _job_ready.notify_all();
+  for (auto &worker : _workers)
+    worker.join();
+}
+
+void ThreadPool::_work(std::size_t worker) {
+  std::uint64_t finished_generation = 0;
+  while (true) {
+    std::unique_lock lock(_mutex);
+    _job_ready.wait(lock, [&] {
+      return _stopping || _job_generation != finished_generation;
+    });
+    if (_stopping)
+      return;
+    finished_generation = _job_generation;
+    lock.unlock();
+
+    _job(worker);
+
+    lock.lock();
+    if (--_running_workers == 0)
+      _job_done.notify_all();
+  }
+}
+
+std::size_t ThreadPool::size() const { return _workers.size(); }
+
+void ThreadPool::run(const std::function<void(std::size_t)> &job) {
+  std::unique_lock lock(_mutex);
+  _job = job;
+  _running_workers = _workers.size();
+  _job_generation++;
+  _job_ready.notify_all();
+  _job_done.wait(lock, [&] { return _running_workers == 0; });
+}
+
+void ThreadPool::parallel_for(std::size_t count,
+                              const std::function<void(std::size_t)> &body) {
+  std::atomic<std::size_t> next_index = 0;
+  run([&](std::size_t) {
+    for (auto index = next_index++; index < count; index = next_index++)
+      body(index);
+  });
+}
@@ -0,0 +1,77 @@
+#include "tile_scheduler.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+TileScheduler::TileScheduler(std::uint32_t image_width,
+                             std::uint32_t image_height,
+                             std::uint32_t tile_size) {
+  for (std::uint32_t y = 0; y < image_height; y += tile_size)
+    for (std::uint32_t x = 0; x < image_width; x += tile_size)
+      _tiles.push_back({
+          .x = x,
+          .y = y,
+          .width = std::min(tile_size, image_width - x),
+          .height = std::min(tile_size, image_height - y),
+      });
+}
+
+std::vector<Tile> TileScheduler::take_gpu_batch(double target_seconds) {
+  std::lock_guard lock(_mutex);
+  const auto remaining = _tiles.size() - _next_tile;
+  if (remaining == 0)
+    return {};
+
+  std::size_t batch_size = _first_gpu_batch;
+  if (_gpu_seconds > 0)
+    batch_size = static_cast<std::size_t>(target_seconds * _gpu_tiles /
+                                          _gpu_seconds);
+  batch_size = std::clamp<std::size_t>(batch_size, 1, remaining);
+
+  std::vector<Tile> batch(_tiles.begin() + _next_tile,
+                          _tiles.begin() + _next_tile + batch_size);
+  _next_tile += batch_size;
+  return batch;
+}
+
+std::optional<Tile> TileScheduler::take_cpu_tile() {
+  std::lock_guard lock(_mutex);
+  if (_next_tile == _tiles.size())
+    return std::nullopt;
+
+  // Leaving the tail to the GPU keeps it from waiting on a slow CPU tile.
+  if (_gpu_tiles > 0 && _cpu_tiles > 0) {
+    const auto remaining = static_cast<double>(_tiles.size() - _next_tile);
+    if (remaining * _gpu_seconds / _gpu_tiles < _cpu_seconds / _cpu_tiles)
+      return std::nullopt;
+  }
+  return _tiles[_next_tile++];
+}
+
+void TileScheduler::report_gpu(std::size_t tiles, double seconds) {
+  std::lock_guard lock(_mutex);
+  _gpu_tiles += tiles;
+  _gpu_seconds += seconds;
+}
+
+void TileScheduler::report_cpu(double seconds) {
+  std::lock_guard lock(_mutex);
+  _cpu_tiles++;
+  _cpu_seconds += seconds;
+}
+
+std::size_t TileScheduler::tile_count() const { return _tiles.size(); }
+
+std::size_t TileScheduler::gpu_tiles() {
+  std::lock_guard lock(_mutex);
+  return _gpu_tiles;
+}
+
+std::size_t TileScheduler::cpu_tiles() {
+  std::lock_guard lock(_mutex);
+  return _cpu_tiles;
+}
@@ -0,0 +1,82 @@
+#include "time_budget.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace {
+double luminance(const glm::vec3 &color) {
+  return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+} // namespace
+
+TimeBudget::TimeBudget(double seconds)
+    : _begin(std::chrono::steady_clock::now()), _pass_begin(_begin),
+      _seconds(seconds) {}
+
+void TimeBudget::set_reserve(double seconds) { _reserve_seconds = seconds; }
+
+std::uint32_t TimeBudget::next_pass(std::uint32_t max_samples) {
+  auto samples = std::min(_next_pass_samples, max_samples);
+  if (_traced_samples > 0) {
+    const auto fitting = (_seconds - _reserve_seconds - elapsed_seconds()) /
+                         seconds_per_sample();
+    samples = static_cast<std::uint32_t>(
+        std::clamp(fitting, 0.0, static_cast<double>(samples)));
+  }
+  _pass_samples = samples;
+  _pass_begin = std::chrono::steady_clock::now();
+  return samples;
+}
+
+void TimeBudget::finish_pass() {
+  _traced_seconds += std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - _pass_begin)
+                         .count();
+  _traced_samples += _pass_samples;
+  _next_pass_samples = std::min(_next_pass_samples * 2, 1u << 30);
+}
+
+double TimeBudget::elapsed_seconds() const {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       _begin)
+      .count();
+}
+
+double TimeBudget::seconds_per_sample() const {
+  return _traced_samples > 0 ? _traced_seconds / _traced_samples : 0;
+}
+
+PassVariance::PassVariance(std::size_t pixel_count)
+    : _sums(pixel_count, 0.0), _weighted_squares(pixel_count, 0.0),
+      _passes(pixel_count, 0), _samples(pixel_count, 0) {}
+
+void PassVariance::add(std::size_t pixel, const glm::vec3 &pass_sum,
+                       std::uint32_t pass_samples) {
+  if (pass_samples == 0)
+    return;
+  const auto sum = luminance(pass_sum);
+  _sums[pixel] += sum;
+  _weighted_squares[pixel] += sum * sum / pass_samples;
+  _passes[pixel]++;
+  _samples[pixel] += pass_samples;
+}
+
+double PassVariance::rms_error() const {
+  double total = 0;
+  std::size_t pixels = 0;
+  for (std::size_t i = 0; i < _sums.size(); i++) {
+    if (_passes[i] < 2)
+      continue;
+    const auto squares = std::max(
+        _weighted_squares[i] - _sums[i] * _sums[i] / _samples[i], 0.0);
+    total += squares / (_passes[i] - 1) / _samples[i];
+    pixels++;
+  }
+  return pixels > 0 ? std::sqrt(total / static_cast<double>(pixels)) : 0;
+}
@@ -0,0 +1,36 @@
+#include "viewport.hh"
+
+#include <cmath>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+gpu::Viewport gpu::Viewport::from_camera(const Camera &camera,
+                                         std::uint32_t image_width,
+                                         std::uint32_t image_height) {
+  const auto theta = glm::radians(camera.vfov), h = std::tan(theta / 2),
+             viewport_height = 2.0f * h * camera.focus_dist,
+             viewport_width = viewport_height *
+                              (static_cast<float>(image_width) / image_height);
+  const auto w = glm::normalize(camera.eye - camera.center),
+             u = glm::normalize(glm::cross(camera.up, w)),
+             v = glm::cross(w, u), viewport_u = viewport_width * u,
+             viewport_v = -viewport_height * v,
+             viewport_upper_left = camera.eye - (camera.focus_dist * w) -
+                                   viewport_u / 2.0f - viewport_v / 2.0f;
+  const auto pixel_delta_u = viewport_u / static_cast<float>(image_width),
+             pixel_delta_v = viewport_v / static_cast<float>(image_height);
+  const auto defocus_radius =
+      camera.focus_dist * std::tan(glm::radians(camera.defocus_angle / 2));
+
+  return {
+      .eye = camera.eye,
+      .pixel00_location =
+          viewport_upper_left + 0.5f * (pixel_delta_u + pixel_delta_v),
+      .pixel_delta_u = pixel_delta_u,
+      .pixel_delta_v = pixel_delta_v,
+      .defocus_disk_u = defocus_radius * u,
+      .defocus_disk_v = defocus_radius * v,
+      .defocus = camera.defocus_angle > 0.0f,
+  };
+}
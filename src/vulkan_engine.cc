@@ -1,15 +1,20 @@
 #include "vulkan_engine.hh"
 
+#include "embedded_shaders.hh"
 #include "scene.hh"
 
 #include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <iterator>
 #include <limits>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 #define VULKAN_HPP_NO_CONSTRUCTORS
@@ -31,22 +36,6 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_vulkan.h>
 
-std::uint32_t VulkanEngine::_find_memory_type_index(
-    std::uint32_t memory_type_bits, const vk::MemoryPropertyFlags &properties) {
-  vk::PhysicalDeviceMemoryProperties memory_properties =
-      _selected_dev.getMemoryProperties();
-
-  for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
-    if ((memory_type_bits & (1 << i)) &&
-        (memory_properties.memoryTypes[i].propertyFlags & properties) ==
-            properties) {
-      return i;
-    }
-  }
-
-  throw std::runtime_error("Unable to find suitable memory type!");
-}
-
 VulkanBuffer VulkanEngine::_create_buffer(
     const vk::DeviceSize &size, const vk::Flags<vk::BufferUsageFlagBits> &usage,
     const vk::Flags<vk::MemoryPropertyFlagBits> &memory_property) {
@@ -58,21 +47,13 @@ VulkanBuffer VulkanEngine::_create_buffer(
 
   vk::Buffer buffer = _device.createBuffer(buffer_createInfo);
 
-  vk::MemoryRequirements memory_requirements =
-      _device.getBufferMemoryRequirements(buffer);
-
-  vk::MemoryAllocateInfo allocate_info{
-      .allocationSize = memory_requirements.size,
-      .memoryTypeIndex = _find_memory_type_index(
-          memory_requirements.memoryTypeBits, memory_property)};
-
-  vk::DeviceMemory memory = _device.allocateMemory(allocate_info);
-
-  _device.bindBufferMemory(buffer, memory, 0);
+  const auto allocation = _allocator->allocate(
+      _device.getBufferMemoryRequirements(buffer), memory_property);
+  _device.bindBufferMemory(buffer, allocation.memory, allocation.offset);
 
   return {
       .buffer = buffer,
-      .memory = memory,
+      .allocation = allocation,
   };
 }
 
@@ -112,22 +93,13 @@ VulkanEngine::_create_image(const vk::Format &format,
 
   vk::Image image = _device.createImage(image_create_info);
 
-  vk::MemoryRequirements memory_requirements =
-      _device.getImageMemoryRequirements(image);
-
-  vk::MemoryAllocateInfo alloc_info{
-      .allocationSize = memory_requirements.size,
-      .memoryTypeIndex =
-          _find_memory_type_index(memory_requirements.memoryTypeBits,
-                                  vk::MemoryPropertyFlagBits::eDeviceLocal),
-  };
-
-  vk::DeviceMemory memory = _device.allocateMemory(alloc_info);
-
-  _device.bindImageMemory(image, memory, 0);
+  const auto allocation =
+      _allocator->allocate(_device.getImageMemoryRequirements(image),
+                           vk::MemoryPropertyFlagBits::eDeviceLocal);
+  _device.bindImageMemory(image, allocation.memory, allocation.offset);
 
   return {.image = image,
-          .memory = memory,
+          .allocation = allocation,
           .view = _create_image_view(image, format)};
 }
 
@@ -146,6 +118,81 @@ std::vector<char> VulkanEngine::_read_binary_file(const std::string &filename) {
   return buffer;
 }
 
+vk::ShaderModule
+VulkanEngine::_create_shader_module(const std::string &filename) {
+#ifdef GPU_TRACER_EMBED_SHADERS
+  const auto embedded_code = find_embedded_shader(filename);
+  if (!embedded_code.empty())
+    return _device.createShaderModule({.codeSize = embedded_code.size_bytes(),
+                                       .pCode = embedded_code.data()});
+#endif
+
+  std::string path = filename;
+#ifdef GPU_TRACER_SHADER_DIR
+  // Shaders compiled by the build end up next to the executable.
+  if (!std::filesystem::exists(path))
+    path = std::string(GPU_TRACER_SHADER_DIR) + "/" + filename;
+#endif
+  std::vector<char> shader_code = _read_binary_file(path);
+
+  vk::ShaderModuleCreateInfo shader_module_create_info = {
+      .codeSize = shader_code.size(),
+      .pCode = reinterpret_cast<const uint32_t *>(shader_code.data())};
+
+  return _device.createShaderModule(shader_module_create_info);
+}
+
+// Every compute shader shares the specialization constants 0 to 6 (workgroup
+// size, maximum depth, samples per pass, the scene's material kinds, the
+// sampler and the portal hop budget), stage_constants are appended.
+vk::Pipeline VulkanEngine::_create_compute_pipeline(
+    const vk::ShaderModule &module, std::uint32_t group_size_x,
+    std::uint32_t group_size_y,
+    const std::vector<SpecializationConstant> &stage_constants) {
+  std::vector<SpecializationConstant> constants = {
+      {.id = 0, .value = group_size_x},
+      {.id = 1, .value = group_size_y},
+      {.id = 2, .value = _settings.max_depth},
+      {.id = 3, .value = _settings.samples_per_pass},
+      {.id = 4, .value = _material_kinds},
+      {.id = 5, .value = static_cast<std::uint32_t>(_settings.sampler)},
+      {.id = 6, .value = _settings.max_portal_hops},
+  };
+  constants.insert(constants.end(), stage_constants.begin(),
+                   stage_constants.end());
+
+  std::vector<vk::SpecializationMapEntry> map_entries;
+  std::vector<std::uint32_t> values;
+  for (const auto &constant : constants) {
+    map_entries.push_back({
+        .constantID = constant.id,
+        .offset = static_cast<std::uint32_t>(values.size() *
+                                             sizeof(std::uint32_t)),
+        .size = sizeof(std::uint32_t),
+    });
+    values.push_back(constant.value);
+  }
+  const vk::SpecializationInfo specialization_info = {
+      .mapEntryCount = static_cast<uint32_t>(map_entries.size()),
+      .pMapEntries = map_entries.data(),
+      .dataSize = values.size() * sizeof(std::uint32_t),
+      .pData = values.data(),
+  };
+
+  vk::PipelineShaderStageCreateInfo shader_stage = {
+      .stage = vk::ShaderStageFlagBits::eCompute,
+      .module = module,
+      .pName = "main",
+      .pSpecializationInfo = &specialization_info,
+  };
+
+  vk::ComputePipelineCreateInfo pipeline_create_info = {
+      .stage = shader_stage, .layout = _pipeline_layout};
+
+  return _device.createComputePipeline(_pipeline_cache, pipeline_create_info)
+      .value;
+}
+
 vk::ImageMemoryBarrier VulkanEngine::_image_pipeline_barrier(
     const vk::AccessFlagBits &src_flags, const vk::AccessFlagBits &dst_flags,
     const vk::ImageLayout &old_layout, const vk::ImageLayout &new_layout,
@@ -172,12 +219,45 @@ vk::ImageMemoryBarrier VulkanEngine::_image_pipeline_barrier(
 void VulkanEngine::_destroy_image(const VulkanImage &image) const {
   _device.destroyImageView(image.view);
   _device.destroyImage(image.image);
-  _device.freeMemory(image.memory);
+  _allocator->free(image.allocation);
 }
 
 void VulkanEngine::_destroy_buffer(const VulkanBuffer &buffer) const {
   _device.destroyBuffer(buffer.buffer);
-  _device.freeMemory(buffer.memory);
+  _allocator->free(buffer.allocation);
+}
+
+void VulkanEngine::_memory_barrier(const vk::PipelineStageFlags &src_stages,
+                                   const vk::AccessFlags &src_access,
+                                   const vk::PipelineStageFlags &dst_stages,
+                                   const vk::AccessFlags &dst_access) const {
+  const vk::MemoryBarrier barrier{
+      .srcAccessMask = src_access,
+      .dstAccessMask = dst_access,
+  };
+  _command_buffer.pipelineBarrier(src_stages, dst_stages, {}, barrier, nullptr,
+                                  nullptr);
+}
+
+void VulkanEngine::_compute_memory_barrier() const {
+  _memory_barrier(vk::PipelineStageFlagBits::eComputeShader,
+                  vk::AccessFlagBits::eShaderWrite,
+                  vk::PipelineStageFlagBits::eComputeShader |
+                      vk::PipelineStageFlagBits::eDrawIndirect,
+                  vk::AccessFlagBits::eShaderRead |
+                      vk::AccessFlagBits::eShaderWrite |
+                      vk::AccessFlagBits::eIndirectCommandRead);
+}
+
+void VulkanEngine::_dispatch_pixels(std::uint32_t group_size_x,
+                                    std::uint32_t group_size_y,
+                                    std::uint32_t pixel_stride) const {
+  _command_buffer.dispatch(
+      static_cast<uint32_t>(std::ceil(float(_settings.window_width) /
+                                      float(group_size_x * pixel_stride))),
+      static_cast<uint32_t>(std::ceil(float(_settings.window_height) /
+                                      float(group_size_y * pixel_stride))),
+      1);
 }
 
 void VulkanEngine::_create_window() {
@@ -217,27 +297,29 @@ void VulkanEngine::_create_instance() {
       .apiVersion = VK_API_VERSION_1_3,
   };
 
-  std::uint32_t window_extension_count;
-  const char **window_extension_names =
-      glfwGetRequiredInstanceExtensions(&window_extension_count);
   std::vector<const char *> enabled_extensions;
-  enabled_extensions.insert(enabled_extensions.end(), window_extension_names,
-                            window_extension_names + window_extension_count);
+  if (!_settings.headless) {
+    std::uint32_t window_extension_count;
+    const char **window_extension_names =
+        glfwGetRequiredInstanceExtensions(&window_extension_count);
+    enabled_extensions.insert(enabled_extensions.end(), window_extension_names,
+                              window_extension_names + window_extension_count);
+  }
 #ifdef __APPLE__
   enabled_extensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
 #endif
 
-  std::vector<const char *> enabled_layers = {"VK_LAYER_KHRONOS_validation"};
-#ifdef _DEBUG
-  enabled_layers.clear();
+  // Validation only runs in debug builds, it slows down startup noticeably.
+  std::vector<const char *> enabled_layers;
+#ifndef NDEBUG
+  enabled_layers.push_back("VK_LAYER_KHRONOS_validation");
+  enabled_extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 #endif
 
   vk::DebugUtilsMessengerCreateInfoEXT debug_messenger_info;
   debug_messenger_info.messageSeverity =
       vk::DebugUtilsMessageSeverityFlagBitsEXT::eError |
-      vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning |
-      vk::DebugUtilsMessageSeverityFlagBitsEXT::eInfo |
-      vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose;
+      vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning;
   debug_messenger_info.messageType =
       vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation |
       vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance |
@@ -258,7 +340,7 @@ void VulkanEngine::_create_instance() {
       vk::InstanceCreateFlagBits::eEnumeratePortabilityKHR;
 #endif
 
-#ifndef _DEBUG
+#ifdef NDEBUG
   instance_create_info.pNext = nullptr;
 #endif
 
@@ -271,6 +353,11 @@ void VulkanEngine::_create_surface() {
 }
 
 void VulkanEngine::_select_phys_device() {
+  if (_settings.headless)
+    std::erase_if(_required_device_extensions, [](const char *name) {
+      return std::string(name) == VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+    });
+
   const auto physical_devs = _instance.enumeratePhysicalDevices();
   if (physical_devs.empty())
     throw std::runtime_error("No GPU found");
@@ -283,6 +370,9 @@ void VulkanEngine::_select_phys_device() {
   std::sort(required_dev_extensions.begin(), required_dev_extensions.end());
 
   for (const auto &dev : physical_devs) {
+    const std::string name = dev.getProperties().deviceName;
+    if (name.find(_settings.device_name) == std::string::npos)
+      continue;
     auto available_extensions = dev.enumerateDeviceExtensionProperties();
     std::vector<std::string> available_extension_names;
     std::transform(available_extensions.begin(), available_extensions.end(),
@@ -311,6 +401,60 @@ void VulkanEngine::_select_phys_device() {
   throw std::runtime_error("No suitable GPU found");
 }
 
+// Vulkan has no core count, so it is read from the vendor extensions that
+// report the shader cores and how many subgroups each of them keeps in flight.
+void VulkanEngine::_query_resident_invocations() {
+  const auto extensions = _selected_dev.enumerateDeviceExtensionProperties();
+  const auto supported = [&](const char *name) {
+    return std::any_of(extensions.begin(), extensions.end(),
+                       [&](const auto &ext) {
+                         return std::string(ext.extensionName) == name;
+                       });
+  };
+
+  _max_group_count_x =
+      _selected_dev.getProperties().limits.maxComputeWorkGroupCount[0];
+  if (supported(VK_NV_SHADER_SM_BUILTINS_EXTENSION_NAME)) {
+    const auto properties = _selected_dev.getProperties2<
+        vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties,
+        vk::PhysicalDeviceShaderSMBuiltinsPropertiesNV>();
+    const auto &cores =
+        properties.get<vk::PhysicalDeviceShaderSMBuiltinsPropertiesNV>();
+    _resident_invocations =
+        static_cast<std::uint64_t>(cores.shaderSMCount) *
+        cores.shaderWarpsPerSM *
+        properties.get<vk::PhysicalDeviceSubgroupProperties>().subgroupSize;
+  } else if (supported(VK_AMD_SHADER_CORE_PROPERTIES_EXTENSION_NAME)) {
+    const auto properties = _selected_dev.getProperties2<
+        vk::PhysicalDeviceProperties2,
+        vk::PhysicalDeviceShaderCorePropertiesAMD>();
+    const auto &cores =
+        properties.get<vk::PhysicalDeviceShaderCorePropertiesAMD>();
+    _resident_invocations =
+        static_cast<std::uint64_t>(cores.shaderEngineCount) *
+        cores.shaderArraysPerEngineCount * cores.computeUnitsPerShaderArray *
+        cores.simdPerComputeUnit * cores.wavefrontsPerSimd *
+        cores.wavefrontSize;
+  }
+}
+
+// Enough workgroups to fill every core once. Without a core count every work
+// item of a pass gets an invocation, which is never too few: workgroups that
+// find the queue empty return right away.
+std::uint32_t VulkanEngine::_persistent_group_count() const {
+  if (_settings.persistent_group_count > 0)
+    return _settings.persistent_group_count;
+  const std::uint64_t group_invocations =
+      _settings.group_size_x * _settings.group_size_y;
+  auto invocations = _resident_invocations;
+  if (invocations == 0)
+    invocations = static_cast<std::uint64_t>(_settings.window_width) *
+                  _settings.window_height * _settings.samples_per_pass;
+  return static_cast<std::uint32_t>(std::clamp<std::uint64_t>(
+      (invocations + group_invocations - 1) / group_invocations, 1,
+      _max_group_count_x));
+}
+
 void VulkanEngine::_find_queue_families() {
   std::vector<vk::QueueFamilyProperties> queue_families =
       _selected_dev.getQueueFamilyProperties();
@@ -326,7 +470,7 @@ void VulkanEngine::_find_queue_families() {
         (queue_families[i].queueFlags & vk::QueueFlagBits::eCompute) ==
         vk::QueueFlagBits::eCompute;
     const auto supports_presenting =
-        _selected_dev.getSurfaceSupportKHR(i, _surface);
+        !_settings.headless && _selected_dev.getSurfaceSupportKHR(i, _surface);
 
     if (supports_compute && !supports_graphics && !compute_family_found) {
       _compute_queue_family = i;
@@ -342,6 +486,20 @@ void VulkanEngine::_find_queue_families() {
     if (compute_family_found && present_family_found)
       break;
   }
+
+  // Without a dedicated compute family, compute on any family that can.
+  for (std::uint32_t i = 0; i < queue_families.size() && !compute_family_found;
+       i++)
+    if (queue_families[i].queueFlags & vk::QueueFlagBits::eCompute) {
+      _compute_queue_family = i;
+      compute_family_found = true;
+    }
+  if (!compute_family_found)
+    throw std::runtime_error("No compute queue found");
+  if (_settings.headless)
+    _present_queue_family = _compute_queue_family;
+  else if (!present_family_found)
+    throw std::runtime_error("No present queue found");
 }
 
 void VulkanEngine::_create_logical_device() {
@@ -357,7 +515,9 @@ void VulkanEngine::_create_logical_device() {
           .pQueuePriorities = &queue_priority,
       };
   std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos = {
-      compute_queue_info, present_queue_info};
+      compute_queue_info};
+  if (_present_queue_family != _compute_queue_family)
+    queueCreateInfos.push_back(present_queue_info);
 
   vk::PhysicalDeviceFeatures device_features = {};
 
@@ -385,15 +545,67 @@ void VulkanEngine::_create_logical_device() {
 
 void VulkanEngine::_create_scene_buffer() {
   _scene_buffer = _create_buffer(sizeof(gpu::Scene),
-                                 vk::BufferUsageFlagBits::eUniformBuffer,
-                                 vk::MemoryPropertyFlagBits::eHostVisible |
-                                     vk::MemoryPropertyFlagBits::eHostCoherent);
+                                 vk::BufferUsageFlagBits::eUniformBuffer |
+                                     vk::BufferUsageFlagBits::eTransferDst,
+                                 vk::MemoryPropertyFlagBits::eDeviceLocal);
 }
 
+// Collects the camera, hittables and materials that changed since the last
+// upload, merging adjacent ones into one range.
 void VulkanEngine::_update_scene_buffer(const gpu::Scene &scene) {
-  void *data = _device.mapMemory(_scene_buffer.memory, 0, sizeof(gpu::Scene));
-  std::memcpy(data, &scene, sizeof(gpu::Scene));
-  _device.unmapMemory(_scene_buffer.memory);
+  _scene_updates.clear();
+  const auto *uploaded = reinterpret_cast<const std::byte *>(&_uploaded_scene);
+  const auto *current = reinterpret_cast<const std::byte *>(&scene);
+  const auto compare = [&](std::size_t offset, std::size_t size) {
+    if (_scene_uploaded &&
+        std::memcmp(uploaded + offset, current + offset, size) == 0)
+      return;
+    if (!_scene_updates.empty() &&
+        _scene_updates.back().offset + _scene_updates.back().size == offset)
+      _scene_updates.back().size += static_cast<std::uint32_t>(size);
+    else
+      _scene_updates.push_back({
+          .offset = static_cast<std::uint32_t>(offset),
+          .size = static_cast<std::uint32_t>(size),
+      });
+  };
+
+  compare(0, offsetof(gpu::Scene, hittables));
+  for (std::size_t i = 0; i < std::size(scene.hittables); i++)
+    compare(offsetof(gpu::Scene, hittables) + i * sizeof(gpu::Hittable),
+            sizeof(gpu::Hittable));
+  for (std::size_t i = 0; i < std::size(scene.materials); i++)
+    compare(offsetof(gpu::Scene, materials) + i * sizeof(gpu::Material),
+            sizeof(gpu::Material));
+
+  if (!_scene_updates.empty())
+    std::memcpy(&_uploaded_scene, &scene, sizeof(gpu::Scene));
+  _scene_uploaded = true;
+}
+
+// The data of vkCmdUpdateBuffer is copied into the command buffer, so the
+// ranges are read from _uploaded_scene while recording and no staging memory
+// has to outlive the frame.
+void VulkanEngine::_record_scene_updates() {
+  _recorded_upload_bytes = 0;
+  if (_scene_updates.empty())
+    return;
+
+  const auto *data = reinterpret_cast<const std::byte *>(&_uploaded_scene);
+  for (const auto &update : _scene_updates) {
+    const auto end = update.offset + update.size;
+    for (auto offset = update.offset; offset < end;
+         offset += _max_update_buffer_size) {
+      const auto size = std::min(_max_update_buffer_size, end - offset);
+      _command_buffer.updateBuffer(_scene_buffer.buffer, offset, size,
+                                   data + offset);
+      _recorded_upload_bytes += size;
+    }
+  }
+  _memory_barrier(vk::PipelineStageFlagBits::eTransfer,
+                  vk::AccessFlagBits::eTransferWrite,
+                  vk::PipelineStageFlagBits::eComputeShader,
+                  vk::AccessFlagBits::eUniformRead);
 }
 
 void VulkanEngine::_create_render_call_info_buffer() {
@@ -404,15 +616,152 @@ void VulkanEngine::_create_render_call_info_buffer() {
 }
 void VulkanEngine::_update_render_call_info_buffer(
     const RenderCallInfo &render_call_info) {
-  void *data = _device.mapMemory(_render_call_info_buffer.memory, 0,
-                                 sizeof(RenderCallInfo));
-  std::memcpy(data, &render_call_info, sizeof(RenderCallInfo));
-  _device.unmapMemory(_render_call_info_buffer.memory);
+  std::memcpy(_render_call_info_buffer.allocation.mapped, &render_call_info,
+              sizeof(RenderCallInfo));
+}
+
+void VulkanEngine::_create_viewport_buffer() {
+  _viewport_buffer = _create_buffer(
+      sizeof(gpu::Viewport), vk::BufferUsageFlagBits::eUniformBuffer,
+      vk::MemoryPropertyFlagBits::eHostVisible |
+          vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+void VulkanEngine::_update_viewport_buffer(const gpu::Viewport &viewport) {
+  std::memcpy(_viewport_buffer.allocation.mapped, &viewport,
+              sizeof(gpu::Viewport));
+}
+
+void VulkanEngine::_create_light_buffer() {
+  _light_buffer = _create_buffer(sizeof(gpu::LightList),
+                                 vk::BufferUsageFlagBits::eStorageBuffer,
+                                 vk::MemoryPropertyFlagBits::eHostVisible |
+                                     vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+void VulkanEngine::_update_light_buffer(const gpu::Scene &scene) {
+  const auto lights = scene.lights();
+  std::memcpy(_light_buffer.allocation.mapped, &lights,
+              sizeof(gpu::LightList));
+}
+
+void VulkanEngine::_upload_environment(
+    const gpu::EnvironmentHeader &header,
+    const std::vector<gpu::EnvironmentTexel> &texels) {
+  const auto texels_size = texels.size() * sizeof(gpu::EnvironmentTexel);
+  _environment_buffer =
+      _create_buffer(sizeof(gpu::EnvironmentHeader) + texels_size,
+                     vk::BufferUsageFlagBits::eStorageBuffer,
+                     vk::MemoryPropertyFlagBits::eHostVisible |
+                         vk::MemoryPropertyFlagBits::eHostCoherent);
+  auto *mapped =
+      static_cast<std::byte *>(_environment_buffer.allocation.mapped);
+  std::memcpy(mapped, &header, sizeof(gpu::EnvironmentHeader));
+  std::memcpy(mapped + sizeof(gpu::EnvironmentHeader), texels.data(),
+              texels_size);
+}
+
+void VulkanEngine::_write_environment_descriptor() {
+  const vk::DescriptorBufferInfo environment_buffer_info = {
+      _environment_buffer.buffer, 0, VK_WHOLE_SIZE};
+  const vk::WriteDescriptorSet descriptor_write = {
+      .dstSet = _descriptor_set,
+      .dstBinding = 14,
+      .dstArrayElement = 0,
+      .descriptorCount = 1,
+      .descriptorType = vk::DescriptorType::eStorageBuffer,
+      .pBufferInfo = &environment_buffer_info};
+  _device.updateDescriptorSets(1, &descriptor_write, 0, nullptr);
 }
 
 void VulkanEngine::_create_summed_pixel_color_image() {
-  _summed_image = _create_image(vk::Format::eR16G16B16A16Unorm,
-                                vk::ImageUsageFlagBits::eStorage);
+  _summed_image = _create_image(vk::Format::eR32G32B32A32Sfloat,
+                                vk::ImageUsageFlagBits::eStorage |
+                                    vk::ImageUsageFlagBits::eTransferSrc);
+}
+
+void VulkanEngine::_create_reprojection_resources() {
+  _history_image = _create_image(vk::Format::eR32G32B32A32Sfloat,
+                                 vk::ImageUsageFlagBits::eStorage |
+                                     vk::ImageUsageFlagBits::eTransferDst);
+  _first_hit_image = _create_image(vk::Format::eR32G32B32A32Sfloat,
+                                   vk::ImageUsageFlagBits::eStorage |
+                                       vk::ImageUsageFlagBits::eTransferSrc);
+  _previous_first_hit_image =
+      _create_image(vk::Format::eR32G32B32A32Sfloat,
+                    vk::ImageUsageFlagBits::eStorage |
+                        vk::ImageUsageFlagBits::eTransferDst);
+  _reprojection_info_buffer = _create_buffer(
+      sizeof(ReprojectionInfo), vk::BufferUsageFlagBits::eUniformBuffer,
+      vk::MemoryPropertyFlagBits::eHostVisible |
+          vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+// Called whenever the accumulation restarts. The samples accumulated so far
+// belong to the camera of the previous restart.
+void VulkanEngine::_update_reprojection_info_buffer(
+    const gpu::Viewport &viewport) {
+  _reproject_history = _temporal_reprojection && _has_accumulated_viewport;
+  const ReprojectionInfo info = {
+      .previous_viewport = _accumulated_viewport,
+      .history_valid = _reproject_history,
+      .history_samples = _settings.reprojection_history_samples,
+      .position_tolerance = _reprojection_position_tolerance,
+  };
+  std::memcpy(_reprojection_info_buffer.allocation.mapped, &info,
+              sizeof(ReprojectionInfo));
+
+  _accumulated_viewport = viewport;
+  _has_accumulated_viewport = true;
+}
+
+void VulkanEngine::_create_wavefront_buffers() {
+  const vk::DeviceSize path_count =
+      static_cast<vk::DeviceSize>(_settings.window_width) *
+      _settings.window_height;
+  _path_buffer = _create_buffer(path_count * _path_state_size,
+                                vk::BufferUsageFlagBits::eStorageBuffer,
+                                vk::MemoryPropertyFlagBits::eDeviceLocal);
+  // Indirect dispatch arguments, queue sizes and then the queues themselves.
+  const vk::DeviceSize queue_buffer_size =
+      _queue_count * 4 * sizeof(std::uint32_t) +
+      _queue_count * sizeof(std::uint32_t) +
+      _queue_count * path_count * sizeof(std::uint32_t);
+  _queue_buffer = _create_buffer(queue_buffer_size,
+                                 vk::BufferUsageFlagBits::eStorageBuffer |
+                                     vk::BufferUsageFlagBits::eIndirectBuffer |
+                                     vk::BufferUsageFlagBits::eTransferSrc,
+                                 vk::MemoryPropertyFlagBits::eDeviceLocal);
+  _live_path_readback_buffer =
+      _create_buffer(sizeof(std::uint32_t),
+                     vk::BufferUsageFlagBits::eTransferDst,
+                     vk::MemoryPropertyFlagBits::eHostVisible |
+                         vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+void VulkanEngine::_create_statistics_buffers() {
+  _statistics_buffer =
+      _create_buffer(sizeof(ShaderStatistics),
+                     vk::BufferUsageFlagBits::eStorageBuffer |
+                         vk::BufferUsageFlagBits::eTransferSrc |
+                         vk::BufferUsageFlagBits::eTransferDst,
+                     vk::MemoryPropertyFlagBits::eDeviceLocal);
+  _statistics_readback_buffer =
+      _create_buffer(sizeof(ShaderStatistics),
+                     vk::BufferUsageFlagBits::eTransferDst,
+                     vk::MemoryPropertyFlagBits::eHostVisible |
+                         vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
+void VulkanEngine::_create_accumulation_buffer() {
+  const vk::DeviceSize pixel_count =
+      static_cast<vk::DeviceSize>(_settings.window_width) *
+      _settings.window_height;
+  _accumulation_buffer = _create_buffer(
+      pixel_count * 6 * sizeof(std::uint32_t),
+      vk::BufferUsageFlagBits::eStorageBuffer |
+          vk::BufferUsageFlagBits::eTransferDst,
+      vk::MemoryPropertyFlagBits::eDeviceLocal);
 }
 
 void VulkanEngine::_create_command_pool() {
@@ -422,6 +771,15 @@ void VulkanEngine::_create_command_pool() {
 }
 
 void VulkanEngine::_create_swap_chain() {
+  _resolved_image = _create_image(vk::Format::eR8G8B8A8Unorm,
+                                  vk::ImageUsageFlagBits::eStorage |
+                                      vk::ImageUsageFlagBits::eTransferSrc);
+  if (_settings.headless) {
+    _swap_chain_image = _resolved_image.image;
+    _swap_chain_image_view = _resolved_image.view;
+    return;
+  }
+
   vk::SwapchainCreateInfoKHR swap_chain_create_info{
       .surface = _surface,
       .minImageCount = 1,
@@ -431,7 +789,7 @@ void VulkanEngine::_create_swap_chain() {
                       .height = _settings.window_height},
       .imageArrayLayers = 1,
       .imageUsage = vk::ImageUsageFlagBits::eColorAttachment |
-                    vk::ImageUsageFlagBits::eStorage |
+                    vk::ImageUsageFlagBits::eTransferDst |
                     vk::ImageUsageFlagBits::eTransferSrc,
       .imageSharingMode = vk::SharingMode::eExclusive,
       .preTransform =
@@ -470,6 +828,50 @@ void VulkanEngine::_create_descriptor_set_layout() {
        .descriptorType = vk::DescriptorType::eUniformBuffer,
        .descriptorCount = 1,
        .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 4,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 5,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 6,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 7,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 8,
+       .descriptorType = vk::DescriptorType::eUniformBuffer,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 9,
+       .descriptorType = vk::DescriptorType::eStorageImage,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 10,
+       .descriptorType = vk::DescriptorType::eStorageImage,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 11,
+       .descriptorType = vk::DescriptorType::eStorageImage,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 12,
+       .descriptorType = vk::DescriptorType::eUniformBuffer,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 13,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
+      {.binding = 14,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .descriptorCount = 1,
+       .stageFlags = vk::ShaderStageFlagBits::eCompute},
   };
 
   _descriptor_set_layout =
@@ -480,8 +882,9 @@ void VulkanEngine::_create_descriptor_set_layout() {
 
 void VulkanEngine::_create_descriptor_pool() {
   std::vector<vk::DescriptorPoolSize> poolSizes{
-      {.type = vk::DescriptorType::eStorageImage, .descriptorCount = 2},
-      {.type = vk::DescriptorType::eUniformBuffer, .descriptorCount = 2},
+      {.type = vk::DescriptorType::eStorageImage, .descriptorCount = 5},
+      {.type = vk::DescriptorType::eUniformBuffer, .descriptorCount = 4},
+      {.type = vk::DescriptorType::eStorageBuffer, .descriptorCount = 6},
       {.type = vk::DescriptorType::eCombinedImageSampler, .descriptorCount = 1},
   };
 
@@ -501,7 +904,7 @@ void VulkanEngine::_create_descriptor_set() {
           .front();
 
   vk::DescriptorImageInfo render_target_image_info = {
-      {}, _swap_chain_image_view, vk::ImageLayout::eGeneral};
+      {}, _resolved_image.view, vk::ImageLayout::eGeneral};
 
   vk::DescriptorImageInfo summed_image_info = {
       {}, _summed_image.view, vk::ImageLayout::eGeneral};
@@ -512,6 +915,36 @@ void VulkanEngine::_create_descriptor_set() {
   vk::DescriptorBufferInfo render_call_info_buffer_info = {
       _render_call_info_buffer.buffer, 0, sizeof(RenderCallInfo)};
 
+  vk::DescriptorBufferInfo path_buffer_info = {_path_buffer.buffer, 0,
+                                               VK_WHOLE_SIZE};
+
+  vk::DescriptorBufferInfo queue_buffer_info = {_queue_buffer.buffer, 0,
+                                                VK_WHOLE_SIZE};
+
+  vk::DescriptorBufferInfo statistics_buffer_info = {
+      _statistics_buffer.buffer, 0, sizeof(ShaderStatistics)};
+
+  vk::DescriptorBufferInfo accumulation_buffer_info = {
+      _accumulation_buffer.buffer, 0, VK_WHOLE_SIZE};
+
+  vk::DescriptorBufferInfo reprojection_info_buffer_info = {
+      _reprojection_info_buffer.buffer, 0, sizeof(ReprojectionInfo)};
+
+  vk::DescriptorBufferInfo viewport_buffer_info = {
+      _viewport_buffer.buffer, 0, sizeof(gpu::Viewport)};
+
+  vk::DescriptorBufferInfo light_buffer_info = {_light_buffer.buffer, 0,
+                                                sizeof(gpu::LightList)};
+
+  vk::DescriptorImageInfo history_image_info = {
+      {}, _history_image.view, vk::ImageLayout::eGeneral};
+
+  vk::DescriptorImageInfo first_hit_image_info = {
+      {}, _first_hit_image.view, vk::ImageLayout::eGeneral};
+
+  vk::DescriptorImageInfo previous_first_hit_image_info = {
+      {}, _previous_first_hit_image.view, vk::ImageLayout::eGeneral};
+
   std::vector<vk::WriteDescriptorSet> descriptor_writes{
       {.dstSet = _descriptor_set,
        .dstBinding = 0,
@@ -536,45 +969,323 @@ void VulkanEngine::_create_descriptor_set() {
        .dstArrayElement = 0,
        .descriptorCount = 1,
        .descriptorType = vk::DescriptorType::eUniformBuffer,
-       .pBufferInfo = &render_call_info_buffer_info}};
+       .pBufferInfo = &render_call_info_buffer_info},
+      {.dstSet = _descriptor_set,
+       .dstBinding = 4,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .pBufferInfo = &path_buffer_info},
+      {.dstSet = _descriptor_set,
+       .dstBinding = 5,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .pBufferInfo = &queue_buffer_info},
+      {.dstSet = _descriptor_set,
+       .dstBinding = 6,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .pBufferInfo = &statistics_buffer_info},
+      {.dstSet = _descriptor_set,
+       .dstBinding = 7,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .pBufferInfo = &accumulation_buffer_info},
+      {.dstSet = _descriptor_set,
+       .dstBinding = 8,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = vk::DescriptorType::eUniformBuffer,
+       .pBufferInfo = &reprojection_info_buffer_info},
+      {.dstSet = _descriptor_set,
+       .dstBinding = 9,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = vk::DescriptorType::eStorageImage,
+       .pImageInfo = &history_image_info},
+      {.dstSet = _descriptor_set,
+       .dstBinding = 10,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = vk::DescriptorType::eStorageImage,
+       .pImageInfo = &first_hit_image_info},
+      {.dstSet = _descriptor_set,
+       .dstBinding = 11,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = vk::DescriptorType::eStorageImage,
+       .pImageInfo = &previous_first_hit_image_info},
+      {.dstSet = _descriptor_set,
+       .dstBinding = 12,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = vk::DescriptorType::eUniformBuffer,
+       .pBufferInfo = &viewport_buffer_info},
+      {.dstSet = _descriptor_set,
+       .dstBinding = 13,
+       .dstArrayElement = 0,
+       .descriptorCount = 1,
+       .descriptorType = vk::DescriptorType::eStorageBuffer,
+       .pBufferInfo = &light_buffer_info}};
 
   _device.updateDescriptorSets(static_cast<uint32_t>(descriptor_writes.size()),
                                descriptor_writes.data(), 0, nullptr);
+  _write_environment_descriptor();
 }
 
 void VulkanEngine::_create_pipeline_layout() {
+  const vk::PushConstantRange push_constant_range = {
+      .stageFlags = vk::ShaderStageFlagBits::eCompute,
+      .offset = 0,
+      .size = static_cast<std::uint32_t>(std::max(
+          sizeof(WavefrontPushConstants), sizeof(PassPushConstants))),
+  };
   _pipeline_layout = _device.createPipelineLayout({
       .setLayoutCount = 1,
       .pSetLayouts = &_descriptor_set_layout,
-      .pushConstantRangeCount = 0,
-      .pPushConstantRanges = nullptr,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &push_constant_range,
   });
 }
 
-void VulkanEngine::_create_pipeline() {
-  std::vector<char> _shader_code = _read_binary_file(_settings.shader_file);
+// Loads the pipeline cache written by a previous run. A cache from another
+// device or driver is ignored and replaced when the engine is destroyed.
+void VulkanEngine::_create_pipeline_cache() {
+  std::vector<char> cache_data;
+  if (!_settings.pipeline_cache_file.empty() &&
+      std::filesystem::exists(_settings.pipeline_cache_file)) {
+    cache_data = _read_binary_file(_settings.pipeline_cache_file);
+
+    const auto properties = _selected_dev.getProperties();
+    VkPipelineCacheHeaderVersionOne header;
+    if (cache_data.size() < sizeof(header))
+      cache_data.clear();
+    else {
+      std::memcpy(&header, cache_data.data(), sizeof(header));
+      if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+          header.vendorID != properties.vendorID ||
+          header.deviceID != properties.deviceID ||
+          std::memcmp(header.pipelineCacheUUID,
+                      properties.pipelineCacheUUID.data(), VK_UUID_SIZE) != 0)
+        cache_data.clear();
+    }
+  }
 
-  vk::ShaderModuleCreateInfo shader_module_create_info = {
-      .codeSize = _shader_code.size(),
-      .pCode = reinterpret_cast<const uint32_t *>(_shader_code.data())};
+  _pipeline_cache_loaded = !cache_data.empty();
+  _pipeline_cache = _device.createPipelineCache({
+      .initialDataSize = cache_data.size(),
+      .pInitialData = cache_data.data(),
+  });
+}
 
+void VulkanEngine::_save_pipeline_cache() const {
+  if (_settings.pipeline_cache_file.empty())
+    return;
+
+  const auto cache_data = _device.getPipelineCacheData(_pipeline_cache);
+  // Written to a temporary file first so that an interrupted write never
+  // leaves a truncated cache behind.
+  const auto temporary_file = _settings.pipeline_cache_file + ".tmp";
+  std::ofstream file(temporary_file, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Failed to open: " << temporary_file << std::endl;
+    return;
+  }
+  file.write(reinterpret_cast<const char *>(cache_data.data()),
+             static_cast<std::streamsize>(cache_data.size()));
+  file.close();
+  std::filesystem::rename(temporary_file, _settings.pipeline_cache_file);
+}
+
+void VulkanEngine::_create_pipeline() {
   vk::ShaderModule compute_shader_module =
-      _device.createShaderModule(shader_module_create_info);
+      _create_shader_module(_settings.shader_file);
 
-  vk::PipelineShaderStageCreateInfo shaderStage = {
-      .stage = vk::ShaderStageFlagBits::eCompute,
-      .module = compute_shader_module,
-      .pName = "main",
+  _pipeline = _create_compute_pipeline(compute_shader_module,
+                                       _settings.group_size_x,
+                                       _settings.group_size_y);
+
+  _device.destroyShaderModule(compute_shader_module);
+}
+
+void VulkanEngine::_create_wavefront_pipelines() {
+  enum WavefrontStage {
+    GENERATE = 0,
+    INTERSECT = 1,
+    SHADE = 2,
+    COMPACT = 3,
+    ACCUMULATE = 4
+  };
+  vk::ShaderModule wavefront_shader_module =
+      _create_shader_module(_settings.wavefront_shader_file);
+
+  const auto create_stage = [&](std::uint32_t stage,
+                                std::uint32_t material_kind = 0) {
+    return _create_compute_pipeline(wavefront_shader_module,
+                                    _settings.group_size_x,
+                                    _settings.group_size_y,
+                                    {{.id = 10, .value = stage},
+                                     {.id = 11, .value = material_kind}});
   };
 
-  vk::ComputePipelineCreateInfo pipeline_create_info = {
-      .stage = shaderStage, .layout = _pipeline_layout};
+  _wavefront_pipelines.generate = create_stage(GENERATE);
+  _wavefront_pipelines.intersect = create_stage(INTERSECT);
+  for (std::uint32_t kind = 0; kind < _wavefront_pipelines.shade.size();
+       kind++)
+    _wavefront_pipelines.shade[kind] = create_stage(SHADE, kind);
+  _wavefront_pipelines.compact = create_stage(COMPACT);
+  _wavefront_pipelines.accumulate = create_stage(ACCUMULATE);
+
+  _device.destroyShaderModule(wavefront_shader_module);
+}
 
-  _pipeline =
-      _device.createComputePipeline(nullptr, pipeline_create_info).value;
+void VulkanEngine::_create_persistent_pipelines() {
+  enum PersistentStage { TRACE = 0, ACCUMULATE = 1 };
 
+  vk::ShaderModule persistent_shader_module =
+      _create_shader_module(_settings.persistent_shader_file);
+
+  const auto create_stage = [&](std::uint32_t stage) {
+    return _create_compute_pipeline(
+        persistent_shader_module, _settings.group_size_x,
+        _settings.group_size_y, {{.id = 10, .value = stage}});
+  };
+
+  _persistent_pipeline = create_stage(TRACE);
+  _persistent_accumulate_pipeline = create_stage(ACCUMULATE);
+
+  _device.destroyShaderModule(persistent_shader_module);
+}
+
+void VulkanEngine::_create_reproject_pipeline() {
+  vk::ShaderModule reproject_shader_module =
+      _create_shader_module(_settings.reproject_shader_file);
+  _reproject_pipeline =
+      _create_compute_pipeline(reproject_shader_module, _settings.group_size_x,
+                               _settings.group_size_y);
+  _device.destroyShaderModule(reproject_shader_module);
+}
+
+void VulkanEngine::_create_resolve_pipeline() {
+  vk::ShaderModule resolve_shader_module =
+      _create_shader_module(_settings.resolve_shader_file);
+  _resolve_pipeline =
+      _create_compute_pipeline(resolve_shader_module, _settings.group_size_x,
+                               _settings.group_size_y);
+  _device.destroyShaderModule(resolve_shader_module);
+}
+
+void VulkanEngine::_destroy_pipelines() {
+  _device.destroyPipeline(_pipeline);
+  _device.destroyPipeline(_wavefront_pipelines.generate);
+  _device.destroyPipeline(_wavefront_pipelines.intersect);
+  for (const auto &pipeline : _wavefront_pipelines.shade)
+    _device.destroyPipeline(pipeline);
+  _device.destroyPipeline(_wavefront_pipelines.compact);
+  _device.destroyPipeline(_wavefront_pipelines.accumulate);
+  _device.destroyPipeline(_persistent_pipeline);
+  _device.destroyPipeline(_persistent_accumulate_pipeline);
+  _device.destroyPipeline(_resolve_pipeline);
+  _device.destroyPipeline(_reproject_pipeline);
+}
+
+// Creates a megakernel pipeline for every workgroup shape the device
+// supports. Each of them is timed in _tuning_rounds of the first traced
+// megakernel frames and the fastest on average is kept for all kernels by
+// _finish_group_size_tuning. The wavefront and persistent kernels are not
+// timed themselves, and the tuning waits while another kernel is selected.
+void VulkanEngine::_create_group_size_candidates() {
+  if (!_settings.auto_tune_group_size)
+    return;
+  if (!_timestamps_supported) {
+    std::cout << "Workgroup size auto-tuning needs timestamp queries, using "
+              << _settings.group_size_x << "x" << _settings.group_size_y
+              << std::endl;
+    return;
+  }
+
+  const auto limits = _selected_dev.getProperties().limits;
+  const std::vector<std::pair<std::uint32_t, std::uint32_t>> shapes = {
+      {8, 8}, {16, 8}, {8, 16}, {16, 16}, {32, 4}, {32, 8}, {64, 1}, {64, 4}};
+
+  vk::ShaderModule compute_shader_module =
+      _create_shader_module(_settings.shader_file);
+  for (const auto &[x, y] : shapes) {
+    if (x * y > limits.maxComputeWorkGroupInvocations ||
+        x > limits.maxComputeWorkGroupSize[0] ||
+        y > limits.maxComputeWorkGroupSize[1])
+      continue;
+    _group_size_candidates.push_back({
+        .x = x,
+        .y = y,
+        .pipeline = _create_compute_pipeline(compute_shader_module, x, y),
+        .total_ms = 0,
+    });
+  }
+  _device.destroyShaderModule(compute_shader_module);
+}
+
+void VulkanEngine::_finish_group_size_tuning() {
+  const auto fastest = std::min_element(
+      _group_size_candidates.begin(), _group_size_candidates.end(),
+      [](const auto &a, const auto &b) { return a.total_ms < b.total_ms; });
+  std::cout << "Workgroup sizes:";
+  for (const auto &candidate : _group_size_candidates)
+    std::cout << " " << candidate.x << "x" << candidate.y << " ("
+              << candidate.total_ms / (_tuning_rounds - 1) << " ms)";
+  std::cout << "\nSelected workgroup size " << fastest->x << "x" << fastest->y
+            << std::endl;
+
+  _settings.group_size_x = fastest->x;
+  _settings.group_size_y = fastest->y;
+  for (const auto &candidate : _group_size_candidates)
+    _device.destroyPipeline(candidate.pipeline);
+  _group_size_candidates.clear();
+
+  _recreate_pipelines();
+}
+
+// Only called after the frame fence was waited on, so none of the pipelines is
+// in use anymore. Candidates that are still to be timed are rebuilt as well.
+void VulkanEngine::_recreate_pipelines() {
+  _destroy_pipelines();
+  _create_pipeline();
+  _create_wavefront_pipelines();
+  _create_persistent_pipelines();
+  _create_resolve_pipeline();
+  _create_reproject_pipeline();
+
+  if (_group_size_candidates.empty())
+    return;
+  vk::ShaderModule compute_shader_module =
+      _create_shader_module(_settings.shader_file);
+  for (auto &candidate : _group_size_candidates) {
+    _device.destroyPipeline(candidate.pipeline);
+    candidate.pipeline = _create_compute_pipeline(
+        compute_shader_module, candidate.x, candidate.y);
+  }
   _device.destroyShaderModule(compute_shader_module);
 }
+
+void VulkanEngine::_specialize_material_kinds(std::uint32_t material_kinds) {
+  if (material_kinds == _material_kinds)
+    return;
+
+  static const char *kind_names[] = {"lambertian", "metal", "dielectric",
+                                     "portal", "emissive"};
+  std::cout << "Specializing pipelines for materials:";
+  for (std::uint32_t kind = 0; kind < std::size(kind_names); kind++)
+    if (material_kinds & (1u << kind))
+      std::cout << " " << kind_names[kind];
+  std::cout << std::endl;
+
+  _material_kinds = material_kinds;
+  _recreate_pipelines();
+}
+
 static void check_vk_result(VkResult err) {
   std::cout << string_VkResult(err) << std::endl;
 }
@@ -595,7 +1306,7 @@ void VulkanEngine::_setup_imgui() {
   init_info.Device = _device;
   init_info.QueueFamily = _present_queue_family;
   init_info.Queue = _present_queue;
-  init_info.PipelineCache = VK_NULL_HANDLE;
+  init_info.PipelineCache = _pipeline_cache;
   init_info.DescriptorPool = _descriptor_pool;
   init_info.Allocator = nullptr;
   init_info.MinImageCount = 2;
@@ -610,7 +1321,216 @@ void VulkanEngine::_setup_imgui() {
   ImGui_ImplVulkan_Init(&init_info);
 }
 
-void VulkanEngine::_create_command_buffer() {
+void VulkanEngine::_record_megakernel(std::uint32_t pixel_stride,
+                                      std::uint32_t samples) {
+  auto pipeline = _pipeline;
+  auto group_size_x = _settings.group_size_x,
+       group_size_y = _settings.group_size_y;
+  // Reduced resolution and tiled passes would skew the workgroup size
+  // timings.
+  if (pixel_stride == 1 && _tiles.empty() &&
+      _tuned_frames < _group_size_candidates.size() * _tuning_rounds) {
+    const auto index = _tuned_frames % _group_size_candidates.size();
+    const auto &candidate = _group_size_candidates[index];
+    pipeline = candidate.pipeline;
+    group_size_x = candidate.x;
+    group_size_y = candidate.y;
+    _profiled_candidate = index;
+    _profiled_group_size_x = candidate.x;
+    _profiled_group_size_y = candidate.y;
+  }
+  _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+
+  const std::vector<Tile> whole_image = {{
+      .x = 0,
+      .y = 0,
+      .width = _settings.window_width,
+      .height = _settings.window_height,
+  }};
+  const auto group_width = group_size_x * pixel_stride,
+             group_height = group_size_y * pixel_stride;
+  for (const auto &tile : _tiles.empty() ? whole_image : _tiles) {
+    const PassPushConstants push_constants = {
+        .pixel_stride = pixel_stride,
+        .samples = samples,
+        .tile_x = tile.x,
+        .tile_y = tile.y,
+        .tile_width = tile.width,
+        .tile_height = tile.height,
+    };
+    _command_buffer.pushConstants(_pipeline_layout,
+                                  vk::ShaderStageFlagBits::eCompute, 0,
+                                  sizeof(push_constants), &push_constants);
+    _command_buffer.dispatch((tile.width + group_width - 1) / group_width,
+                             (tile.height + group_height - 1) / group_height,
+                             1);
+  }
+}
+
+// Records one wave per sample: generate a camera path for every pixel, then
+// alternate between intersecting the live paths and shading them with one
+// kernel per material kind. The compact kernel turns the queue sizes into
+// indirect dispatch arguments. Every _wavefront_bounces_per_submit bounces
+// the command buffer is submitted and the number of live paths read back,
+// so the recorded bounces end with the deepest path instead of max_depth.
+void VulkanEngine::_record_wavefront() {
+  const std::uint32_t all_queues = (1u << _queue_count) - 1,
+                      material_queues =
+                          all_queues & ~((1u << _ray_queue_count) - 1);
+  const vk::DeviceSize dispatch_stride = 4 * sizeof(std::uint32_t);
+  const vk::DeviceSize counts_offset = _queue_count * dispatch_stride;
+
+  WavefrontPushConstants push_constants = {};
+  const auto push = [&]() {
+    _command_buffer.pushConstants(_pipeline_layout,
+                                  vk::ShaderStageFlagBits::eCompute, 0,
+                                  sizeof(push_constants), &push_constants);
+  };
+  const auto compact = [&](std::uint32_t consumed_queues) {
+    push_constants.consumed_queues = consumed_queues;
+    push();
+    _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                 _wavefront_pipelines.compact);
+    _command_buffer.dispatch(1, 1, 1);
+    _compute_memory_barrier();
+  };
+
+  for (std::uint32_t sample = 0; sample < _settings.samples_per_pass;
+       sample++) {
+    push_constants.ray_queue = 0;
+    push_constants.sample_index = sample;
+    push_constants.depth = 0;
+    compact(all_queues);
+
+    _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                 _wavefront_pipelines.generate);
+    push();
+    _dispatch_pixels(_settings.group_size_x, _settings.group_size_y);
+    _compute_memory_barrier();
+    compact(0);
+
+    for (std::uint32_t depth = 0; depth < _settings.max_depth; depth++) {
+      push_constants.depth = depth;
+      push();
+      _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                   _wavefront_pipelines.intersect);
+      _command_buffer.dispatchIndirect(
+          _queue_buffer.buffer, push_constants.ray_queue * dispatch_stride);
+      _compute_memory_barrier();
+      compact(1u << push_constants.ray_queue);
+
+      // Every material kind works on its own queue, so the shading kernels
+      // do not have to be ordered against each other.
+      for (std::uint32_t kind = 0; kind < _wavefront_pipelines.shade.size();
+           kind++) {
+        if ((_material_kinds & (1u << kind)) == 0)
+          continue;
+        _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                     _wavefront_pipelines.shade[kind]);
+        _command_buffer.dispatchIndirect(
+            _queue_buffer.buffer, (_ray_queue_count + kind) * dispatch_stride);
+      }
+      _compute_memory_barrier();
+      compact(material_queues);
+
+      push_constants.ray_queue = 1 - push_constants.ray_queue;
+      if ((depth + 1) % _wavefront_bounces_per_submit != 0 ||
+          depth + 1 == _settings.max_depth)
+        continue;
+      _memory_barrier(vk::PipelineStageFlagBits::eComputeShader,
+                      vk::AccessFlagBits::eShaderWrite,
+                      vk::PipelineStageFlagBits::eTransfer,
+                      vk::AccessFlagBits::eTransferRead);
+      const vk::BufferCopy live_path_copy = {
+          .srcOffset =
+              counts_offset + push_constants.ray_queue * sizeof(std::uint32_t),
+          .dstOffset = 0,
+          .size = sizeof(std::uint32_t)};
+      _command_buffer.copyBuffer(_queue_buffer.buffer,
+                                 _live_path_readback_buffer.buffer,
+                                 live_path_copy);
+      _memory_barrier(vk::PipelineStageFlagBits::eTransfer,
+                      vk::AccessFlagBits::eTransferWrite,
+                      vk::PipelineStageFlagBits::eHost,
+                      vk::AccessFlagBits::eHostRead);
+      _flush_command_buffer();
+      std::uint32_t live_paths = 0;
+      std::memcpy(&live_paths, _live_path_readback_buffer.allocation.mapped,
+                  sizeof(live_paths));
+      if (live_paths == 0)
+        break;
+    }
+
+    _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                 _wavefront_pipelines.accumulate);
+    push();
+    _dispatch_pixels(_settings.group_size_x, _settings.group_size_y);
+    _compute_memory_barrier();
+  }
+}
+
+// A fixed number of workgroups pull work items from the counter in the
+// statistics buffer, which is cleared at the start of every frame.
+void VulkanEngine::_record_persistent() {
+  _command_buffer.fillBuffer(_accumulation_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+  _memory_barrier(vk::PipelineStageFlagBits::eTransfer,
+                  vk::AccessFlagBits::eTransferWrite,
+                  vk::PipelineStageFlagBits::eComputeShader,
+                  vk::AccessFlagBits::eShaderRead |
+                      vk::AccessFlagBits::eShaderWrite);
+
+  _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               _persistent_pipeline);
+  _command_buffer.dispatch(_persistent_group_count(), 1, 1);
+  _compute_memory_barrier();
+
+  _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               _persistent_accumulate_pipeline);
+  _dispatch_pixels(_settings.group_size_x, _settings.group_size_y);
+}
+
+// Restarts the accumulation, from the reprojected samples of the previous
+// view if temporal reprojection is on and from zero otherwise.
+void VulkanEngine::_record_reprojection() {
+  if (_reproject_history) {
+    const vk::ImageCopy region = {
+        .srcSubresource = {.aspectMask = vk::ImageAspectFlagBits::eColor,
+                           .layerCount = 1},
+        .dstSubresource = {.aspectMask = vk::ImageAspectFlagBits::eColor,
+                           .layerCount = 1},
+        .extent = {_settings.window_width, _settings.window_height, 1},
+    };
+    _command_buffer.copyImage(_summed_image.image, vk::ImageLayout::eGeneral,
+                              _history_image.image, vk::ImageLayout::eGeneral,
+                              region);
+    _command_buffer.copyImage(_first_hit_image.image, vk::ImageLayout::eGeneral,
+                              _previous_first_hit_image.image,
+                              vk::ImageLayout::eGeneral, region);
+    _memory_barrier(vk::PipelineStageFlagBits::eTransfer,
+                    vk::AccessFlagBits::eTransferWrite,
+                    vk::PipelineStageFlagBits::eComputeShader,
+                    vk::AccessFlagBits::eShaderRead |
+                        vk::AccessFlagBits::eShaderWrite);
+  }
+
+  _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               _reproject_pipeline);
+  _dispatch_pixels(_settings.group_size_x, _settings.group_size_y);
+  _compute_memory_barrier();
+}
+
+void VulkanEngine::_record_resolve(std::uint32_t pixel_stride) {
+  const PassPushConstants push_constants = {.pixel_stride = pixel_stride,
+                                            .samples = 0};
+  _command_buffer.pushConstants(_pipeline_layout,
+                                vk::ShaderStageFlagBits::eCompute, 0,
+                                sizeof(push_constants), &push_constants);
+  _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               _resolve_pipeline);
+  _dispatch_pixels(_settings.group_size_x, _settings.group_size_y);
+}
+
+void VulkanEngine::_begin_command_buffer() {
   _command_buffer = _device
                         .allocateCommandBuffers({
                             .commandPool = _command_pool,
@@ -624,35 +1544,181 @@ void VulkanEngine::_create_command_buffer() {
   if (res != vk::Result::eSuccess)
     throw std::runtime_error("Vulkan error");
 
-  _command_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, _pipeline);
-
   std::vector<vk::DescriptorSet> descriptorSets = {_descriptor_set};
   _command_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
                                      _pipeline_layout, 0, descriptorSets,
                                      nullptr);
+}
+
+// Submits what the frame has recorded so far and waits for it, so that the
+// rest of the frame can be recorded from what the GPU wrote. Recording goes
+// on in a new command buffer.
+void VulkanEngine::_flush_command_buffer() {
+  _command_buffer.end();
+  _submit_and_wait(_command_buffer);
+  _device.freeCommandBuffers(_command_pool, _command_buffer);
+  _begin_command_buffer();
+  _compute_memory_barrier();
+}
 
-  vk::ImageMemoryBarrier image_barriers[2] = {
-      _image_pipeline_barrier(vk::AccessFlagBits::eNoneKHR,
-                              vk::AccessFlagBits::eShaderWrite,
-                              vk::ImageLayout::eUndefined,
-                              vk::ImageLayout::eGeneral, _swap_chain_image),
-      _image_pipeline_barrier(vk::AccessFlagBits::eNoneKHR,
-                              vk::AccessFlagBits::eShaderWrite,
-                              vk::ImageLayout::eUndefined,
-                              vk::ImageLayout::eGeneral, _summed_image.image),
+// Waits on a fence of its own, so other work on the queue goes on.
+void VulkanEngine::_submit_and_wait(const vk::CommandBuffer &command_buffer) {
+  const vk::SubmitInfo submit_info{
+      .commandBufferCount = 1,
+      .pCommandBuffers = &command_buffer,
   };
+  if (_compute_queue.submit(1, &submit_info, _flush_fence) !=
+      vk::Result::eSuccess)
+    throw std::runtime_error("Submit failed");
+  if (_device.waitForFences(1, &_flush_fence, true,
+                            std::numeric_limits<std::uint64_t>::max()) !=
+      vk::Result::eSuccess)
+    throw std::runtime_error("Fence wait failed");
+  _device.resetFences(_flush_fence);
+}
 
-  _command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
-                                  vk::PipelineStageFlagBits::eComputeShader,
-                                  vk::DependencyFlagBits::eByRegion, 0, nullptr,
-                                  0, nullptr, 2, image_barriers);
+void VulkanEngine::_create_command_buffer(
+    const RenderCallInfo &render_call_info) {
+  // Only called after the frame fence was waited on.
+  if (_command_buffer)
+    _device.freeCommandBuffers(_command_pool, _command_buffer);
+  _begin_command_buffer();
+
+  if (_timestamps_supported) {
+    _command_buffer.resetQueryPool(_timestamp_query_pool, 0, TIMESTAMP_COUNT);
+    _command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe,
+                                   _timestamp_query_pool,
+                                   TIMESTAMP_FRAME_BEGIN);
+  }
 
-  _command_buffer.dispatch(
-      static_cast<uint32_t>(std::ceil(float(_settings.window_width) /
-                                      float(_settings.group_size_x))),
-      static_cast<uint32_t>(std::ceil(float(_settings.window_height) /
-                                      float(_settings.group_size_y))),
-      1);
+  _record_scene_updates();
+
+  std::vector<vk::ImageMemoryBarrier> image_barriers;
+  // The accumulation images and the resolved image must keep their contents
+  // between frames, so they only leave the undefined layout once. The first
+  // frame restarts the accumulation like a clearing render call.
+  if (!_summed_image_initialized)
+    for (const auto &image :
+         {_summed_image, _history_image, _first_hit_image,
+          _previous_first_hit_image, _resolved_image}) {
+      auto barrier = _image_pipeline_barrier(
+          vk::AccessFlagBits::eNoneKHR, vk::AccessFlagBits::eShaderWrite,
+          vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, image.image);
+      barrier.dstAccessMask |= vk::AccessFlagBits::eTransferRead |
+                               vk::AccessFlagBits::eTransferWrite;
+      image_barriers.push_back(barrier);
+    }
+
+  _command_buffer.pipelineBarrier(
+      vk::PipelineStageFlagBits::eComputeShader,
+      vk::PipelineStageFlagBits::eComputeShader |
+          vk::PipelineStageFlagBits::eTransfer,
+      vk::DependencyFlagBits::eByRegion, 0, nullptr, 0, nullptr,
+      static_cast<uint32_t>(image_barriers.size()), image_barriers.data());
+  const auto accumulation_changed = !_summed_image_initialized ||
+                                    render_call_info.clear != 0 ||
+                                    render_call_info.read_only == 0;
+  if (!_summed_image_initialized || render_call_info.clear != 0)
+    _record_reprojection();
+  _summed_image_initialized = true;
+
+  _command_buffer.fillBuffer(_statistics_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+  _memory_barrier(vk::PipelineStageFlagBits::eTransfer,
+                  vk::AccessFlagBits::eTransferWrite,
+                  vk::PipelineStageFlagBits::eComputeShader,
+                  vk::AccessFlagBits::eShaderRead |
+                      vk::AccessFlagBits::eShaderWrite);
+
+  // Read-only render calls trace nothing. Render calls
+  // that restart the accumulation are a sign of a moving camera, so they trace
+  // a one sample per pixel preview at reduced resolution with the megakernel.
+  _profiled_group_size_x = _settings.group_size_x;
+  _profiled_group_size_y = _settings.group_size_y;
+  _profiled_pixel_stride = 1;
+  const auto preview = render_call_info.read_only == 0 &&
+                       render_call_info.clear != 0 &&
+                       _settings.preview_frame_ms > 0.0f;
+  _profiled_preview = preview;
+  if (render_call_info.read_only == 0) {
+    if (preview) {
+      _profiled_pixel_stride = _preview_pixel_stride;
+      _record_megakernel(_preview_pixel_stride, 1);
+    } else if (!_tiles.empty())
+      _record_megakernel(1, _settings.samples_per_pass);
+    else if (_integrator == Integrator::WAVEFRONT)
+      _record_wavefront();
+    else if (_integrator == Integrator::PERSISTENT)
+      _record_persistent();
+    else
+      _record_megakernel(1, _settings.samples_per_pass);
+    _compute_memory_barrier();
+  }
+  // Otherwise the resolved image still shows the accumulated sums.
+  if (accumulation_changed)
+    _record_resolve(_profiled_pixel_stride);
+
+  _memory_barrier(vk::PipelineStageFlagBits::eComputeShader,
+                  vk::AccessFlagBits::eShaderWrite,
+                  vk::PipelineStageFlagBits::eTransfer,
+                  vk::AccessFlagBits::eTransferRead);
+  const vk::BufferCopy statistics_copy = {.size = sizeof(ShaderStatistics)};
+  _command_buffer.copyBuffer(_statistics_buffer.buffer,
+                             _statistics_readback_buffer.buffer,
+                             statistics_copy);
+
+  if (_timestamps_supported)
+    _command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                                   _timestamp_query_pool,
+                                   TIMESTAMP_DISPATCH_END);
+
+  if (_settings.headless) {
+    if (_timestamps_supported)
+      _command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                                     _timestamp_query_pool,
+                                     TIMESTAMP_IMGUI_END);
+    _command_buffer.end();
+    return;
+  }
+
+  // The swapchain image gets a copy of the resolved image in every frame.
+  // Its barrier is recorded here, since the wavefront path tracer submits
+  // the first part of the frame before the image is acquired.
+  const auto image_barrier_to_transfer = _image_pipeline_barrier(
+      vk::AccessFlagBits::eNoneKHR, vk::AccessFlagBits::eTransferWrite,
+      vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal,
+      _swap_chain_image);
+  _command_buffer.pipelineBarrier(
+      vk::PipelineStageFlagBits::eTopOfPipe,
+      vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlagBits::eByRegion,
+      0, nullptr, 0, nullptr, 1, &image_barrier_to_transfer);
+
+  const vk::ImageSubresourceLayers color_layer = {
+      .aspectMask = vk::ImageAspectFlagBits::eColor,
+      .mipLevel = 0,
+      .baseArrayLayer = 0,
+      .layerCount = 1,
+  };
+  const vk::ImageCopy resolved_copy = {
+      .srcSubresource = color_layer,
+      .srcOffset = {0, 0, 0},
+      .dstSubresource = color_layer,
+      .dstOffset = {0, 0, 0},
+      .extent = {_settings.window_width, _settings.window_height, 1},
+  };
+  _command_buffer.copyImage(_resolved_image.image, vk::ImageLayout::eGeneral,
+                            _swap_chain_image,
+                            vk::ImageLayout::eTransferDstOptimal,
+                            resolved_copy);
+  const auto image_barrier_to_attachment = _image_pipeline_barrier(
+      vk::AccessFlagBits::eTransferWrite,
+      vk::AccessFlagBits::eColorAttachmentWrite,
+      vk::ImageLayout::eTransferDstOptimal,
+      vk::ImageLayout::eColorAttachmentOptimal, _swap_chain_image);
+  _command_buffer.pipelineBarrier(
+      vk::PipelineStageFlagBits::eTransfer,
+      vk::PipelineStageFlagBits::eColorAttachmentOutput,
+      vk::DependencyFlagBits::eByRegion, 0, nullptr, 0, nullptr, 1,
+      &image_barrier_to_attachment);
 
   vk::RenderingAttachmentInfo color_attachment{
       .pNext = nullptr,
@@ -678,20 +1744,27 @@ void VulkanEngine::_create_command_buffer() {
       _device, "vkCmdEndRenderingKHR");
   end_rendering(_command_buffer);
 
+  if (_timestamps_supported)
+    _command_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe,
+                                   _timestamp_query_pool, TIMESTAMP_IMGUI_END);
+
   vk::ImageMemoryBarrier image_barrier_to_present = _image_pipeline_barrier(
-      vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eMemoryRead,
-      vk::ImageLayout::eGeneral, vk::ImageLayout::ePresentSrcKHR,
-      _swap_chain_image);
-  _command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
-                                  vk::PipelineStageFlagBits::eBottomOfPipe,
-                                  vk::DependencyFlagBits::eByRegion, 0, nullptr,
-                                  0, nullptr, 1, &image_barrier_to_present);
+      vk::AccessFlagBits::eColorAttachmentWrite,
+      vk::AccessFlagBits::eMemoryRead,
+      vk::ImageLayout::eColorAttachmentOptimal,
+      vk::ImageLayout::ePresentSrcKHR, _swap_chain_image);
+  _command_buffer.pipelineBarrier(
+      vk::PipelineStageFlagBits::eColorAttachmentOutput,
+      vk::PipelineStageFlagBits::eBottomOfPipe,
+      vk::DependencyFlagBits::eByRegion, 0, nullptr, 0, nullptr, 1,
+      &image_barrier_to_present);
 
   _command_buffer.end();
 }
 
 void VulkanEngine::_create_fence() {
   _fence = _device.createFence({.flags = vk::FenceCreateFlagBits::eSignaled});
+  _flush_fence = _device.createFence({});
 }
 
 void VulkanEngine::_create_semaphore() {
@@ -699,50 +1772,234 @@ void VulkanEngine::_create_semaphore() {
   _render_sema = _device.createSemaphore({});
 }
 
-VulkanEngine::VulkanEngine(const Settings &settings) : _settings(settings) {
-  _create_window();
+void VulkanEngine::_create_timestamp_query_pool() {
+  const auto queue_families = _selected_dev.getQueueFamilyProperties();
+  _timestamp_period = _selected_dev.getProperties().limits.timestampPeriod;
+  _timestamps_supported =
+      queue_families[_compute_queue_family].timestampValidBits > 0 &&
+      _timestamp_period > 0.0f;
+  if (!_timestamps_supported) {
+    std::cout << "Timestamp queries are not supported on the compute queue"
+              << std::endl;
+    return;
+  }
+
+  _timestamp_query_pool = _device.createQueryPool({
+      .queryType = vk::QueryType::eTimestamp,
+      .queryCount = TIMESTAMP_COUNT,
+  });
+}
+
+// Reads the timestamps and shader counters of the previous frame. This is only
+// called after the frame fence has been waited on, so the results are already
+// available and reading them never stalls.
+void VulkanEngine::_read_frame_stats() {
+  if (_frame_count == 0)
+    return;
+
+  ShaderStatistics statistics;
+  std::memcpy(&statistics, _statistics_readback_buffer.allocation.mapped,
+              sizeof(ShaderStatistics));
+  _frame_stats.frame = _frame_count - 1;
+  _frame_stats.rays = statistics.rays;
+  _frame_stats.portal_traversals = statistics.portal_traversals;
+  _frame_stats.upload_bytes = _recorded_upload_bytes;
+  _frame_stats.lane_utilization =
+      statistics.lane_steps == 0
+          ? 0.0f
+          : static_cast<float>(statistics.rays) / statistics.lane_steps;
+
+  if (!_timestamps_supported || !_timestamps_pending)
+    return;
+  _timestamps_pending = false;
+
+  const auto timestamps = _device.getQueryPoolResults<std::uint64_t>(
+      _timestamp_query_pool, 0, TIMESTAMP_COUNT,
+      TIMESTAMP_COUNT * sizeof(std::uint64_t), sizeof(std::uint64_t),
+      vk::QueryResultFlagBits::e64);
+  if (timestamps.result != vk::Result::eSuccess)
+    return;
+
+  const auto ticks_to_ms = [this](std::uint64_t begin, std::uint64_t end) {
+    return static_cast<float>(end - begin) * _timestamp_period * 1e-6f;
+  };
+  const auto &ticks = timestamps.value;
+  _frame_stats.dispatch_ms = ticks_to_ms(ticks[TIMESTAMP_FRAME_BEGIN],
+                                         ticks[TIMESTAMP_DISPATCH_END]);
+  _frame_stats.imgui_ms =
+      ticks_to_ms(ticks[TIMESTAMP_DISPATCH_END], ticks[TIMESTAMP_IMGUI_END]);
+
+  _frame_stats.group_size_x = _profiled_group_size_x;
+  _frame_stats.group_size_y = _profiled_group_size_y;
+  _frame_stats.pixel_stride = _profiled_pixel_stride;
+  _frame_stats.mrays_per_second =
+      _frame_stats.dispatch_ms > 0.0f
+          ? static_cast<float>(_frame_stats.rays /
+                               (_frame_stats.dispatch_ms * 1e-3) / 1e6)
+          : 0.0f;
+
+  static const char *integrator_names[] = {"megakernel", "wavefront",
+                                           "persistent"};
+  if (_profile_csv.is_open())
+    _profile_csv << _frame_stats.frame << ","
+                 << integrator_names[static_cast<int>(_profiled_integrator)]
+                 << "," << _frame_stats.dispatch_ms << ","
+                 << _frame_stats.imgui_ms << "," << _frame_stats.present_ms
+                 << "," << _frame_stats.rays << ","
+                 << _frame_stats.mrays_per_second << ","
+                 << _frame_stats.lane_utilization << ","
+                 << _frame_stats.group_size_x << "x"
+                 << _frame_stats.group_size_y << ","
+                 << _frame_stats.pixel_stride << ","
+                 << _frame_stats.upload_bytes << std::endl;
+
+  // The traced pixel count goes with the inverse square of the stride, so
+  // scale the stride by the square root of how far off the target we were.
+  if (_profiled_preview && _frame_stats.dispatch_ms > 0.0f) {
+    const auto stride =
+        std::ceil(static_cast<float>(_profiled_pixel_stride) *
+                  std::sqrt(_frame_stats.dispatch_ms /
+                            _settings.preview_frame_ms));
+    _preview_pixel_stride = std::clamp(static_cast<std::uint32_t>(stride),
+                                       1u, _max_preview_pixel_stride);
+  }
+
+  if (_profiled_candidate.has_value()) {
+    auto &candidate = _group_size_candidates[*_profiled_candidate];
+    if (_tuned_frames >= _group_size_candidates.size())
+      candidate.total_ms += _frame_stats.dispatch_ms;
+    _profiled_candidate.reset();
+    if (++_tuned_frames == _group_size_candidates.size() * _tuning_rounds)
+      _finish_group_size_tuning();
+  }
+}
+
+VulkanEngine::VulkanEngine(const Settings &settings)
+    : _settings(settings),
+      _temporal_reprojection(settings.temporal_reprojection),
+      _integrator(settings.integrator),
+      _startup_begin(std::chrono::steady_clock::now()) {
+  if (!_settings.headless)
+    _create_window();
   _create_instance();
-  _create_surface();
+  if (!_settings.headless)
+    _create_surface();
   _select_phys_device();
   _find_queue_families();
+  _query_resident_invocations();
   _create_logical_device();
+  _allocator.emplace(_selected_dev, _device);
   _create_scene_buffer();
   _create_render_call_info_buffer();
+  _create_viewport_buffer();
+  _create_light_buffer();
+  // The gradient sky, shaders never read the texel.
+  _upload_environment({.width = 0, .height = 0, .padding = {0, 0}},
+                      {{.color = {0, 0, 0},
+                        .pdf = 0,
+                        .probability = 1,
+                        .alias = 0}});
   _create_summed_pixel_color_image();
+  _create_reprojection_resources();
+  _create_wavefront_buffers();
+  _create_statistics_buffers();
+  _create_accumulation_buffer();
   _create_command_pool();
   _create_swap_chain();
   _create_descriptor_set_layout();
   _create_descriptor_pool();
   _create_descriptor_set();
   _create_pipeline_layout();
+  _create_pipeline_cache();
   _create_pipeline();
-  _setup_imgui();
+  _create_wavefront_pipelines();
+  _create_persistent_pipelines();
+  _create_resolve_pipeline();
+  _create_reproject_pipeline();
+  if (!_settings.headless)
+    _setup_imgui();
   _create_fence();
   _create_semaphore();
+  _create_timestamp_query_pool();
+  _create_group_size_candidates();
+
+  const auto memory = _allocator->statistics();
+  std::cout << "GPU memory: " << memory.allocation_count << " allocations, "
+            << memory.used_bytes / (1 << 20) << " of "
+            << memory.reserved_bytes / (1 << 20) << " MiB used in "
+            << memory.block_count << " blocks ("
+            << memory.host_visible_bytes / (1 << 20) << " MiB host visible)"
+            << std::endl;
+
+  if (!_settings.profile_csv_file.empty()) {
+    const auto properties = _selected_dev.getProperties();
+    _profile_csv.open(_settings.profile_csv_file);
+    if (!_profile_csv.is_open())
+      throw std::runtime_error("Failed to open: " +
+                               _settings.profile_csv_file);
+    _profile_csv << "# device: " << properties.deviceName.data()
+                 << ", driver: " << properties.driverVersion
+                 << ", shader: " << _settings.shader_file << "\n"
+                 << "frame,integrator,dispatch_ms,imgui_ms,present_ms,rays,"
+                    "mrays_per_second,lane_utilization,group_size,"
+                    "pixel_stride,upload_bytes"
+                 << std::endl;
+  }
 }
 
 VulkanEngine::~VulkanEngine() {
   _destroy_image(_summed_image);
+  _destroy_image(_history_image);
+  _destroy_image(_first_hit_image);
+  _destroy_image(_previous_first_hit_image);
+  _destroy_buffer(_reprojection_info_buffer);
   _destroy_buffer(_scene_buffer);
   _destroy_buffer(_render_call_info_buffer);
+  _destroy_buffer(_viewport_buffer);
+  _destroy_buffer(_light_buffer);
+  _destroy_buffer(_environment_buffer);
+  _destroy_buffer(_path_buffer);
+  _destroy_buffer(_queue_buffer);
+  _destroy_buffer(_live_path_readback_buffer);
+  if (_summed_readback_command_buffer)
+    _destroy_buffer(_summed_readback_buffer);
+  _destroy_buffer(_statistics_buffer);
+  _destroy_buffer(_statistics_readback_buffer);
+  _destroy_buffer(_accumulation_buffer);
 
   _device.destroySemaphore(_sema);
   _device.destroyFence(_fence);
+  _device.destroyFence(_flush_fence);
   _device.destroySemaphore(_render_sema);
-  _device.destroyPipeline(_pipeline);
+  if (_timestamps_supported)
+    _device.destroyQueryPool(_timestamp_query_pool);
+  _destroy_pipelines();
+  for (const auto &candidate : _group_size_candidates)
+    _device.destroyPipeline(candidate.pipeline);
+  _save_pipeline_cache();
+  _device.destroyPipelineCache(_pipeline_cache);
   _device.destroyPipelineLayout(_pipeline_layout);
   _device.destroyDescriptorSetLayout(_descriptor_set_layout);
   _device.destroyDescriptorPool(_descriptor_pool);
-  _device.destroyImageView(_swap_chain_image_view);
-  _device.destroySwapchainKHR(_swap_chain);
+  _destroy_image(_resolved_image);
+  if (!_settings.headless) {
+    _device.destroyImageView(_swap_chain_image_view);
+    _device.destroySwapchainKHR(_swap_chain);
+  }
   _device.destroyCommandPool(_command_pool);
+  _allocator.reset();
   _device.destroy();
 
+  if (_settings.headless)
+    return;
   glfwDestroyWindow(_window);
   glfwTerminate();
 }
 
-void VulkanEngine::update() { glfwPollEvents(); }
+void VulkanEngine::update() {
+  if (!_settings.headless)
+    glfwPollEvents();
+}
 
 void VulkanEngine::render(const RenderCallInfo &render_call_info,
                           const gpu::Scene &scene) {
@@ -751,10 +2008,32 @@ void VulkanEngine::render(const RenderCallInfo &render_call_info,
   if (res != vk::Result::eSuccess)
     throw std::runtime_error("Fence wait failed");
   _device.resetFences(_fence);
+  _read_frame_stats();
+  _specialize_material_kinds(scene.material_kinds());
 
   _update_render_call_info_buffer(render_call_info);
   _update_scene_buffer(scene);
-  _create_command_buffer();
+  _update_light_buffer(scene);
+  const auto viewport = gpu::Viewport::from_camera(
+      scene.camera, _settings.window_width, _settings.window_height);
+  _update_viewport_buffer(viewport);
+  if (!_summed_image_initialized || render_call_info.clear != 0)
+    _update_reprojection_info_buffer(viewport);
+  _create_command_buffer(render_call_info);
+
+  if (_settings.headless) {
+    const vk::SubmitInfo submit_info{
+        .commandBufferCount = 1,
+        .pCommandBuffers = &_command_buffer,
+    };
+    res = _compute_queue.submit(1, &submit_info, _fence);
+    if (res != vk::Result::eSuccess)
+      throw std::runtime_error("Submit failed");
+    _profiled_integrator = _integrator;
+    _timestamps_pending = _timestamps_supported;
+    _frame_count++;
+    return;
+  }
 
   const auto swap_chain_image_result = _device.acquireNextImageKHR(
       _swap_chain, std::numeric_limits<std::uint64_t>::max(), _sema);
@@ -774,6 +2053,9 @@ void VulkanEngine::render(const RenderCallInfo &render_call_info,
   res = _compute_queue.submit(1, &submit_info, _fence);
   if (res != vk::Result::eSuccess)
     throw std::runtime_error("Submit failed");
+  _profiled_integrator = _integrator;
+  _timestamps_pending = _timestamps_supported;
+  _frame_count++;
 
   vk::PresentInfoKHR present_info{
       .waitSemaphoreCount = 1,
@@ -784,9 +2066,128 @@ void VulkanEngine::render(const RenderCallInfo &render_call_info,
   };
   if (swap_chain_image_index != 0)
     return;
+  const auto present_begin = std::chrono::steady_clock::now();
   res = _present_queue.presentKHR(present_info);
+  const auto present_end = std::chrono::steady_clock::now();
+  _frame_stats.present_ms =
+      std::chrono::duration<float, std::milli>(present_end - present_begin)
+          .count();
+
+  if (_frame_count == 1)
+    std::cout << "Time to first frame: "
+              << std::chrono::duration<float, std::milli>(present_end -
+                                                          _startup_begin)
+                     .count()
+              << " ms (" << (_pipeline_cache_loaded ? "warm" : "cold")
+              << " pipeline cache)" << std::endl;
 }
 
 bool VulkanEngine::should_exit() const {
-  return glfwWindowShouldClose(_window);
+  return !_settings.headless && glfwWindowShouldClose(_window);
+}
+
+const FrameStats &VulkanEngine::frame_stats() const { return _frame_stats; }
+
+void VulkanEngine::set_integrator(Integrator integrator) {
+  _integrator = integrator;
+}
+
+Integrator VulkanEngine::integrator() const { return _integrator; }
+
+void VulkanEngine::set_temporal_reprojection(bool enabled) {
+  _temporal_reprojection = enabled;
+}
+
+bool VulkanEngine::temporal_reprojection() const {
+  return _temporal_reprojection;
+}
+
+MemoryStatistics VulkanEngine::memory_statistics() const {
+  return _allocator->statistics();
+}
+
+void VulkanEngine::set_tiles(const std::vector<Tile> &tiles) { _tiles = tiles; }
+
+void VulkanEngine::set_environment(const Environment &environment) {
+  _device.waitIdle();
+  _destroy_buffer(_environment_buffer);
+  _upload_environment({.width = environment.width(),
+                       .height = environment.height(),
+                       .padding = {0, 0}},
+                      environment.texels());
+  _write_environment_descriptor();
+}
+
+void VulkanEngine::wait_for_frame() {
+  const auto res = _device.waitForFences(
+      1, &_fence, true, std::numeric_limits<std::uint64_t>::max());
+  if (res != vk::Result::eSuccess)
+    throw std::runtime_error("Fence wait failed");
+}
+
+void VulkanEngine::_create_summed_readback() {
+  const vk::DeviceSize pixel_count =
+      static_cast<vk::DeviceSize>(_settings.window_width) *
+      _settings.window_height;
+  _summed_readback_buffer =
+      _create_buffer(pixel_count * sizeof(glm::vec4),
+                     vk::BufferUsageFlagBits::eTransferDst,
+                     vk::MemoryPropertyFlagBits::eHostVisible |
+                         vk::MemoryPropertyFlagBits::eHostCoherent);
+  _summed_readback_command_buffer =
+      _device
+          .allocateCommandBuffers({
+              .commandPool = _command_pool,
+              .level = vk::CommandBufferLevel::ePrimary,
+              .commandBufferCount = 1,
+          })
+          .front();
+  const auto &command_buffer = _summed_readback_command_buffer;
+  command_buffer.begin(vk::CommandBufferBeginInfo{});
+  const auto barrier = _image_pipeline_barrier(
+      vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead,
+      vk::ImageLayout::eGeneral, vk::ImageLayout::eGeneral,
+      _summed_image.image);
+  command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                 vk::PipelineStageFlagBits::eTransfer, {},
+                                 nullptr, nullptr, barrier);
+  command_buffer.copyImageToBuffer(
+      _summed_image.image, vk::ImageLayout::eGeneral,
+      _summed_readback_buffer.buffer,
+      vk::BufferImageCopy{
+          .bufferOffset = 0,
+          .bufferRowLength = 0,
+          .bufferImageHeight = 0,
+          .imageSubresource = {.aspectMask = vk::ImageAspectFlagBits::eColor,
+                               .mipLevel = 0,
+                               .baseArrayLayer = 0,
+                               .layerCount = 1},
+          .imageOffset = {0, 0, 0},
+          .imageExtent = {.width = _settings.window_width,
+                          .height = _settings.window_height,
+                          .depth = 1},
+      });
+  const vk::MemoryBarrier host_barrier{
+      .srcAccessMask = vk::AccessFlagBits::eTransferWrite,
+      .dstAccessMask = vk::AccessFlagBits::eHostRead,
+  };
+  command_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                 vk::PipelineStageFlagBits::eHost, {},
+                                 host_barrier, nullptr, nullptr);
+  command_buffer.end();
+}
+
+std::vector<glm::vec4> VulkanEngine::read_summed_image() {
+  wait_for_frame();
+  if (!_summed_readback_command_buffer)
+    _create_summed_readback();
+  _submit_and_wait(_summed_readback_command_buffer);
+
+  const auto pixel_count =
+      static_cast<std::size_t>(_settings.window_width) *
+      _settings.window_height;
+  std::vector<glm::vec4> pixels(pixel_count);
+  std::memcpy(pixels.data(), _summed_readback_buffer.allocation.mapped,
+              pixel_count * sizeof(glm::vec4));
+  return pixels;
 }